@@ -11,9 +11,78 @@ int main(int argc, char* argv[]) {
     std::string port;
     app.add_option("PORT", port, "Port")->required();
 
+    NHttpProxy::TServerOptions options;
+    app.add_option("--threads", options.Threads, "Number of worker threads", true)
+        ->check(CLI::Range(1, 1024));
+
+    int dnsTtl = options.Resolver.Ttl.count();
+    app.add_option("--dns-ttl", dnsTtl, "Seconds to cache resolved names for", true);
+
+    int dnsNegativeTtl = options.Resolver.NegativeTtl.count();
+    app.add_option("--dns-negative-ttl", dnsNegativeTtl, "Seconds to cache failed lookups for", true);
+
+    app.add_option("--pool-max-idle", options.ConnectionPool.MaxIdle,
+        "Idle upstream connections kept in total", true);
+    app.add_option("--pool-max-idle-per-host", options.ConnectionPool.MaxIdlePerHost,
+        "Idle upstream connections kept to a single host", true);
+
+    int poolIdleTimeout = options.ConnectionPool.IdleTimeout.count();
+    app.add_option("--pool-idle-timeout", poolIdleTimeout,
+        "Seconds to keep an idle upstream connection for", true);
+
+    int idleTimeout = options.Session.IdleTimeout.count();
+    app.add_option("--idle-timeout", idleTimeout,
+        "Seconds a client connection may wait for the next request", true);
+    app.add_option("--max-requests", options.Session.MaxRequests,
+        "Requests served over one client connection", true);
+
+    app.add_option("--compression-threads", options.Compression.Threads,
+        "Threads compressing responses", true);
+    app.add_option("--compression-min-size", options.Compression.Compression.MinSize,
+        "Smallest response body worth compressing, in bytes", true);
+    app.add_option("--compression-cpu-weight", options.Compression.Compression.CpuWeight,
+        "Between codings a client accepts equally, 1 prefers the cheapest, 0 the smallest output", true)
+        ->check(CLI::Range(0.0, 1.0));
+
+    std::size_t cacheSize = options.Database.MaxBytes >> 20;
+    app.add_option("--cache-size", cacheSize, "Cache budget in MiB", true);
+    auto maxStale = options.Database.MaxStale.count();
+    app.add_option("--cache-max-stale", maxStale,
+        "Seconds expired responses with a validator are kept for revalidation", true);
+
+    int revalidateTimeout = options.Revalidator.Timeout.count();
+    app.add_option("--revalidate-timeout", revalidateTimeout,
+        "Seconds a background revalidation may take", true);
+
+    app.add_option("--disk-cache-dir", options.Database.Disk.Directory,
+        "Directory for the on-disk cache tier, none by default");
+    std::size_t diskCacheSize = options.Database.Disk.MaxBytes >> 20;
+    app.add_option("--disk-cache-size", diskCacheSize, "Disk cache budget in MiB", true);
+
+    app.add_option("--access-log", options.AccessLog,
+        "File to append the access log to, - for stdout, an empty string to disable", true);
+    app.add_option("--access-log-buffer", options.AccessLogCapacity,
+        "Access log records waiting to be written; the ones beyond are dropped", true);
+
+    app.add_option("--admin-host", options.AdminHost, "Host to serve the metrics on", true);
+    app.add_option("--admin-port", options.AdminPort,
+        "Port to serve the metrics on in the Prometheus format at /metrics, none by default");
+
     CLI11_PARSE(app, argc, argv);
 
-    NHttpProxy::TServer server;
+    options.Database.MaxBytes = cacheSize << 20;
+    options.Database.MaxStale = std::chrono::seconds(maxStale);
+    options.Database.Disk.MaxBytes = diskCacheSize << 20;
+    options.Revalidator.Timeout = std::chrono::seconds(revalidateTimeout);
+
+    options.Session.IdleTimeout = std::chrono::seconds(idleTimeout);
+
+    options.ConnectionPool.IdleTimeout = std::chrono::seconds(poolIdleTimeout);
+
+    options.Resolver.Ttl = std::chrono::seconds(dnsTtl);
+    options.Resolver.NegativeTtl = std::chrono::seconds(dnsNegativeTtl);
+
+    NHttpProxy::TServer server(options);
     server.Bind(host, port);
 
     server.Run();
@@ -0,0 +1,200 @@
+#include <HTTP.h>
+
+#include <CLI/CLI11.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using NHttpProxy::THttpHeader;
+using NHttpProxy::THttpHeaders;
+
+// The header container as it was before: fields in a vector and the first
+// value of each name mirrored in a map, looked up case-sensitively
+class TMapHeaders {
+public:
+    struct THeader {
+        std::string Key;
+        std::string Value;
+    };
+
+    TMapHeaders(const std::vector<THeader>& headers)
+        : Headers_(headers)
+    {
+        for (const auto& header : Headers_) {
+            Values_.emplace(header.Key, header.Value);
+        }
+    }
+
+    void Append(const THeader& header) {
+        Headers_.emplace_back(header);
+        Values_.emplace(header.Key, header.Value);
+    }
+
+    std::optional<THeader> Find(const std::string& key) const {
+        auto it = Values_.find(key);
+        if (it == Values_.end()) {
+            return {};
+        }
+        return THeader{it->first, it->second};
+    }
+
+    void Update(const THeader& header) {
+        auto it = Values_.find(header.Key);
+        if (it == Values_.end()) {
+            Append(header);
+            return;
+        }
+        it->second = header.Value;
+        for (auto& h : Headers_) {
+            if (h.Key == header.Key) {
+                h = header;
+            }
+        }
+    }
+
+    void Remove(const std::string& key) {
+        Values_.erase(key);
+        Headers_.erase(
+            std::remove_if(Headers_.begin(), Headers_.end(), [&key](const THeader& header) {
+                return header.Key == key;
+            }),
+            Headers_.end()
+        );
+    }
+
+    std::string Serialize() const {
+        std::string ret;
+        for (const auto& header : Headers_) {
+            ret += header.Key + ": " + header.Value + "\r\n";
+        }
+        return ret;
+    }
+
+private:
+    std::vector<THeader> Headers_;
+    std::map<std::string, std::string> Values_;
+};
+
+// Fields of a typical upstream response
+const std::vector<std::pair<std::string, std::string>> Fields = {
+    {"Date", "Thu, 15 Oct 2026 10:00:00 GMT"},
+    {"Server", "nginx/1.24.0"},
+    {"Content-Type", "text/html; charset=utf-8"},
+    {"Content-Length", "48213"},
+    {"Connection", "keep-alive"},
+    {"Keep-Alive", "timeout=5"},
+    {"Cache-Control", "public, max-age=300"},
+    {"ETag", "\"5f2a-64c1b2\""},
+    {"Last-Modified", "Wed, 14 Oct 2026 08:12:45 GMT"},
+    {"Vary", "Accept-Language"},
+    {"X-Request-Id", "4be6a1f2c09d"},
+    {"Accept-Ranges", "bytes"}
+};
+
+// Keeps the compiler from dropping the measured work
+volatile std::size_t Sink = 0;
+
+double Measure(std::size_t iterations, const std::function<void()>& body) {
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; i++) {
+        body();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+void Report(const std::string& name, double before, double after) {
+    std::cout << std::setw(10) << name
+              << std::setw(12) << std::fixed << std::setprecision(1) << before
+              << std::setw(12) << after
+              << std::setw(10) << std::setprecision(2) << before / after << "x" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    CLI::App app("Header container micro-benchmark");
+
+    std::size_t iterations = 1000000;
+    app.add_option("--iterations", iterations, "Iterations per measurement", true);
+
+    CLI11_PARSE(app, argc, argv);
+
+    auto buildOld = [] {
+        TMapHeaders headers({});
+        for (const auto& [key, value] : Fields) {
+            headers.Append({key, value});
+        }
+        return headers;
+    };
+    auto buildNew = [] {
+        THttpHeaders headers;
+        for (const auto& [key, value] : Fields) {
+            headers.Append({key, value});
+        }
+        return headers;
+    };
+    const TMapHeaders oldHeaders = buildOld();
+    const THttpHeaders newHeaders = buildNew();
+
+    std::cout << std::setw(10) << "ns/op"
+              << std::setw(12) << "map"
+              << std::setw(12) << "flat"
+              << std::setw(11) << "speedup" << std::endl;
+
+    // Filling the container, as the parser does
+    Report(
+        "build",
+        Measure(iterations, [&] { Sink += buildOld().Find("Date").has_value(); }),
+        Measure(iterations, [&] { Sink += buildNew().Find(NHttpProxy::EHeader::Date) != nullptr; })
+    );
+
+    // The lookups a response goes through on its way to the client
+    const std::vector<std::string> names = {"Content-Encoding", "Content-Length", "Content-Type", "Transfer-Encoding", "Vary"};
+    Report(
+        "find",
+        Measure(iterations, [&] {
+            for (const auto& name : names) {
+                auto header = oldHeaders.Find(name);
+                Sink += header.has_value() ? header->Value.size() : 0;
+            }
+        }),
+        Measure(iterations, [&] {
+            for (const auto& name : names) {
+                const THttpHeader* header = newHeaders.Find(name);
+                Sink += header != nullptr ? header->Value().size() : 0;
+            }
+        })
+    );
+
+    // Copying, dropping hop-by-hop headers, updating and serializing
+    Report(
+        "rewrite",
+        Measure(iterations, [&] {
+            TMapHeaders headers = oldHeaders;
+            headers.Remove("Connection");
+            headers.Remove("Keep-Alive");
+            headers.Remove("Proxy-Connection");
+            headers.Update({"Content-Length", "1024"});
+            Sink += headers.Serialize().size();
+        }),
+        Measure(iterations, [&] {
+            THttpHeaders headers = newHeaders;
+            NHttpProxy::RemoveHopByHopHeaders(headers);
+            headers.Update({NHttpProxy::EHeader::ContentLength, "1024"});
+            Sink += headers.Serialize().size();
+        })
+    );
+
+    return 0;
+}
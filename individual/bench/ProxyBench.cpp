@@ -0,0 +1,440 @@
+#include <Histogram.h>
+#include <HTTP.h>
+#include <Server.h>
+
+#include <CLI/CLI11.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace {
+
+using boost::asio::ip::tcp;
+using NHttpProxy::EParseResult;
+using NHttpProxy::THistogram;
+
+// Text the bodies are made of, so that compressing them is like
+// compressing a real page
+std::string MakeBody(std::size_t size) {
+    static const std::vector<std::string> words = {
+        "proxy", "cache", "request", "response", "header", "body", "client", "server",
+        "connection", "latency", "<div>", "</div>", "class=\"item\"", "\n", "the", "of"
+    };
+    std::mt19937 random(static_cast<unsigned>(size));
+    std::uniform_int_distribution<std::size_t> word(0, words.size() - 1);
+    std::string ret;
+    while (ret.size() < size) {
+        ret += words[word(random)];
+        ret += ' ';
+    }
+    ret.resize(size);
+    return ret;
+}
+
+// Stand-in origin server. The path is /c/<size>/<id> for a cacheable
+// object and /u/<size>/<id> for one that is never stored; connections are
+// kept alive.
+class TOrigin {
+public:
+    TOrigin(const std::vector<std::size_t>& sizes, std::size_t threads)
+        : Acceptor_(IOContext_, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0))
+        , Threads_(threads)
+    {
+        for (std::size_t size : sizes) {
+            Bodies_.emplace(size, MakeBody(size));
+        }
+    }
+
+    unsigned short Port() const {
+        return Acceptor_.local_endpoint().port();
+    }
+
+    void Start() {
+        Accept();
+        for (std::size_t i = 0; i < Threads_; i++) {
+            Workers_.emplace_back([this]() { IOContext_.run(); });
+        }
+    }
+
+    void Stop() {
+        IOContext_.stop();
+        for (auto& worker : Workers_) {
+            worker.join();
+        }
+    }
+
+private:
+    struct TConnection : std::enable_shared_from_this<TConnection> {
+        TConnection(tcp::socket socket, const std::map<std::size_t, std::string>& bodies)
+            : Socket(std::move(socket))
+            , Bodies(bodies)
+        {}
+
+        void Read() {
+            boost::asio::async_read_until(
+                Socket,
+                boost::asio::dynamic_buffer(Request),
+                "\r\n\r\n",
+                [self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+                    if (ec) {
+                        return;
+                    }
+                    // The response may be written and the next read
+                    // started on another thread before this one returns
+                    std::string request = self->Request.substr(0, size);
+                    self->Request.erase(0, size);
+                    self->Respond(request);
+                }
+            );
+        }
+
+        void Respond(std::string_view request) {
+            // The proxy sends the URL in the absolute form
+            std::string_view target = request.substr(0, request.find("\r\n"));
+            target = target.substr(target.find(' ') + 1);
+            if (target.substr(0, 7) == "http://") {
+                target = target.substr(target.find('/', 7));
+            }
+            if (target.size() < 4) {
+                return;
+            }
+            bool cacheable = target.substr(0, 3) == "/c/";
+            auto body = Bodies.find(std::strtoul(target.data() + 3, nullptr, 10));
+            if (body == Bodies.end()) {
+                return;
+            }
+
+            Head = "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/html; charset=utf-8\r\n"
+                "Content-Length: " + std::to_string(body->second.size()) + "\r\n";
+            Head += cacheable ? "Cache-Control: max-age=3600\r\n" : "Cache-Control: no-store\r\n";
+            Head += "\r\n";
+            std::array<boost::asio::const_buffer, 2> buffers = {
+                boost::asio::buffer(Head),
+                boost::asio::buffer(body->second)
+            };
+            boost::asio::async_write(
+                Socket,
+                buffers,
+                [self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+                    if (!ec) {
+                        self->Read();
+                    }
+                }
+            );
+        }
+
+        tcp::socket Socket;
+        const std::map<std::size_t, std::string>& Bodies;
+        std::string Request;
+        std::string Head;
+    };
+
+    void Accept() {
+        Acceptor_.async_accept(
+            [this](boost::system::error_code ec, tcp::socket socket) {
+                if (!ec) {
+                    socket.set_option(tcp::no_delay(true), ec);
+                    std::make_shared<TConnection>(std::move(socket), Bodies_)->Read();
+                }
+                Accept();
+            }
+        );
+    }
+
+    boost::asio::io_context IOContext_;
+    tcp::acceptor Acceptor_;
+    std::size_t Threads_;
+    std::map<std::size_t, std::string> Bodies_;
+    std::vector<std::thread> Workers_;
+};
+
+// What the clients ask for
+struct TWorkload {
+    std::string Origin;
+    std::vector<std::size_t> Sizes;
+    std::vector<double> Weights;
+    // Share of requests going to the cacheable objects
+    double HitRatio = 0;
+    std::vector<std::string> HotPaths;
+    bool KeepAlive = false;
+    bool Gzip = false;
+
+    std::string Request(const std::string& path) const {
+        std::string ret = "GET http://" + Origin + path + " HTTP/1.1\r\n"
+            "Host: " + Origin + "\r\n";
+        if (Gzip) {
+            ret += "Accept-Encoding: gzip\r\n";
+        }
+        ret += KeepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+        ret += "\r\n";
+        return ret;
+    }
+};
+
+// One connection to the proxy at a time, reused if the workload keeps
+// connections alive and the proxy agrees
+class TClient {
+public:
+    TClient(const tcp::endpoint& proxy, const TWorkload& workload)
+        : Proxy_(proxy)
+        , Workload_(workload)
+        , Socket_(Context_)
+    {}
+
+    // Returns false if the request fails or the response is not 200 OK
+    bool Fetch(const std::string& path) {
+        boost::system::error_code ec;
+        if (!Socket_.is_open()) {
+            Socket_.connect(Proxy_, ec);
+            if (ec) {
+                return false;
+            }
+            Socket_.set_option(tcp::no_delay(true), ec);
+        }
+        Request_ = Workload_.Request(path);
+        boost::asio::write(Socket_, boost::asio::buffer(Request_), ec);
+
+        Parser_.Reset();
+        Parser_.StreamBody([](std::string_view) {});
+        EParseResult status = EParseResult::Await;
+        while (!ec && status != EParseResult::Parsed && status != EParseResult::Error) {
+            std::size_t size = Socket_.read_some(boost::asio::buffer(Buffer_), ec);
+            if (ec == boost::asio::error::eof) {
+                status = Parser_.Finish();
+                break;
+            }
+            // The head and the body are consumed one after another
+            std::string_view data(Buffer_.data(), size);
+            do {
+                status = Parser_.Consume(data);
+            } while (!data.empty() && status == EParseResult::Head);
+        }
+        if (status != EParseResult::Parsed) {
+            Close();
+            return false;
+        }
+        auto head = Parser_.TakeParsed();
+        if (!Workload_.KeepAlive || !NHttpProxy::KeepsConnection(head.ResponseStatusLine().HttpVersion(), head.Headers())) {
+            Close();
+        }
+        return head.ResponseStatusLine().StatusCode() == "200";
+    }
+
+private:
+    void Close() {
+        boost::system::error_code ignored;
+        Socket_.close(ignored);
+    }
+
+    tcp::endpoint Proxy_;
+    const TWorkload& Workload_;
+    boost::asio::io_context Context_;
+    tcp::socket Socket_;
+    std::string Request_;
+    std::array<char, 16384> Buffer_;
+    NHttpProxy::THttpResponseParser Parser_;
+};
+
+struct TRunResult {
+    std::size_t Requests = 0;
+    std::size_t Errors = 0;
+};
+
+// Sends requests until the deadline, recording the latency of each
+TRunResult RunClient(
+    const tcp::endpoint& proxy,
+    const TWorkload& workload,
+    unsigned seed,
+    std::chrono::steady_clock::time_point deadline,
+    THistogram& latency
+) {
+    TRunResult ret;
+    TClient client(proxy, workload);
+    std::mt19937 random(seed);
+    std::bernoulli_distribution hot(workload.HitRatio);
+    std::uniform_int_distribution<std::size_t> hotPath(0, workload.HotPaths.size() - 1);
+    std::discrete_distribution<std::size_t> size(workload.Weights.begin(), workload.Weights.end());
+
+    std::string path;
+    for (std::size_t i = 0; std::chrono::steady_clock::now() < deadline; i++) {
+        if (!workload.HotPaths.empty() && hot(random)) {
+            path = workload.HotPaths[hotPath(random)];
+        } else {
+            // A fresh URL each time, so nothing is shared between requests
+            path = "/u/" + std::to_string(workload.Sizes[size(random)]) + "/" + std::to_string(seed) + "-" + std::to_string(i);
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (client.Fetch(path)) {
+            latency.Record(std::chrono::steady_clock::now() - start);
+            ret.Requests++;
+        } else {
+            ret.Errors++;
+        }
+    }
+    return ret;
+}
+
+// Resident and peak resident memory of the process in MiB
+std::pair<double, double> MemoryUsage() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    double rss = 0;
+    double peak = 0;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmRSS:", 0) == 0) {
+            rss = std::stod(line.substr(6)) / 1024;
+        } else if (line.rfind("VmHWM:", 0) == 0) {
+            peak = std::stod(line.substr(6)) / 1024;
+        }
+    }
+    return {rss, peak};
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    CLI::App app("HTTP proxy throughput and latency benchmark");
+
+    std::vector<std::size_t> threads = {1, 2, 4};
+    app.add_option("--threads", threads, "Proxy thread counts to measure", true);
+
+    std::size_t clients = 32;
+    app.add_option("--clients", clients, "Concurrent clients", true);
+
+    double duration = 5;
+    app.add_option("--duration", duration, "Seconds per measurement", true);
+
+    std::vector<std::string> sizes = {"4096"};
+    app.add_option("--sizes", sizes,
+        "Object sizes in bytes, each optionally with its weight as size:weight", true);
+
+    double hitRatio = 0;
+    app.add_option("--hit-ratio", hitRatio, "Share of requests for objects the proxy caches", true)
+        ->check(CLI::Range(0.0, 1.0));
+
+    std::size_t hotObjects = 100;
+    app.add_option("--hot-objects", hotObjects, "Number of cacheable objects", true);
+
+    bool keepAlive = false;
+    app.add_flag("--keep-alive", keepAlive, "Reuse client connections");
+
+    bool gzip = false;
+    app.add_flag("--gzip", gzip, "Ask for gzip-compressed responses");
+
+    std::size_t originThreads = 2;
+    app.add_option("--origin-threads", originThreads, "Threads of the stand-in origin server", true);
+
+    std::string accessLog = "-";
+    app.add_option("--access-log", accessLog, "Where the proxy writes its access log", true);
+
+    std::string port = "18008";
+    app.add_option("--port", port, "Proxy port", true);
+
+    CLI11_PARSE(app, argc, argv);
+
+    TWorkload workload;
+    workload.HitRatio = hitRatio;
+    workload.KeepAlive = keepAlive;
+    workload.Gzip = gzip;
+    for (const std::string& size : sizes) {
+        auto colon = size.find(':');
+        workload.Sizes.push_back(std::stoul(size.substr(0, colon)));
+        workload.Weights.push_back(colon == std::string::npos ? 1 : std::stod(size.substr(colon + 1)));
+    }
+
+    TOrigin origin(workload.Sizes, originThreads);
+    origin.Start();
+    workload.Origin = "127.0.0.1:" + std::to_string(origin.Port());
+    if (hitRatio > 0) {
+        std::mt19937 random(0);
+        std::discrete_distribution<std::size_t> size(workload.Weights.begin(), workload.Weights.end());
+        for (std::size_t i = 0; i < hotObjects; i++) {
+            workload.HotPaths.push_back("/c/" + std::to_string(workload.Sizes[size(random)]) + "/" + std::to_string(i));
+        }
+    }
+    tcp::endpoint proxy(boost::asio::ip::make_address("127.0.0.1"), std::stoi(port));
+
+    // stdout is taken by the access log of the proxy
+    std::cerr << std::setw(8) << "threads"
+              << std::setw(12) << "requests"
+              << std::setw(8) << "errors"
+              << std::setw(10) << "rps"
+              << std::setw(10) << "p50_us"
+              << std::setw(10) << "p99_us"
+              << std::setw(10) << "p999_us"
+              << std::setw(9) << "rss_mb"
+              << std::setw(9) << "peak_mb" << std::endl;
+    for (std::size_t n : threads) {
+        NHttpProxy::TServerOptions options;
+        options.Threads = n;
+        options.AccessLog = accessLog;
+        NHttpProxy::TServer server(options);
+        server.Bind("127.0.0.1", port);
+        std::thread serverThread([&server]() { server.Run(); });
+
+        // The cache of a new server starts empty. Compressed variants are
+        // built on the first hit, so those are fetched twice.
+        {
+            TClient client(proxy, workload);
+            for (const std::string& path : workload.HotPaths) {
+                for (int i = 0; i < (gzip ? 2 : 1); i++) {
+                    client.Fetch(path);
+                }
+            }
+        }
+
+        THistogram latency;
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(duration)
+        );
+
+        std::vector<std::thread> workers;
+        std::vector<TRunResult> results(clients);
+        for (std::size_t i = 0; i < clients; i++) {
+            workers.emplace_back([&, i]() {
+                results[i] = RunClient(proxy, workload, static_cast<unsigned>(i), deadline, latency);
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        auto [rss, peak] = MemoryUsage();
+
+        server.Stop();
+        serverThread.join();
+
+        TRunResult total;
+        for (const auto& result : results) {
+            total.Requests += result.Requests;
+            total.Errors += result.Errors;
+        }
+        std::cerr << std::setw(8) << n
+                  << std::setw(12) << total.Requests
+                  << std::setw(8) << total.Errors
+                  << std::setw(10) << std::fixed << std::setprecision(0) << total.Requests / elapsed
+                  << std::setw(10) << latency.Percentile(0.5).count()
+                  << std::setw(10) << latency.Percentile(0.99).count()
+                  << std::setw(10) << latency.Percentile(0.999).count()
+                  << std::setw(9) << std::setprecision(1) << rss
+                  << std::setw(9) << peak << std::endl;
+    }
+
+    origin.Stop();
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include <AccessLog.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+namespace NHttpProxy {
+
+namespace {
+
+// How often the writer looks for new records
+constexpr std::chrono::milliseconds PollInterval{10};
+// Records formatted before the batch is written out
+constexpr std::size_t MaxBatch = 1024;
+
+const char* CacheResultName(ECacheResult result) {
+    switch (result) {
+        case ECacheResult::None:
+            return "none";
+        case ECacheResult::Miss:
+            return "miss";
+        case ECacheResult::Hit:
+            return "hit";
+        case ECacheResult::Stale:
+            return "stale";
+        case ECacheResult::Refreshed:
+            return "refreshed";
+        case ECacheResult::Coalesced:
+            return "coalesced";
+    }
+    return "none";
+}
+
+}
+
+void FormatAccessRecord(const TAccessRecord& record, std::string& out) {
+    auto sinceEpoch = record.Time.time_since_epoch();
+    std::time_t seconds = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch).count();
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(sinceEpoch).count() % 1000;
+    std::tm tm;
+    gmtime_r(&seconds, &tm);
+    // Wide enough for any int fields, which the compiler cannot rule out
+    char time[64];
+    std::snprintf(
+        time, sizeof(time), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, static_cast<int>(millis)
+    );
+
+    out += "time=";
+    out += time;
+    out += " method=";
+    out += record.Method;
+    out += " url=";
+    out += record.URL;
+    out += " status=";
+    out += std::to_string(record.Status);
+    out += " cache=";
+    out += CacheResultName(record.Cache);
+    out += " encoding=";
+    out += record.Encoding.empty() ? "-" : record.Encoding;
+    out += " bytes=";
+    out += std::to_string(record.Bytes);
+    out += " ttfb_us=";
+    out += std::to_string(record.FirstByte.count());
+    out += " total_us=";
+    out += std::to_string(record.Total.count());
+    out += "\n";
+}
+
+TAccessLog::TAccessLog(const std::string& path, std::size_t capacity)
+    : Ring_(path.empty() ? 1 : capacity)
+{
+    if (path.empty()) {
+        return;
+    }
+    if (path == "-") {
+        File_ = stdout;
+    } else {
+        File_ = std::fopen(path.c_str(), "a");
+        if (File_ == nullptr) {
+            throw std::runtime_error("Couldn't open " + path + ": " + std::strerror(errno));
+        }
+        OwnsFile_ = true;
+    }
+    Writer_ = std::thread([this]() { RunWriter(); });
+}
+
+TAccessLog::~TAccessLog() {
+    Stop();
+    if (OwnsFile_) {
+        std::fclose(File_);
+    }
+}
+
+bool TAccessLog::Enabled() const {
+    return File_ != nullptr;
+}
+
+void TAccessLog::Log(const TAccessRecord& record) {
+    if (!Enabled()) {
+        return;
+    }
+    if (!Ring_.TryPush(record)) {
+        Dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void TAccessLog::Stop() {
+    {
+        std::lock_guard<std::mutex> guard(StopLock_);
+        Stopped_ = true;
+    }
+    StopRequested_.notify_all();
+    if (Writer_.joinable()) {
+        Writer_.join();
+    }
+}
+
+std::uint64_t TAccessLog::Written() const {
+    return Written_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t TAccessLog::Dropped() const {
+    return Dropped_.load(std::memory_order_relaxed);
+}
+
+void TAccessLog::RunWriter() {
+    std::string batch;
+    while (true) {
+        // Whatever is logged before the stop is seen gets written
+        bool stopped;
+        {
+            std::lock_guard<std::mutex> guard(StopLock_);
+            stopped = Stopped_;
+        }
+        std::size_t records = 0;
+        while (records < MaxBatch && Ring_.TryPop([&batch](const TAccessRecord& record) {
+            FormatAccessRecord(record, batch);
+        })) {
+            records++;
+        }
+        if (records > 0) {
+            std::fwrite(batch.data(), 1, batch.size(), File_);
+            std::fflush(File_);
+            batch.clear();
+            Written_.fetch_add(records, std::memory_order_relaxed);
+            continue;
+        }
+        if (stopped) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(StopLock_);
+        StopRequested_.wait_for(lock, PollInterval, [this]() { return Stopped_; });
+    }
+}
+
+}
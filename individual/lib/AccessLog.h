@@ -0,0 +1,94 @@
+#pragma once
+
+#include <MpscRing.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace NHttpProxy {
+
+// Where the response of an exchange came from
+enum class ECacheResult {
+    // Not served: the request was refused or upstream failed
+    None,
+    // Fetched from upstream
+    Miss,
+    Hit,
+    // Served stale while being revalidated in the background
+    Stale,
+    // Revalidated with upstream and served from the cache
+    Refreshed,
+    // Taken from a fetch of the same URL by another session
+    Coalesced
+};
+
+// One line of the access log
+struct TAccessRecord {
+    // When the request was parsed
+    std::chrono::system_clock::time_point Time;
+    std::string Method;
+    std::string URL;
+    // 0 if the client got no response
+    int Status = 0;
+    ECacheResult Cache = ECacheResult::None;
+    // Content coding of a response compressed by the proxy, if any
+    std::string Encoding;
+    // Sent to the client, head included
+    std::uint64_t Bytes = 0;
+    std::chrono::microseconds FirstByte{0};
+    std::chrono::microseconds Total{0};
+};
+
+// Records are put into a ring by the sessions without blocking and written
+// out in batches by a background thread, so a slow disk or pipe never
+// stalls the event loop. Records that don't fit into the ring are dropped
+// and counted.
+class TAccessLog {
+public:
+    // Appends to the file, writes to stdout if the path is "-" and nowhere
+    // if it is empty
+    TAccessLog(const std::string& path, std::size_t capacity);
+    // Writes out what is left
+    ~TAccessLog();
+
+    TAccessLog(const TAccessLog&) = delete;
+    TAccessLog& operator=(const TAccessLog&) = delete;
+
+    bool Enabled() const;
+
+    // Thread-safe, lock-free
+    void Log(const TAccessRecord& record);
+
+    // Writes out what is left and stops the writer
+    void Stop();
+
+    std::uint64_t Written() const;
+    std::uint64_t Dropped() const;
+
+private:
+    void RunWriter();
+
+    TMpscRing<TAccessRecord> Ring_;
+    std::FILE* File_ = nullptr;
+    bool OwnsFile_ = false;
+
+    std::atomic<std::uint64_t> Written_{0};
+    std::atomic<std::uint64_t> Dropped_{0};
+
+    // Only wakes the writer up to stop, records are polled for
+    std::mutex StopLock_;
+    std::condition_variable StopRequested_;
+    bool Stopped_ = false;
+    std::thread Writer_;
+};
+
+// Appends the record as a line of key=value pairs
+void FormatAccessRecord(const TAccessRecord& record, std::string& out);
+
+}
@@ -0,0 +1,138 @@
+#include <Admin.h>
+#include <HTTP.h>
+
+#include <array>
+#include <chrono>
+#include <memory>
+
+namespace NHttpProxy {
+
+namespace {
+
+// A scraper has this long to send its request
+constexpr std::chrono::seconds RequestTimeout{5};
+
+class TAdminConnection : public std::enable_shared_from_this<TAdminConnection> {
+public:
+    TAdminConnection(boost::asio::ip::tcp::socket socket, const TMetricsRegistry& metrics)
+        : Strand_(boost::asio::make_strand(socket.get_executor()))
+        , Socket_(std::move(socket))
+        , Timer_(Strand_)
+        , Metrics_(metrics)
+    {}
+
+    void Start() {
+        Timer_.expires_after(RequestTimeout);
+        Timer_.async_wait([this, self = shared_from_this()](boost::system::error_code ec) {
+            if (!ec) {
+                boost::system::error_code ignored;
+                Socket_.close(ignored);
+            }
+        });
+        boost::asio::post(Strand_, [this, self = shared_from_this()]() { Read(); });
+    }
+
+private:
+    void Read() {
+        Socket_.async_read_some(
+            boost::asio::buffer(Buffer_),
+            boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+                if (ec) {
+                    Timer_.cancel();
+                    return;
+                }
+                std::string_view data(Buffer_.data(), size);
+                EParseResult status = Parser_.Consume(data);
+                if (status == EParseResult::Await) {
+                    Read();
+                    return;
+                }
+                Timer_.cancel();
+                if (status == EParseResult::Error) {
+                    boost::system::error_code ignored;
+                    Socket_.close(ignored);
+                    return;
+                }
+                Respond(Parser_.TakeParsed());
+            })
+        );
+    }
+
+    void Respond(const THttpRequest& request) {
+        std::string_view url = request.RequestLine().URL();
+        std::string_view path = url.substr(0, url.find('?'));
+        std::string status = "200 OK";
+        std::string body;
+        if (path != "/metrics") {
+            status = "404 Not Found";
+        } else if (request.RequestLine().Method() != "GET") {
+            status = "405 Method Not Allowed";
+        } else {
+            body = Metrics_.Render();
+        }
+        Response_ = "HTTP/1.1 " + status + "\r\n"
+            "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n"
+            "\r\n" + body;
+        boost::asio::async_write(
+            Socket_,
+            boost::asio::buffer(Response_),
+            boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code, std::size_t) {
+                boost::system::error_code ignored;
+                Socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                Socket_.close(ignored);
+            })
+        );
+    }
+
+    boost::asio::strand<boost::asio::any_io_executor> Strand_;
+    boost::asio::ip::tcp::socket Socket_;
+    boost::asio::steady_timer Timer_;
+    const TMetricsRegistry& Metrics_;
+    std::array<char, 4096> Buffer_;
+    THttpRequestParser Parser_;
+    std::string Response_;
+};
+
+}
+
+TAdminServer::TAdminServer(boost::asio::io_context& context, const TMetricsRegistry& metrics)
+    : Acceptor_(context)
+    , Metrics_(metrics)
+{}
+
+void TAdminServer::Bind(const boost::asio::ip::tcp::endpoint& endpoint) {
+    Acceptor_.open(endpoint.protocol());
+    Acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    Acceptor_.bind(endpoint);
+}
+
+void TAdminServer::Start() {
+    if (!Acceptor_.is_open()) {
+        return;
+    }
+    Acceptor_.listen();
+    AsyncAccept();
+}
+
+void TAdminServer::Stop() {
+    boost::system::error_code ignored;
+    Acceptor_.close(ignored);
+}
+
+void TAdminServer::AsyncAccept() {
+    Acceptor_.async_accept(
+        [this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
+            if (!Acceptor_.is_open()) {
+                return;
+            }
+            if (!ec) {
+                std::make_shared<TAdminConnection>(std::move(socket), Metrics_)->Start();
+            }
+            AsyncAccept();
+        }
+    );
+}
+
+}
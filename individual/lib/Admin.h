@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Metrics.h>
+
+#include <boost/asio.hpp>
+
+namespace NHttpProxy {
+
+// Serves the metrics at GET /metrics, one request per connection, on the
+// io_context of the proxy itself
+class TAdminServer {
+public:
+    TAdminServer(boost::asio::io_context& context, const TMetricsRegistry& metrics);
+
+    TAdminServer(const TAdminServer&) = delete;
+    TAdminServer& operator=(const TAdminServer&) = delete;
+
+    void Bind(const boost::asio::ip::tcp::endpoint& endpoint);
+    void Start();
+    // Stops accepting; called from a handler of the io_context
+    void Stop();
+
+private:
+    void AsyncAccept();
+
+    boost::asio::ip::tcp::acceptor Acceptor_;
+    const TMetricsRegistry& Metrics_;
+};
+
+}
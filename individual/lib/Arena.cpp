@@ -0,0 +1,52 @@
+#include <Arena.h>
+
+#include <algorithm>
+
+namespace NHttpProxy {
+
+namespace {
+
+// An exchange needing more than this is not worth keeping a block for
+constexpr std::size_t MaxBlockSize = 256 * 1024;
+
+}
+
+TArena::TArena(std::size_t blockSize)
+    : BlockSize_(blockSize)
+    , Block_(new std::byte[blockSize])
+{
+    Resource_.emplace(Block_.get(), BlockSize_, &Overflow_);
+}
+
+std::pmr::memory_resource* TArena::Resource() {
+    return &*Resource_;
+}
+
+void TArena::Reset() {
+    Resource_.reset();
+    if (Overflow_.Allocated > 0 && BlockSize_ < MaxBlockSize) {
+        BlockSize_ = std::min(std::max(BlockSize_ * 2, BlockSize_ + Overflow_.Allocated), MaxBlockSize);
+        Block_.reset(new std::byte[BlockSize_]);
+    }
+    Overflow_.Allocated = 0;
+    Resource_.emplace(Block_.get(), BlockSize_, &Overflow_);
+}
+
+std::size_t TArena::BlockSize() const {
+    return BlockSize_;
+}
+
+void* TArena::TOverflow::do_allocate(std::size_t bytes, std::size_t alignment) {
+    Allocated += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void TArena::TOverflow::do_deallocate(void* p, std::size_t bytes, std::size_t alignment) {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+bool TArena::TOverflow::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+namespace NHttpProxy {
+
+// Memory for the messages of one exchange of a session, freed all at once
+// when the session moves on to the next one. Allocating is bumping a
+// pointer in a block, and the block grows to fit the largest exchange seen,
+// so in the steady state the heap is not touched at all.
+class TArena {
+public:
+    explicit TArena(std::size_t blockSize = 8192);
+
+    TArena(const TArena&) = delete;
+    TArena& operator=(const TArena&) = delete;
+
+    std::pmr::memory_resource* Resource();
+
+    // Frees everything allocated since the last reset. Nothing allocated
+    // from the arena may be used afterwards.
+    void Reset();
+
+    // Size of the block reused from one exchange to another
+    std::size_t BlockSize() const;
+
+private:
+    // Takes what does not fit in the block from the heap, counting it
+    class TOverflow : public std::pmr::memory_resource {
+    public:
+        std::size_t Allocated = 0;
+
+    private:
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+        void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+    };
+
+    std::size_t BlockSize_;
+    std::unique_ptr<std::byte[]> Block_;
+    TOverflow Overflow_;
+    std::optional<std::pmr::monotonic_buffer_resource> Resource_;
+};
+
+}
@@ -0,0 +1,296 @@
+#include <CachePolicy.h>
+#include <CachedResponse.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <ctime>
+
+namespace NHttpProxy {
+
+namespace {
+
+using namespace std::chrono_literals;
+
+// Cap of the heuristic freshness lifetime
+constexpr std::chrono::seconds MaxHeuristicLifetime = 24h;
+
+// Status codes the cache understands; the heuristic ones may be cached
+// without explicit freshness
+constexpr int Understood[] = {200, 203, 204, 300, 301, 302, 307, 308, 404, 405, 410, 414, 501};
+constexpr int Heuristic[] = {200, 203, 204, 300, 301, 308, 404, 405, 410, 414, 501};
+
+struct TResponseCacheControl {
+    bool NoStore = false;
+    bool NoCache = false;
+    bool Private = false;
+    bool Public = false;
+    bool MustRevalidate = false;
+    std::optional<std::chrono::seconds> MaxAge;
+    std::optional<std::chrono::seconds> SMaxAge;
+    std::chrono::seconds StaleWhileRevalidate{0};
+};
+
+std::string Lower(std::string_view s) {
+    std::string ret(s);
+    std::transform(ret.begin(), ret.end(), ret.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ret;
+}
+
+std::string_view Trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+// All the values of a header, joined by commas, whatever the case of its
+// name
+std::optional<std::string> HeaderValue(const THttpHeaders& headers, std::string_view name) {
+    std::optional<std::string> ret;
+    for (std::size_t i = 0; i < headers.Size(); i++) {
+        if (!headers[i].Is(name)) {
+            continue;
+        }
+        if (ret.has_value()) {
+            ret.value() += ", ";
+            ret.value() += headers[i].Value();
+        } else {
+            ret = headers[i].Value();
+        }
+    }
+    return ret;
+}
+
+// Splits a comma-separated list, leaving quoted strings whole
+std::vector<std::string_view> SplitList(std::string_view value) {
+    std::vector<std::string_view> ret;
+    bool quoted = false;
+    std::size_t start = 0;
+    for (std::size_t i = 0; i <= value.size(); i++) {
+        if (i < value.size() && value[i] == '"') {
+            quoted = !quoted;
+        }
+        if (i == value.size() || (value[i] == ',' && !quoted)) {
+            auto item = Trim(value.substr(start, i - start));
+            if (!item.empty()) {
+                ret.push_back(item);
+            }
+            start = i + 1;
+        }
+    }
+    return ret;
+}
+
+std::optional<std::chrono::seconds> ParseSeconds(std::string_view value) {
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+    }
+    long long seconds = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), seconds);
+    if (ec != std::errc() || end != value.data() + value.size() || seconds < 0) {
+        return {};
+    }
+    return std::chrono::seconds(seconds);
+}
+
+// Calls the visitor with every directive name, lowercase, and its value
+template<typename TVisitor>
+void ForEachDirective(const THttpHeaders& headers, TVisitor&& visitor) {
+    auto value = HeaderValue(headers, "cache-control");
+    if (!value.has_value()) {
+        return;
+    }
+    for (auto directive : SplitList(value.value())) {
+        auto eq = directive.find('=');
+        std::string name = Lower(Trim(directive.substr(0, eq)));
+        std::string_view argument = eq == std::string_view::npos ? std::string_view() : Trim(directive.substr(eq + 1));
+        visitor(name, argument, eq != std::string_view::npos);
+    }
+}
+
+TResponseCacheControl ParseResponseCacheControl(const THttpHeaders& headers) {
+    TResponseCacheControl ret;
+    ForEachDirective(headers, [&ret](const std::string& name, std::string_view argument, bool) {
+        // Qualified no-cache and private are taken as unqualified ones
+        if (name == "no-store") {
+            ret.NoStore = true;
+        } else if (name == "no-cache") {
+            ret.NoCache = true;
+        } else if (name == "private") {
+            ret.Private = true;
+        } else if (name == "public") {
+            ret.Public = true;
+        } else if (name == "must-revalidate" || name == "proxy-revalidate") {
+            ret.MustRevalidate = true;
+        } else if (name == "max-age") {
+            // An invalid value means the response is stale
+            ret.MaxAge = ParseSeconds(argument).value_or(0s);
+        } else if (name == "s-maxage") {
+            ret.SMaxAge = ParseSeconds(argument).value_or(0s);
+        } else if (name == "stale-while-revalidate") {
+            ret.StaleWhileRevalidate = ParseSeconds(argument).value_or(0s);
+        }
+    });
+    return ret;
+}
+
+bool Contains(const int* begin, const int* end, int value) {
+    return std::find(begin, end, value) != end;
+}
+
+}
+
+std::optional<TWallTime> ParseHttpDate(std::string_view value) {
+    // IMF-fixdate, obsolete RFC 850 and asctime formats
+    static const char* formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT",
+        "%A, %d-%b-%y %H:%M:%S GMT",
+        "%a %b %e %H:%M:%S %Y"
+    };
+    std::string date(Trim(value));
+    for (const char* format : formats) {
+        std::tm tm{};
+        const char* end = strptime(date.c_str(), format, &tm);
+        if (end != nullptr && *end == '\0') {
+            return std::chrono::system_clock::from_time_t(timegm(&tm));
+        }
+    }
+    return {};
+}
+
+TRequestCacheControl ParseRequestCacheControl(const THttpHeaders& headers) {
+    TRequestCacheControl ret;
+    ForEachDirective(headers, [&ret](const std::string& name, std::string_view argument, bool hasArgument) {
+        if (name == "no-store") {
+            ret.NoStore = true;
+        } else if (name == "no-cache") {
+            ret.NoCache = true;
+        } else if (name == "only-if-cached") {
+            ret.OnlyIfCached = true;
+        } else if (name == "max-age") {
+            ret.MaxAge = ParseSeconds(argument).value_or(0s);
+        } else if (name == "min-fresh") {
+            ret.MinFresh = ParseSeconds(argument).value_or(0s);
+        } else if (name == "max-stale") {
+            ret.MaxStale = hasArgument ? ParseSeconds(argument).value_or(0s) : std::chrono::seconds::max();
+        }
+    });
+    auto pragma = HeaderValue(headers, "pragma");
+    if (pragma.has_value() && !HeaderValue(headers, "cache-control").has_value()) {
+        for (auto token : SplitList(pragma.value())) {
+            if (Lower(token) == "no-cache") {
+                ret.NoCache = true;
+            }
+        }
+    }
+    return ret;
+}
+
+TFreshness ResponseFreshness(const THttpRequest& request, const THttpResponse& response, TWallTime now) {
+    TFreshness ret;
+    if (request.RequestLine().Method() != "GET" || ParseRequestCacheControl(request.Headers()).NoStore) {
+        return ret;
+    }
+    int status = 0;
+    std::string_view code = response.ResponseStatusLine().StatusCode();
+    std::from_chars(code.data(), code.data() + code.size(), status);
+    if (!Contains(std::begin(Understood), std::end(Understood), status)) {
+        return ret;
+    }
+    const THttpHeaders& headers = response.Headers();
+    auto control = ParseResponseCacheControl(headers);
+    if (control.NoStore || control.Private) {
+        return ret;
+    }
+    // A shared cache keeps responses to authorized requests only if told so
+    if (HeaderValue(request.Headers(), "authorization").has_value()
+        && !control.Public && !control.MustRevalidate && !control.SMaxAge.has_value()) {
+        return ret;
+    }
+
+    auto dateValue = HeaderValue(headers, "date");
+    TWallTime date = dateValue.has_value() ? ParseHttpDate(dateValue.value()).value_or(now) : now;
+    ret.Age = std::max(std::chrono::duration_cast<std::chrono::seconds>(now - date), 0s);
+    auto ageValue = HeaderValue(headers, "age");
+    if (ageValue.has_value()) {
+        ret.Age = std::max(ret.Age, ParseSeconds(Trim(ageValue.value())).value_or(0s));
+    }
+
+    auto expires = HeaderValue(headers, "expires");
+    auto lastModified = HeaderValue(headers, "last-modified");
+    if (control.SMaxAge.has_value()) {
+        ret.Lifetime = control.SMaxAge.value();
+    } else if (control.MaxAge.has_value()) {
+        ret.Lifetime = control.MaxAge.value();
+    } else if (expires.has_value()) {
+        // An invalid date means the response has expired
+        auto expiresAt = ParseHttpDate(expires.value());
+        if (expiresAt.has_value()) {
+            ret.Lifetime = std::max(std::chrono::duration_cast<std::chrono::seconds>(expiresAt.value() - date), 0s);
+        }
+    } else if (lastModified.has_value()
+        && (control.Public || Contains(std::begin(Heuristic), std::end(Heuristic), status))) {
+        auto modifiedAt = ParseHttpDate(lastModified.value());
+        if (modifiedAt.has_value() && modifiedAt.value() < date) {
+            auto sinceModified = std::chrono::duration_cast<std::chrono::seconds>(date - modifiedAt.value());
+            ret.Lifetime = std::min(sinceModified / 10, MaxHeuristicLifetime);
+            ret.Heuristic = true;
+        }
+    }
+    if (control.NoCache) {
+        ret.Lifetime = 0s;
+    }
+    ret.MustRevalidate = control.MustRevalidate || control.SMaxAge.has_value() || control.NoCache;
+    ret.StaleWhileRevalidate = control.StaleWhileRevalidate;
+    // Other statuses are stored only if the response says for how long. A
+    // response that is never fresh is of use only if it can be revalidated.
+    bool explicitly = control.Public || control.SMaxAge.has_value() || control.MaxAge.has_value() || expires.has_value();
+    ret.Storable = (explicitly || Contains(std::begin(Heuristic), std::end(Heuristic), status))
+        && (ret.Lifetime > ret.Age || HasValidators(headers));
+    return ret;
+}
+
+std::optional<std::vector<std::string>> VaryHeaders(const THttpHeaders& response) {
+    std::vector<std::string> ret;
+    auto value = HeaderValue(response, "vary");
+    if (!value.has_value()) {
+        return ret;
+    }
+    for (auto item : SplitList(value.value())) {
+        std::string name = Lower(item);
+        if (name == "*") {
+            return {};
+        }
+        if (name != "accept-encoding" && std::find(ret.begin(), ret.end(), name) == ret.end()) {
+            ret.push_back(std::move(name));
+        }
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+std::string CacheKey(const std::string& url, const std::vector<std::string>& vary, const THttpHeaders& request) {
+    std::string key = url;
+    for (const auto& name : vary) {
+        // Values are compared after dropping the whitespace around commas
+        key += '\0';
+        key += name;
+        key += '=';
+        auto value = HeaderValue(request, name);
+        if (!value.has_value()) {
+            continue;
+        }
+        auto items = SplitList(value.value());
+        for (std::size_t i = 0; i < items.size(); i++) {
+            key += i == 0 ? "" : ",";
+            key += items[i];
+        }
+    }
+    return key;
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <HTTP.h>
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace NHttpProxy {
+
+using TWallTime = std::chrono::time_point<std::chrono::system_clock>;
+
+// Parses an HTTP-date in any of the three formats of RFC 9110
+std::optional<TWallTime> ParseHttpDate(std::string_view value);
+
+// Cache-Control directives of a request that bear on the cache
+struct TRequestCacheControl {
+    // The response is not to be stored
+    bool NoStore = false;
+    // A stored response is to be revalidated before it is used. Pragma:
+    // no-cache means the same.
+    bool NoCache = false;
+    // The oldest response the client accepts
+    std::optional<std::chrono::seconds> MaxAge;
+    // How long past its expiration a response is still acceptable. Without
+    // a value any stale response is.
+    std::optional<std::chrono::seconds> MaxStale;
+    // How long a response is to stay fresh at least
+    std::optional<std::chrono::seconds> MinFresh;
+    // The client wants no upstream request, a 504 rather than a miss
+    bool OnlyIfCached = false;
+};
+
+TRequestCacheControl ParseRequestCacheControl(const THttpHeaders& headers);
+
+// How a response to a request may be reused by a shared cache, per
+// RFC 9111
+struct TFreshness {
+    bool Storable = false;
+    // Freshness lifetime: s-maxage, max-age, Expires less Date or, lacking
+    // all of them, a tenth of the time since Last-Modified
+    std::chrono::seconds Lifetime{0};
+    // Age of the response when it was received
+    std::chrono::seconds Age{0};
+    bool Heuristic = false;
+    // No stale use without revalidation: must-revalidate, proxy-revalidate,
+    // s-maxage or no-cache
+    bool MustRevalidate = false;
+    std::chrono::seconds StaleWhileRevalidate{0};
+};
+
+TFreshness ResponseFreshness(const THttpRequest& request, const THttpResponse& response, TWallTime now);
+
+// The request headers the response varies on, lowercase. Accept-Encoding
+// is left out: upstream responses are requested without it and coded for
+// each client by the proxy. Returns nullopt for Vary: *, which no request
+// matches.
+std::optional<std::vector<std::string>> VaryHeaders(const THttpHeaders& response);
+
+// The key the response to the request is cached under: the URL alone, or
+// with the values of the request headers the response varies on
+std::string CacheKey(const std::string& url, const std::vector<std::string>& vary, const THttpHeaders& request);
+
+}
@@ -0,0 +1,82 @@
+#include <CachedResponse.h>
+
+#include <Compress.h>
+
+namespace NHttpProxy {
+
+std::shared_ptr<const TCachedResponse> MakeCachedResponse(THttpResponse response) {
+    RemoveHopByHopHeaders(response.Headers());
+    VaryOnAcceptEncoding(response.Headers());
+    auto body = std::make_shared<const std::string>(std::move(response).TakeData());
+    return std::make_shared<TCachedResponse>(TCachedResponse {
+        THttpResponse(response.ResponseStatusLine(), response.Headers(), ""),
+        response.ResponseStatusLine().Serialize() + "\r\n" + response.Headers().Serialize(),
+        *body,
+        body
+    });
+}
+
+std::shared_ptr<const TCachedResponse> MakeCachedResponse(
+    std::string_view serializedHead,
+    std::string_view body,
+    std::shared_ptr<const void> storage
+) {
+    std::string head(serializedHead);
+    head += "\r\n";
+    std::string_view data = head;
+
+    // Only the head is parsed, as if it answered a HEAD request
+    THttpResponseParser parser;
+    parser.SetRequestMethod("HEAD");
+    if (parser.Consume(data) != EParseResult::Parsed) {
+        return nullptr;
+    }
+    head.resize(serializedHead.size());
+    return std::make_shared<TCachedResponse>(TCachedResponse {
+        parser.TakeParsed(),
+        std::move(head),
+        body,
+        std::move(storage)
+    });
+}
+
+std::shared_ptr<const TCachedResponse> RefreshCachedResponse(
+    const TCachedResponse& cached,
+    const THttpHeaders& notModified
+) {
+    static const char* framing[] = {"Content-Length", "Content-Encoding", "Content-Range", "Transfer-Encoding"};
+
+    THttpHeaders update = notModified;
+    RemoveHopByHopHeaders(update);
+    for (const char* name : framing) {
+        update.Remove(name);
+    }
+    THttpHeaders headers = cached.Head.Headers();
+    for (std::size_t i = 0; i < update.Size(); i++) {
+        headers.Update(update[i]);
+    }
+    const auto& statusLine = cached.Head.ResponseStatusLine();
+    return std::make_shared<TCachedResponse>(TCachedResponse {
+        THttpResponse(statusLine, headers, ""),
+        statusLine.Serialize() + "\r\n" + headers.Serialize(),
+        cached.Body,
+        cached.BodyStorage
+    });
+}
+
+bool HasValidators(const THttpHeaders& headers) {
+    return headers.Find(EHeader::ETag) != nullptr || headers.Find(EHeader::LastModified) != nullptr;
+}
+
+void AddValidators(const TCachedResponse& cached, THttpHeaders& request) {
+    const THttpHeader* etag = cached.Head.Headers().Find(EHeader::ETag);
+    if (etag != nullptr) {
+        request.Update({EHeader::IfNoneMatch, etag->Value()});
+    }
+    const THttpHeader* lastModified = cached.Head.Headers().Find(EHeader::LastModified);
+    if (lastModified != nullptr) {
+        request.Update({EHeader::IfModifiedSince, lastModified->Value()});
+    }
+}
+
+}
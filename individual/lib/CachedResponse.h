@@ -0,0 +1,49 @@
+#pragma once
+
+#include <HTTP.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace NHttpProxy {
+
+// A cached response. Immutable once stored, so hits share it without
+// copying and write it straight from the cache.
+struct TCachedResponse {
+    // Status line and headers, without the body
+    THttpResponse Head;
+    // Head serialized without hop-by-hop headers and the final empty line,
+    // which are appended per client
+    std::string SerializedHead;
+    // Points into BodyStorage: a string in memory or a mapped file
+    std::string_view Body;
+    std::shared_ptr<const void> BodyStorage;
+};
+
+// Stores the response as it is to be cached: the head serialized once,
+// without hop-by-hop headers
+std::shared_ptr<const TCachedResponse> MakeCachedResponse(THttpResponse response);
+
+// Restores a response from its serialized head and a body kept alive by
+// storage. Returns nullptr if the head doesn't parse.
+std::shared_ptr<const TCachedResponse> MakeCachedResponse(
+    std::string_view serializedHead,
+    std::string_view body,
+    std::shared_ptr<const void> storage
+);
+
+// Returns the response with the headers of a 304 response merged in, the
+// body shared. The headers framing the body are kept as they were.
+std::shared_ptr<const TCachedResponse> RefreshCachedResponse(
+    const TCachedResponse& cached,
+    const THttpHeaders& notModified
+);
+
+// Whether the response carries an ETag or Last-Modified to revalidate it
+bool HasValidators(const THttpHeaders& headers);
+
+// Makes the request conditional on the cached response having changed
+void AddValidators(const TCachedResponse& cached, THttpHeaders& request);
+
+}
@@ -0,0 +1,174 @@
+#include <Chunked.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace NHttpProxy {
+
+namespace {
+
+// A size line is a few hex digits and extensions nobody sends in practice
+constexpr std::size_t MaxSizeLine = 4096;
+constexpr std::size_t MaxTrailerSize = 8192;
+
+int HexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+std::string_view Trim(std::string_view sv) {
+    while (!sv.empty() && (sv.front() == ' ' || sv.front() == '\t')) {
+        sv.remove_prefix(1);
+    }
+    while (!sv.empty() && (sv.back() == ' ' || sv.back() == '\t')) {
+        sv.remove_suffix(1);
+    }
+    return sv;
+}
+
+}
+
+TChunkedDecoder::TChunkedDecoder(EChunkedMode mode)
+    : Mode_(mode)
+{}
+
+EParseResult TChunkedDecoder::Consume(std::string_view& data, const TBodyCallback& sink) {
+    if (State_ == EState::ERROR) {
+        return EParseResult::Error;
+    }
+    const std::string_view input = data;
+    while (!data.empty() && State_ != EState::DONE) {
+        if (State_ == EState::SIZE) {
+            EParseResult line = ConsumeLine(data, MaxSizeLine);
+            if (line == EParseResult::Await) {
+                break;
+            }
+            if (line == EParseResult::Error || !ParseSizeLine()) {
+                return Fail();
+            }
+        } else if (State_ == EState::DATA) {
+            std::size_t size = std::min(Left_, data.size());
+            if (Mode_ == EChunkedMode::Dechunk) {
+                sink(data.substr(0, size));
+            }
+            data.remove_prefix(size);
+            Left_ -= size;
+            if (Left_ == 0) {
+                State_ = EState::DATA_END;
+            }
+        } else if (State_ == EState::DATA_END || State_ == EState::DATA_LF) {
+            // CRLF, or a bare LF, right after the data
+            if (data.front() == '\r' && State_ == EState::DATA_END) {
+                State_ = EState::DATA_LF;
+            } else if (data.front() == '\n') {
+                State_ = EState::SIZE;
+            } else {
+                return Fail();
+            }
+            data.remove_prefix(1);
+        } else if (State_ == EState::TRAILER) {
+            // The fields are counted with their line breaks; the CR of the
+            // empty line ending the section fits even once they fill it
+            EParseResult line = ConsumeLine(data, MaxTrailerSize - TrailerSize_ + 1);
+            if (line == EParseResult::Await) {
+                break;
+            }
+            if (line == EParseResult::Error || !ParseTrailerLine()) {
+                return Fail();
+            }
+        }
+    }
+    if (State_ == EState::ERROR) {
+        return EParseResult::Error;
+    }
+    if (Mode_ == EChunkedMode::Verbatim && data.size() < input.size()) {
+        sink(input.substr(0, input.size() - data.size()));
+    }
+    return State_ == EState::DONE ? EParseResult::Parsed : EParseResult::Await;
+}
+
+const THttpHeaders& TChunkedDecoder::Trailers() const {
+    return Trailers_;
+}
+
+void TChunkedDecoder::Reset() {
+    State_ = EState::SIZE;
+    Left_ = 0;
+    Line_.clear();
+    TrailerSize_ = 0;
+    Trailers_ = THttpHeaders();
+}
+
+EParseResult TChunkedDecoder::Fail() {
+    State_ = EState::ERROR;
+    return EParseResult::Error;
+}
+
+EParseResult TChunkedDecoder::ConsumeLine(std::string_view& data, std::size_t limit) {
+    const char* lf = static_cast<const char*>(std::memchr(data.data(), '\n', data.size()));
+    std::size_t size = lf == nullptr ? data.size() : lf - data.data();
+    if (Line_.size() + size > limit) {
+        return EParseResult::Error;
+    }
+    Line_.append(data.data(), size);
+    if (lf == nullptr) {
+        data.remove_prefix(size);
+        return EParseResult::Await;
+    }
+    data.remove_prefix(size + 1);
+    if (!Line_.empty() && Line_.back() == '\r') {
+        Line_.pop_back();
+    }
+    return EParseResult::Parsed;
+}
+
+bool TChunkedDecoder::ParseSizeLine() {
+    std::string_view line = Line_;
+    std::size_t size = 0;
+    std::size_t digits = 0;
+    for (; digits < line.size() && HexDigit(line[digits]) >= 0; digits++) {
+        if (size > std::numeric_limits<std::size_t>::max() >> 4) {
+            return false;
+        }
+        size = size * 16 + HexDigit(line[digits]);
+    }
+    // Extensions after the size are allowed and ignored
+    std::string_view rest = Trim(line.substr(digits));
+    if (digits == 0 || !(rest.empty() || rest.front() == ';')) {
+        return false;
+    }
+    Line_.clear();
+    Left_ = size;
+    State_ = size == 0 ? EState::TRAILER : EState::DATA;
+    return true;
+}
+
+bool TChunkedDecoder::ParseTrailerLine() {
+    std::string_view line = Line_;
+    if (line.empty()) {
+        State_ = EState::DONE;
+        return true;
+    }
+    if (TrailerSize_ + line.size() + 2 > MaxTrailerSize) {
+        return false;
+    }
+    TrailerSize_ += line.size() + 2;
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos || Trim(line.substr(0, colon)).empty()) {
+        return false;
+    }
+    Trailers_.Append(Trim(line.substr(0, colon)), Trim(line.substr(colon + 1)));
+    Line_.clear();
+    return true;
+}
+
+}
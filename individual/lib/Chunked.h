@@ -0,0 +1,62 @@
+#pragma once
+
+#include <HTTP.h>
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace NHttpProxy {
+
+enum class EChunkedMode {
+    // The sink gets the chunk data only
+    Dechunk,
+    // The sink gets the body as it is, framing included, in spans of the
+    // consumed input
+    Verbatim
+};
+
+// Follows a body in the chunked transfer coding as it arrives in pieces of
+// any size. Chunk data is passed on in spans of the input, without copying;
+// only the size lines and the trailer section are buffered.
+class TChunkedDecoder {
+public:
+    explicit TChunkedDecoder(EChunkedMode mode = EChunkedMode::Dechunk);
+
+    // Consumes the prefix of data that belongs to the body and passes it to
+    // the sink. Returns Parsed once the trailer section is over, leaving the
+    // rest of data untouched, and Error if the framing is broken.
+    EParseResult Consume(std::string_view& data, const TBodyCallback& sink);
+
+    // Fields of the trailer section, complete once the body is parsed
+    const THttpHeaders& Trailers() const;
+
+    void Reset();
+
+private:
+    EParseResult Fail();
+    // Appends the line up to LF to Line_. Returns Await if it goes on and
+    // Error if it is longer than the limit.
+    EParseResult ConsumeLine(std::string_view& data, std::size_t limit);
+    bool ParseSizeLine();
+    bool ParseTrailerLine();
+
+    enum class EState {
+        SIZE,
+        DATA,
+        DATA_END,
+        DATA_LF,
+        TRAILER,
+        DONE,
+        ERROR
+    };
+
+    EChunkedMode Mode_;
+    EState State_ = EState::SIZE;
+    std::size_t Left_ = 0;
+    std::string Line_;
+    std::size_t TrailerSize_ = 0;
+    THttpHeaders Trailers_;
+};
+
+}
@@ -1,34 +1,34 @@
 #include <Compress.h>
 
-#include <sstream>
-
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <string_view>
 
 namespace NHttpProxy {
 namespace {
 
-// XXX: Only gzip detection =(
+// Any coding but identity, whichever it is
 bool IsCompressed(const THttpResponse& response) {
-    auto mbHeader = response.Headers().Find("Content-Encoding");
-    if (!mbHeader.has_value()) {
+    const THttpHeader* header = response.Headers().Find(EHeader::ContentEncoding);
+    if (header == nullptr) {
         return false;
     }
-    auto header = mbHeader.value();
 
-    auto directives = header.SplitValue();
-    return std::find(directives.begin(), directives.end(), "gzip") != directives.end();
+    auto directives = header->SplitValue();
+    return std::any_of(directives.begin(), directives.end(), [](std::string_view directive) {
+        return !directive.empty() && directive != "identity";
+    });
 }
 
-THttpHeaders ExpandContentEncoding(const THttpHeaders& headers) {
+THttpHeaders ExpandContentEncoding(const THttpHeaders& headers, const std::string& coding) {
     std::vector<THttpHeader> ret;
     bool changed = false;
     for (size_t i = 0; i < headers.Size(); i++) {
-        if (headers[i].Key() == "Content-Encoding") {
+        if (headers[i].Is(EHeader::ContentEncoding)) {
             ret.emplace_back(
-                "Content-Encoding",
-                headers[i].Value() + ", gzip"
+                EHeader::ContentEncoding,
+                std::string(headers[i].Value()) + ", " + coding
             );
             changed = true;
         } else {
@@ -36,47 +36,95 @@ THttpHeaders ExpandContentEncoding(const THttpHeaders& headers) {
         }
     }
     if (!changed) {
-        ret.emplace_back("Content-Encoding", "gzip");
+        ret.emplace_back(EHeader::ContentEncoding, coding);
     }
     return THttpHeaders{ret};
 }
 
-std::string Compress(const std::string& data) {
-    std::istringstream in(data);
-    std::ostringstream out;
+std::string Compress(const std::string& data, const TEncoder& encoder) {
+    auto stream = encoder.MakeStream();
+    std::string out;
+    stream->Write(data, out);
+    stream->Finish(out);
+    return out;
+}
 
-    boost::iostreams::filtering_istreambuf filter;
-    filter.push(boost::iostreams::gzip_compressor());
-    filter.push(in);
-    boost::iostreams::copy(filter, out);
+}
 
-    return out.str();
+void VaryOnAcceptEncoding(THttpHeaders& headers) {
+    const THttpHeader* vary = headers.Find(EHeader::Vary);
+    if (vary == nullptr) {
+        headers.Append(EHeader::Vary, "Accept-Encoding");
+        return;
+    }
+    auto values = vary->SplitValue();
+    for (auto value : values) {
+        if (value == "*" || HeaderId(value) == EHeader::AcceptEncoding) {
+            return;
+        }
+    }
+    headers.Update({EHeader::Vary, std::string(vary->Value()) + ", Accept-Encoding"});
 }
 
+const TEncoder* ChooseEncoder(
+    const THttpRequest& request,
+    const TEncoderRegistry& encoders,
+    const TCompressionOptions& options
+) {
+    const THttpHeader* header = request.Headers().Find(EHeader::AcceptEncoding);
+    if (header == nullptr) {
+        return nullptr;
+    }
+    return encoders.Choose(header->Value(), options.CpuWeight);
 }
 
-bool CompressionSupported(const THttpRequest& request) {
-    auto mbHeader = request.Headers().Find("Accept-Encoding");
-    if (!mbHeader.has_value()) {
+bool Compressible(const THttpResponse& response, const TCompressionOptions& options) {
+    if (IsCompressed(response)) {
         return false;
     }
 
-    auto supported = mbHeader.value().SplitValue();
-    return std::find(supported.begin(), supported.end(), "gzip") != supported.end();
+    const THttpHeader* contentLength = response.Headers().Find(EHeader::ContentLength);
+    if (contentLength != nullptr) {
+        std::string_view value = contentLength->Value();
+        std::size_t length = 0;
+        auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+        if (ec == std::errc() && length < options.MinSize) {
+            return false;
+        }
+    }
+
+    const THttpHeader* contentType = response.Headers().Find(EHeader::ContentType);
+    if (contentType == nullptr) {
+        return false;
+    }
+    std::string_view type = contentType->Value();
+    return std::any_of(options.Types.begin(), options.Types.end(), [type](const std::string& prefix) {
+        return type.size() >= prefix.size() && std::equal(prefix.begin(), prefix.end(), type.begin(), [](char a, char b) {
+            return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+        });
+    });
 }
 
-void Compress(THttpResponse& response) {
+void Compress(THttpResponse& response, const TEncoder& encoder) {
     if (IsCompressed(response)) {
         return;
     }
 
+    THttpHeaders headers = response.Headers();
+    SetContentEncoding(headers, encoder.Name);
     response = THttpResponse {
         response.ResponseStatusLine(),
-        ExpandContentEncoding(response.Headers()),
-        Compress(response.Data())
+        headers,
+        Compress(response.Data(), encoder)
     };
 
     response.UpdateContentLength();
 }
 
+void SetContentEncoding(THttpHeaders& headers, const std::string& coding) {
+    headers = ExpandContentEncoding(headers, coding);
+    headers.Remove(EHeader::ContentLength);
+    VaryOnAcceptEncoding(headers);
+}
+
 }
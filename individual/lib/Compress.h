@@ -1,11 +1,53 @@
 #pragma once
 
+#include <Encoders.h>
 #include <HTTP.h>
 
+#include <cstddef>
+#include <string>
+#include <vector>
+
 namespace NHttpProxy {
 
-bool CompressionSupported(const THttpRequest& request);
+struct TCompressionOptions {
+    // Smaller bodies are sent as is, compressing them saves next to nothing
+    std::size_t MinSize = 1024;
+    // Content-Type prefixes worth compressing. Images, video and archives
+    // are compressed already.
+    std::vector<std::string> Types = {
+        "text/",
+        "application/json",
+        "application/javascript",
+        "application/xml",
+        "application/xhtml+xml",
+        "image/svg+xml",
+    };
+    // How to choose between the codings a client accepts equally: 1 picks
+    // the cheapest encoder, 0 the smallest output
+    double CpuWeight = 0.5;
+};
+
+// Picks the coding to compress the response to the request with, nullptr
+// if the client wants none of the registered ones
+const TEncoder* ChooseEncoder(
+    const THttpRequest& request,
+    const TEncoderRegistry& encoders,
+    const TCompressionOptions& options
+);
+
+// Whether the response is worth compressing. Looks at the headers only, so
+// it works before the body is received; a body of unknown length counts
+// as large.
+bool Compressible(const THttpResponse& response, const TCompressionOptions& options);
+
+void Compress(THttpResponse& response, const TEncoder& encoder);
+
+// Marks the headers of a response whose body is compressed on the way.
+// Content-Length is dropped: the compressed length is known only at the end.
+void SetContentEncoding(THttpHeaders& headers, const std::string& coding);
 
-void Compress(THttpResponse& response);
+// Responses the proxy may compress depend on Accept-Encoding, so caches
+// downstream have to take it into account too
+void VaryOnAcceptEncoding(THttpHeaders& headers);
 
 }
@@ -0,0 +1,59 @@
+#include <CompressionPool.h>
+
+#include <algorithm>
+#include <exception>
+
+#include <boost/asio/post.hpp>
+
+namespace NHttpProxy {
+
+TCompressionPool::TCompressionPool(const TCompressionPoolOptions& options)
+    : Options_(options)
+    , Encoders_(TEncoderRegistry::Builtin())
+    , Pool_(std::max<std::size_t>(options.Threads, 1))
+{}
+
+TCompressionPool::~TCompressionPool() {
+    Stop();
+}
+
+const TEncoder* TCompressionPool::ChooseEncoder(const THttpRequest& request) const {
+    return NHttpProxy::ChooseEncoder(request, Encoders_, Options_.Compression);
+}
+
+bool TCompressionPool::Compressible(const THttpResponse& response) const {
+    return NHttpProxy::Compressible(response, Options_.Compression);
+}
+
+bool TCompressionPool::Submit(THttpResponse response, const TEncoder& encoder, TCompressCallback callback) {
+    if (++Pending_ > Options_.MaxPending) {
+        Pending_--;
+        return false;
+    }
+    boost::asio::post(
+        Pool_,
+        [this, &encoder, response = std::move(response), callback = std::move(callback)]() mutable {
+            Pending_--;
+            try {
+                Compress(response, encoder);
+            } catch (const std::exception&) {
+                Failures_++;
+                callback(std::nullopt);
+                return;
+            }
+            callback(std::move(response));
+        }
+    );
+    return true;
+}
+
+std::uint64_t TCompressionPool::Failures() const {
+    return Failures_;
+}
+
+void TCompressionPool::Stop() {
+    Pool_.stop();
+    Pool_.join();
+}
+
+}
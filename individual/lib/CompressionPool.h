@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Compress.h>
+#include <Encoders.h>
+#include <HTTP.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+#include <boost/asio/thread_pool.hpp>
+
+namespace NHttpProxy {
+
+// Gets nothing if the encoder failed
+using TCompressCallback = std::function<void(std::optional<THttpResponse>)>;
+
+struct TCompressionPoolOptions {
+    std::size_t Threads = 2;
+    // Responses waiting for a worker. When there are more, responses are
+    // sent uncompressed instead.
+    std::size_t MaxPending = 256;
+    TCompressionOptions Compression;
+};
+
+// Compresses responses on its own threads so that a large body doesn't
+// hold up the sessions sharing the io_context threads
+class TCompressionPool {
+public:
+    explicit TCompressionPool(const TCompressionPoolOptions& options);
+    ~TCompressionPool();
+
+    TCompressionPool(const TCompressionPool&) = delete;
+    TCompressionPool& operator=(const TCompressionPool&) = delete;
+
+    // Coding for the responses to the request, nullptr for none
+    const TEncoder* ChooseEncoder(const THttpRequest& request) const;
+
+    bool Compressible(const THttpResponse& response) const;
+
+    // Thread-safe. Compresses the response on a worker and passes it to the
+    // callback there. Returns false without calling the callback if too
+    // many responses are pending already.
+    bool Submit(THttpResponse response, const TEncoder& encoder, TCompressCallback callback);
+
+    // Responses the encoders failed on
+    std::uint64_t Failures() const;
+
+    // Drops the pending responses and waits for the workers
+    void Stop();
+
+private:
+    TCompressionPoolOptions Options_;
+    TEncoderRegistry Encoders_;
+    boost::asio::thread_pool Pool_;
+    std::atomic<std::size_t> Pending_{0};
+    std::atomic<std::uint64_t> Failures_{0};
+};
+
+}
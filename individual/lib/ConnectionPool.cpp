@@ -0,0 +1,128 @@
+#include <ConnectionPool.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <iterator>
+
+#include <sys/socket.h>
+
+namespace NHttpProxy {
+
+namespace {
+
+std::string Key(const std::string& host, const std::string& service) {
+    return host + ":" + service;
+}
+
+// An idle connection must have nothing to read: neither data nor EOF
+bool IsAlive(boost::asio::ip::tcp::socket& socket) {
+    char c;
+    ssize_t size = ::recv(socket.native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+}
+
+TConnectionPool::TConnectionPool(const TConnectionPoolOptions& options)
+    : Options_(options)
+{}
+
+std::optional<boost::asio::ip::tcp::socket> TConnectionPool::Borrow(
+    const std::string& host,
+    const std::string& service
+) {
+    std::string key = Key(host, service);
+
+    std::lock_guard<std::mutex> guard(Lock_);
+    Prune(std::chrono::steady_clock::now());
+    auto byHost = IdleByHost_.find(key);
+    while (byHost != IdleByHost_.end()) {
+        auto it = byHost->second.back();
+        // Erasing the last connection to the host drops its index
+        bool last = byHost->second.size() == 1;
+        if (IsAlive(it->Socket)) {
+            auto socket = std::move(it->Socket);
+            Erase(it);
+            return socket;
+        }
+        Erase(it);
+        if (last) {
+            break;
+        }
+    }
+    return {};
+}
+
+void TConnectionPool::Return(
+    const std::string& host,
+    const std::string& service,
+    boost::asio::ip::tcp::socket socket
+) {
+    std::string key = Key(host, service);
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> guard(Lock_);
+    Prune(now);
+    if (Options_.MaxIdle == 0 || Options_.MaxIdlePerHost == 0) {
+        return;
+    }
+    auto byHost = IdleByHost_.find(key);
+    if (byHost != IdleByHost_.end() && byHost->second.size() >= Options_.MaxIdlePerHost) {
+        return;
+    }
+    if (Idle_.size() >= Options_.MaxIdle) {
+        Erase(Idle_.begin());
+    }
+    Idle_.push_back(TIdle{key, std::move(socket), now});
+    IdleByHost_[key].push_back(std::prev(Idle_.end()));
+}
+
+void TConnectionPool::StartSweeping(boost::asio::io_context& context) {
+    SweepTimer_.emplace(context);
+    ScheduleSweep();
+}
+
+void TConnectionPool::ScheduleSweep() {
+    SweepTimer_->expires_after(Options_.SweepInterval);
+    SweepTimer_->async_wait(
+        [this](boost::system::error_code ec) {
+            if (ec) {
+                return;
+            }
+            Sweep();
+            ScheduleSweep();
+        }
+    );
+}
+
+void TConnectionPool::Sweep() {
+    std::lock_guard<std::mutex> guard(Lock_);
+    Prune(std::chrono::steady_clock::now());
+    // The ones closed by the server would linger in CLOSE_WAIT otherwise
+    for (auto it = Idle_.begin(); it != Idle_.end();) {
+        if (IsAlive(it->Socket)) {
+            ++it;
+        } else {
+            it = Erase(it);
+        }
+    }
+}
+
+void TConnectionPool::Prune(TTimePoint now) {
+    while (!Idle_.empty() && Idle_.front().Since + Options_.IdleTimeout < now) {
+        Erase(Idle_.begin());
+    }
+}
+
+std::list<TConnectionPool::TIdle>::iterator TConnectionPool::Erase(std::list<TIdle>::iterator it) {
+    // At most MaxIdlePerHost of them
+    auto byHost = IdleByHost_.find(it->Key);
+    auto& connections = byHost->second;
+    connections.erase(std::find(connections.begin(), connections.end(), it));
+    if (connections.empty()) {
+        IdleByHost_.erase(byHost);
+    }
+    return Idle_.erase(it);
+}
+
+}
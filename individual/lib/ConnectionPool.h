@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace NHttpProxy {
+
+struct TConnectionPoolOptions {
+    // Idle connections kept in total
+    std::size_t MaxIdle = 256;
+    // Idle connections kept to a single host:port
+    std::size_t MaxIdlePerHost = 8;
+    // Idle connections older than this are closed
+    std::chrono::seconds IdleTimeout{30};
+    // How often the idle connections are checked for the timeout and for
+    // being closed by the server
+    std::chrono::seconds SweepInterval{1};
+};
+
+// Idle keep-alive connections to upstream servers, shared by all the
+// sessions. A session borrows a connection for one request and returns it
+// if the server agreed to keep it open.
+class TConnectionPool {
+public:
+    explicit TConnectionPool(const TConnectionPoolOptions& options);
+
+    TConnectionPool(const TConnectionPool&) = delete;
+    TConnectionPool& operator=(const TConnectionPool&) = delete;
+
+    // Thread-safe. Returns the most recently used live connection, if any.
+    std::optional<boost::asio::ip::tcp::socket> Borrow(
+        const std::string& host,
+        const std::string& service
+    );
+
+    // Thread-safe. The connection must have no operations in progress.
+    void Return(
+        const std::string& host,
+        const std::string& service,
+        boost::asio::ip::tcp::socket socket
+    );
+
+    // Sweeps the idle connections every SweepInterval on the context
+    void StartSweeping(boost::asio::io_context& context);
+
+    // Closes the connections idle for too long or closed by the server
+    void Sweep();
+
+private:
+    using TTimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+    struct TIdle {
+        std::string Key;
+        boost::asio::ip::tcp::socket Socket;
+        TTimePoint Since;
+    };
+
+    // Closes the connections idle for too long. Lock_ must be held.
+    void Prune(TTimePoint now);
+    // Lock_ must be held
+    std::list<TIdle>::iterator Erase(std::list<TIdle>::iterator it);
+    void ScheduleSweep();
+
+    TConnectionPoolOptions Options_;
+
+    std::mutex Lock_;
+    // Oldest first
+    std::list<TIdle> Idle_;
+    // The same connections by host:port, oldest first
+    std::unordered_map<std::string, std::vector<std::list<TIdle>::iterator>> IdleByHost_;
+
+    std::optional<boost::asio::steady_timer> SweepTimer_;
+};
+
+}
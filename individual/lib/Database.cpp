@@ -1,85 +1,419 @@
 #include <Database.h>
 
 #include <algorithm>
-#include <charconv>
-#include <cstring>
 #include <iostream>
 #include <string_view>
+#include <utility>
 
 namespace NHttpProxy {
 
-TDatabase::TDatabase() = default;
+namespace {
+
+using TWallClock = std::chrono::system_clock;
+
+// Approximate memory taken by a cached response
+std::size_t ResponseSize(const std::string& key, const TCachedResponse& response) {
+    return key.size() + 2 * response.SerializedHead.size() + response.Body.size();
+}
+
+// The URL a key was made of
+std::string_view Primary(const std::string& key) {
+    return std::string_view(key).substr(0, key.find('\0'));
+}
+
+}
+
+TDatabase::TDatabase(const TDatabaseOptions& options)
+    : Options_(options)
+{
+    Options_.Shards = std::max<std::size_t>(Options_.Shards, 1);
+    for (std::size_t i = 0; i < Options_.Shards; i++) {
+        Shards_.emplace_back(std::make_unique<TShard>());
+    }
+    if (!Options_.Disk.Directory.empty()) {
+        Disk_ = std::make_unique<TDiskCache>(Options_.Disk);
+    }
+}
+
+TDatabase::TShard& TDatabase::Shard(std::string_view url) {
+    return *Shards_[std::hash<std::string_view>()(url) % Shards_.size()];
+}
+
+std::string TDatabase::Key(TShard& shard, const THttpRequest& request) const {
+    std::string url(request.RequestLine().URL());
+    auto vary = shard.Vary.find(url);
+    if (vary == shard.Vary.end()) {
+        return url;
+    }
+    return CacheKey(url, vary->second.Headers, request.Headers());
+}
 
-std::optional<THttpResponse> TDatabase::ServeCached(const std::string& url) {
-    TEntry::TTimePoint now = std::chrono::steady_clock::now();
+void TDatabase::Erase(TShard& shard, std::list<TEntry>::iterator it) {
+    if (it->Key.find('\0') != std::string::npos) {
+        auto vary = shard.Vary.find(std::string(Primary(it->Key)));
+        if (vary != shard.Vary.end() && --vary->second.Entries == 0) {
+            shard.Vary.erase(vary);
+        }
+    }
+    shard.Bytes -= it->Size;
+    shard.Index.erase(it->Key);
+    shard.Entries.erase(it);
+}
 
-    auto it = SavedResponses_.find(url);
-    if (it == SavedResponses_.end()) {
+std::optional<TCacheHit> TDatabase::ServeCached(const THttpRequest& request, const std::string& encoding) {
+    if (request.RequestLine().Method() != "GET") {
         return {};
     }
-    if (it->second.Expire < now) {
-        SavedResponses_.erase(it);
+    TTimePoint now = std::chrono::steady_clock::now();
+    auto control = ParseRequestCacheControl(request.Headers());
+
+    TShard& shard = Shard(request.RequestLine().URL());
+    std::unique_lock<std::mutex> lock(shard.Lock);
+    std::string key = Key(shard, request);
+    auto it = shard.Index.find(key);
+    if (it != shard.Index.end() && it->second->KeepStale < now) {
+        Erase(shard, it->second);
+        Expirations_++;
+        it = shard.Index.end();
+    }
+    if (it == shard.Index.end() && Disk_) {
+        std::string url(request.RequestLine().URL());
+        std::vector<std::string> vary;
+        if (shard.Vary.find(url) == shard.Vary.end()) {
+            // The headers are not known yet for the responses stored on
+            // disk before a restart
+            vary = Disk_->Vary(url);
+            if (!vary.empty()) {
+                key = CacheKey(url, vary, request.Headers());
+            }
+        }
+        lock.unlock();
+        TDiskCache::TWallTime wallExpire;
+        auto response = Disk_->Load(key, wallExpire);
+        lock.lock();
+        if (response) {
+            DiskHits_++;
+            auto freshness = ResponseFreshness(request, response->Head, TWallClock::now());
+            auto left = std::chrono::duration_cast<TTimePoint::duration>(wallExpire - TWallClock::now());
+            if (!Insert(shard, key, response, freshness, now + left)) {
+                // Too large to be kept in memory, it is judged on its own
+                TEntry entry{key, TVariants{response, {}}, 0};
+                SetFreshness(entry, freshness, now + left);
+                return Serve(entry, control, now, encoding);
+            }
+            if (!vary.empty()) {
+                auto [known, added] = shard.Vary.try_emplace(url);
+                if (added) {
+                    known->second.Headers = std::move(vary);
+                    known->second.Entries = 1;
+                }
+            }
+        }
+        // Another session may have cached the response meanwhile
+        it = shard.Index.find(key);
+    }
+    if (it == shard.Index.end()) {
+        Misses_++;
         return {};
     }
 
-    return it->second.Response;
+    shard.Entries.splice(shard.Entries.begin(), shard.Entries, it->second);
+    return Serve(*it->second, control, now, encoding);
 }
 
-namespace {
+TCacheHit TDatabase::Serve(TEntry& entry, const TRequestCacheControl& control, TTimePoint now, const std::string& encoding) {
+    auto age = std::chrono::duration_cast<std::chrono::seconds>(now - entry.Born);
+    auto left = std::chrono::duration_cast<std::chrono::seconds>(entry.Expire - now);
+    bool fresh = now <= entry.Expire && !control.NoCache
+        && (!control.MaxAge.has_value() || age <= control.MaxAge.value())
+        && (!control.MinFresh.has_value() || left >= control.MinFresh.value());
+    if (fresh) {
+        Hits_++;
+        return Serve(entry, encoding);
+    }
+    if (now > entry.Expire && !entry.MustRevalidate && !control.NoCache) {
+        if (control.MaxStale.has_value() && -left <= control.MaxStale.value()) {
+            Hits_++;
+            StaleHits_++;
+            return Serve(entry, encoding);
+        }
+        if (now <= entry.ServeStale) {
+            Hits_++;
+            StaleHits_++;
+            TCacheHit hit = Serve(entry, encoding);
+            hit.Revalidate = !std::exchange(entry.Revalidating, true);
+            return hit;
+        }
+    }
+    Misses_++;
+    TCacheHit hit;
+    hit.Response = entry.Variants.Identity;
+    hit.Stale = true;
+    hit.Key = entry.Key;
+    return hit;
+}
 
-bool StartsWith(const std::string_view& sv, const std::string& prefix) {
-    if (sv.size() < prefix.size())
-        return false;
-    return sv.substr(0, prefix.size()) == prefix;
+void TDatabase::SetFreshness(TEntry& entry, const TFreshness& freshness, TTimePoint expire) const {
+    entry.Born = expire - freshness.Lifetime;
+    entry.Expire = expire;
+    entry.MustRevalidate = freshness.MustRevalidate;
+    entry.ServeStale = freshness.MustRevalidate ? expire : expire + freshness.StaleWhileRevalidate;
+    entry.KeepStale = HasValidators(entry.Variants.Identity->Head.Headers())
+        ? std::max(entry.ServeStale, expire + Options_.MaxStale)
+        : entry.ServeStale;
+    entry.Revalidating = false;
 }
 
-template<typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
-T ToIntegral(std::string_view sv) {
-    T ret;
-    std::from_chars(sv.begin(), sv.end(), ret);
-    return ret;
+TCacheHit TDatabase::Serve(TEntry& entry, const std::string& encoding) {
+    TVariants& variants = entry.Variants;
+    TCacheHit hit;
+    hit.Response = variants.Identity;
+    hit.Key = entry.Key;
+    if (encoding.empty()) {
+        return hit;
+    }
+    auto [variant, inserted] = variants.Encoded.try_emplace(encoding);
+    if (variant->second) {
+        hit.Response = variant->second;
+        return hit;
+    }
+    // Until the variant is built, the other hits get the identity one
+    hit.BuildVariant = inserted;
+    return hit;
 }
 
-int CacheDuration(const THttpResponse& response) {
-    auto mbHeader = response.Headers().Find("Cache-Control");
-    if (!mbHeader.has_value()) {
-        return 0;
+void TDatabase::AddVariant(
+    const std::string& key,
+    const std::shared_ptr<const TCachedResponse>& identity,
+    const std::string& encoding,
+    std::shared_ptr<const TCachedResponse> variant
+) {
+    TShard& shard = Shard(Primary(key));
+    std::lock_guard<std::mutex> guard(shard.Lock);
+    auto it = shard.Index.find(key);
+    // The entry may have been replaced or evicted meanwhile
+    if (it == shard.Index.end() || it->second->Variants.Identity != identity) {
+        return;
+    }
+    auto entry = it->second;
+    if (!variant) {
+        entry->Variants.Encoded.erase(encoding);
+        return;
     }
-    auto header = mbHeader.value();
 
-    auto directives = header.SplitValue();
-    int ret = 0;
-    for (const auto& directive : directives) {
-        if (directive == "private" || directive == "no-store") {
-            return 0;
-        }
-        if (StartsWith(directive, "max-age")) {
-            ret = ToIntegral<int>(directive.substr(std::strlen("max-age=")));
+    std::size_t size = variant == identity ? 0 : ResponseSize(key, *variant);
+    entry->Variants.Encoded[encoding] = std::move(variant);
+    entry->Size += size;
+    shard.Bytes += size;
+    while (shard.Bytes > MaxEntrySize()) {
+        auto last = std::prev(shard.Entries.end());
+        // The iterator is invalid once erased
+        bool evictedSelf = last == entry;
+        Erase(shard, last);
+        Evictions_++;
+        if (evictedSelf) {
+            break;
         }
     }
+}
 
-    return ret;
+bool TDatabase::Cacheable(const THttpRequest& request, const THttpResponse& response) const {
+    return ResponseFreshness(request, response, TWallClock::now()).Storable
+        && VaryHeaders(response.Headers()).has_value();
 }
 
+std::size_t TDatabase::MaxEntrySize() const {
+    return Options_.MaxBytes / Shards_.size();
 }
 
-void TDatabase::CacheResponse(const THttpRequest& request, const THttpResponse& response) {
-    TEntry::TTimePoint now = std::chrono::steady_clock::now();
-    int duration = CacheDuration(response);
-    if (duration > 0) {
-        auto it = SavedResponses_.find(request.RequestLine().URL());
-        if (it == SavedResponses_.end()) {
-            SavedResponses_.emplace(request.RequestLine().URL(),
-                TEntry {
-                    response,
-                    now + std::chrono::seconds(duration)
-                }
-            );
+void TDatabase::CacheResponse(const THttpRequest& request, THttpResponse response) {
+    TTimePoint now = std::chrono::steady_clock::now();
+    auto wallNow = TWallClock::now();
+    auto freshness = ResponseFreshness(request, response, wallNow);
+    auto vary = VaryHeaders(response.Headers());
+    if (!freshness.Storable || !vary.has_value()) {
+        return;
+    }
+    std::string url(request.RequestLine().URL());
+    std::string key = CacheKey(url, vary.value(), request.Headers());
+    auto left = freshness.Lifetime - freshness.Age;
+    auto cached = MakeCachedResponse(std::move(response));
+    {
+        TShard& shard = Shard(url);
+        std::lock_guard<std::mutex> guard(shard.Lock);
+        // A refused response leaves the keys of the cached variants alone
+        if (!Insert(shard, key, cached, freshness, now + left)) {
+            return;
+        }
+        if (vary.value().empty()) {
+            shard.Vary.erase(url);
         } else {
-            it->second.Response = response;
-            it->second.Expire = now + std::chrono::seconds(duration);
+            auto [known, added] = shard.Vary.try_emplace(url);
+            known->second.Headers = std::move(vary.value());
+            // Insert counts the entry only under headers already known
+            if (added) {
+                known->second.Entries = 1;
+            }
+        }
+    }
+    if (Disk_ && left.count() > 0) {
+        Disk_->Store(key, std::move(cached), wallNow + left);
+    }
+}
+
+std::shared_ptr<const TCachedResponse> TDatabase::Refresh(const THttpRequest& request, const THttpResponse& notModified) {
+    TTimePoint now = std::chrono::steady_clock::now();
+    auto wallNow = TWallClock::now();
+    std::shared_ptr<const TCachedResponse> refreshed;
+    std::string key;
+    std::chrono::seconds left;
+    {
+        TShard& shard = Shard(request.RequestLine().URL());
+        std::lock_guard<std::mutex> guard(shard.Lock);
+        key = Key(shard, request);
+        auto it = shard.Index.find(key);
+        if (it == shard.Index.end()) {
+            return nullptr;
+        }
+        auto entry = it->second;
+        TVariants& variants = entry->Variants;
+        const THttpHeader* etag = notModified.Headers().Find(EHeader::ETag);
+        const THttpHeader* cachedETag = variants.Identity->Head.Headers().Find(EHeader::ETag);
+        if (etag != nullptr && (cachedETag == nullptr || cachedETag->Value() != etag->Value())) {
+            return nullptr;
+        }
+
+        refreshed = RefreshCachedResponse(*variants.Identity, notModified.Headers());
+        std::size_t size = ResponseSize(key, *refreshed);
+        for (auto& [encoding, variant] : variants.Encoded) {
+            if (variant == variants.Identity) {
+                variant = refreshed;
+            } else if (variant) {
+                variant = RefreshCachedResponse(*variant, notModified.Headers());
+                size += ResponseSize(key, *variant);
+            }
+        }
+        variants.Identity = refreshed;
+        shard.Bytes += size;
+        shard.Bytes -= entry->Size;
+        entry->Size = size;
+        Refreshes_++;
+
+        auto freshness = ResponseFreshness(request, refreshed->Head, wallNow);
+        if (!freshness.Storable) {
+            Erase(shard, entry);
+            return refreshed;
+        }
+        left = freshness.Lifetime - freshness.Age;
+        SetFreshness(*entry, freshness, now + left);
+    }
+    if (Disk_ && left.count() > 0) {
+        Disk_->Store(key, refreshed, wallNow + left);
+    }
+    return refreshed;
+}
+
+void TDatabase::AbortRevalidation(const THttpRequest& request) {
+    TShard& shard = Shard(request.RequestLine().URL());
+    std::lock_guard<std::mutex> guard(shard.Lock);
+    auto it = shard.Index.find(Key(shard, request));
+    if (it != shard.Index.end()) {
+        it->second->Revalidating = false;
+    }
+}
+
+bool TDatabase::Insert(
+    TShard& shard,
+    const std::string& key,
+    std::shared_ptr<const TCachedResponse> response,
+    const TFreshness& freshness,
+    TTimePoint expire
+) {
+    std::size_t size = ResponseSize(key, *response);
+    if (size > MaxEntrySize()) {
+        return false;
+    }
+
+    // Counted first, so that the headers are not forgotten while the entries
+    // under the old keys are erased
+    if (key.find('\0') != std::string::npos) {
+        auto vary = shard.Vary.find(std::string(Primary(key)));
+        if (vary != shard.Vary.end()) {
+            vary->second.Entries++;
         }
     }
+    auto it = shard.Index.find(key);
+    if (it != shard.Index.end()) {
+        Erase(shard, it->second);
+    }
+    while (shard.Bytes + size > MaxEntrySize()) {
+        Erase(shard, std::prev(shard.Entries.end()));
+        Evictions_++;
+    }
+    shard.Entries.push_front(TEntry {
+        key,
+        TVariants{std::move(response), {}},
+        size
+    });
+    SetFreshness(shard.Entries.front(), freshness, expire);
+    shard.Index.emplace(key, shard.Entries.begin());
+    shard.Bytes += size;
+    return true;
+}
+
+void TDatabase::StartSweeping(boost::asio::io_context& context) {
+    SweepTimer_.emplace(context);
+    ScheduleSweep();
+}
+
+void TDatabase::ScheduleSweep() {
+    SweepTimer_->expires_after(Options_.SweepInterval);
+    SweepTimer_->async_wait(
+        [this](boost::system::error_code ec) {
+            if (ec) {
+                return;
+            }
+            Sweep();
+            ScheduleSweep();
+        }
+    );
+}
+
+void TDatabase::Sweep() {
+    TTimePoint now = std::chrono::steady_clock::now();
+    for (auto& shard : Shards_) {
+        std::lock_guard<std::mutex> guard(shard->Lock);
+        for (auto it = shard->Entries.begin(); it != shard->Entries.end();) {
+            auto next = std::next(it);
+            if (it->KeepStale < now) {
+                Erase(*shard, it);
+                Expirations_++;
+            }
+            it = next;
+        }
+    }
+}
+
+TDatabaseStats TDatabase::Stats() const {
+    TDatabaseStats stats;
+    stats.Hits = Hits_;
+    stats.Misses = Misses_;
+    stats.Evictions = Evictions_;
+    stats.Expirations = Expirations_;
+    stats.StaleHits = StaleHits_;
+    stats.Refreshes = Refreshes_;
+    stats.DiskHits = DiskHits_;
+    if (Disk_) {
+        stats.DiskEntries = Disk_->Entries();
+        stats.DiskBytes = Disk_->Bytes();
+        stats.DiskFailures = Disk_->Failures();
+    }
+    for (const auto& shard : Shards_) {
+        std::lock_guard<std::mutex> guard(shard->Lock);
+        stats.Entries += shard->Entries.size();
+        stats.Bytes += shard->Bytes;
+    }
+    return stats;
 }
 
 }
@@ -1,30 +1,214 @@
 #pragma once
 
+#include <CachePolicy.h>
+#include <CachedResponse.h>
+#include <DiskCache.h>
 #include <HTTP.h>
 
+#include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
 
 namespace NHttpProxy {
 
+struct TDatabaseOptions {
+    // Budget for all the cached responses, split evenly between the shards
+    std::size_t MaxBytes = 256 << 20;
+    std::size_t Shards = 16;
+    // How often expired entries are swept out
+    std::chrono::seconds SweepInterval{30};
+    // How long expired responses with an ETag or Last-Modified are kept to
+    // be revalidated instead of fetched again
+    std::chrono::seconds MaxStale{3600};
+    // Second tier on disk, used if the directory is set
+    TDiskCacheOptions Disk;
+};
+
+struct TCacheHit {
+    // The variant in the requested coding or, while it is not built yet,
+    // the identity one
+    std::shared_ptr<const TCachedResponse> Response;
+    // Set for the one hit that is to build the variant and pass it to
+    // AddVariant
+    bool BuildVariant = false;
+    // The response has expired and may only be served once the upstream
+    // server confirms it with 304, see Refresh. It is the identity one.
+    bool Stale = false;
+    // Set for the one hit served stale within stale-while-revalidate, which
+    // is to revalidate the entry in background
+    bool Revalidate = false;
+    // The key the entry is cached under, see CacheKey
+    std::string Key;
+};
+
+struct TDatabaseStats {
+    std::uint64_t Hits = 0;
+    std::uint64_t Misses = 0;
+    std::uint64_t Evictions = 0;
+    std::uint64_t Expirations = 0;
+    // Hits served stale, while being revalidated or as the client allowed,
+    // included in Hits
+    std::uint64_t StaleHits = 0;
+    // Stale entries confirmed by 304 responses
+    std::uint64_t Refreshes = 0;
+    std::size_t Entries = 0;
+    std::size_t Bytes = 0;
+    // Hits served from the disk tier, included in Hits
+    std::uint64_t DiskHits = 0;
+    std::size_t DiskEntries = 0;
+    std::size_t DiskBytes = 0;
+    // Responses that couldn't be written to disk
+    std::uint64_t DiskFailures = 0;
+};
+
+// Response cache shared by all the sessions of a server. Thread-safe: the
+// URL hash picks a shard, and each shard has its own lock, LRU list and
+// byte budget. Responses are kept and reused as CachePolicy.h tells; those
+// that vary on request headers are cached under keys including their
+// values, the header names being remembered per URL. With a disk tier
+// every response is also written to disk along with its key, so the
+// header names survive restarts too, and memory misses found there are
+// brought back into memory.
 class TDatabase {
 public:
-    TDatabase();
+    explicit TDatabase(const TDatabaseOptions& options = {});
+
+    TDatabase(const TDatabase&) = delete;
+    TDatabase& operator=(const TDatabase&) = delete;
+
+    // Serves the response in the given content coding (identity if empty).
+    // Encoded variants are built by the sessions and kept along with the
+    // entry, see TCacheHit. Expired entries are kept for a while to be
+    // revalidated, and are served stale within stale-while-revalidate.
+    // Responses are served to GET requests only, as their Cache-Control
+    // allows.
+    std::optional<TCacheHit> ServeCached(const THttpRequest& request, const std::string& encoding = {});
+
+    // Stores the variant built for a hit. An empty variant means it couldn't
+    // be built this time, and a later hit may try again; the identity one
+    // means the response is served as is in this coding.
+    void AddVariant(
+        const std::string& key,
+        const std::shared_ptr<const TCachedResponse>& identity,
+        const std::string& encoding,
+        std::shared_ptr<const TCachedResponse> variant
+    );
+
+    // Whether CacheResponse would keep the response. Needs the headers only.
+    bool Cacheable(const THttpRequest& request, const THttpResponse& response) const;
+
+    // Largest response that fits into a shard
+    std::size_t MaxEntrySize() const;
+
+    void CacheResponse(const THttpRequest& request, THttpResponse response);
 
-    std::optional<THttpResponse> ServeCached(const std::string& url);
+    // Refreshes the entry with the head of a 304 response, if the entry
+    // still has the validators the response is for. Returns the refreshed
+    // identity response or nullptr.
+    std::shared_ptr<const TCachedResponse> Refresh(const THttpRequest& request, const THttpResponse& notModified);
 
-    void CacheResponse(const THttpRequest& request, const THttpResponse& response);
+    // Lets a later hit revalidate the entry in background after a failed
+    // attempt
+    void AbortRevalidation(const THttpRequest& request);
+
+    // Sweeps expired entries out every SweepInterval on the context
+    void StartSweeping(boost::asio::io_context& context);
+
+    // Removes all the entries that are not to be served stale or
+    // revalidated anymore
+    void Sweep();
+
+    TDatabaseStats Stats() const;
 
 private:
+    using TTimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+    // Representations of one response, keyed by content coding
+    struct TVariants {
+        std::shared_ptr<const TCachedResponse> Identity;
+        // An empty variant is being built
+        std::map<std::string, std::shared_ptr<const TCachedResponse>> Encoded;
+    };
+
     struct TEntry {
-        using TTimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+        std::string Key;
+        TVariants Variants;
+        std::size_t Size;
+        // When the response was generated, as far as its age tells
+        TTimePoint Born{};
+        TTimePoint Expire{};
+        // Served stale while revalidated in background until then
+        TTimePoint ServeStale{};
+        // Kept for revalidation until then
+        TTimePoint KeepStale{};
+        bool MustRevalidate = false;
+        bool Revalidating = false;
+    };
 
-        THttpResponse Response;
-        TTimePoint Expire;
+    // Request headers the responses for a URL vary on
+    struct TVary {
+        std::vector<std::string> Headers;
+        // Entries cached under keys with these headers
+        std::size_t Entries = 0;
     };
 
-    std::map<std::string, TEntry> SavedResponses_;
+    struct TShard {
+        std::mutex Lock;
+        // Most recently used first
+        std::list<TEntry> Entries;
+        std::unordered_map<std::string, std::list<TEntry>::iterator> Index;
+        std::unordered_map<std::string, TVary> Vary;
+        std::size_t Bytes = 0;
+    };
+
+    TShard& Shard(std::string_view url);
+    // The shard lock must be held
+    std::string Key(TShard& shard, const THttpRequest& request) const;
+    // The shard lock must be held. Returns false if the response is too
+    // large for the shard.
+    bool Insert(
+        TShard& shard,
+        const std::string& key,
+        std::shared_ptr<const TCachedResponse> response,
+        const TFreshness& freshness,
+        TTimePoint expire
+    );
+    // The shard lock must be held. Serves the entry if the request accepts
+    // it as it is, otherwise returns a stale hit to be revalidated.
+    TCacheHit Serve(TEntry& entry, const TRequestCacheControl& control, TTimePoint now, const std::string& encoding);
+    // The shard lock must be held
+    TCacheHit Serve(TEntry& entry, const std::string& encoding);
+    // Sets the expiration time and the stale windows following it
+    void SetFreshness(TEntry& entry, const TFreshness& freshness, TTimePoint expire) const;
+    // The shard lock must be held
+    void Erase(TShard& shard, std::list<TEntry>::iterator it);
+    void ScheduleSweep();
+
+    TDatabaseOptions Options_;
+    std::vector<std::unique_ptr<TShard>> Shards_;
+
+    std::atomic<std::uint64_t> Hits_{0};
+    std::atomic<std::uint64_t> Misses_{0};
+    std::atomic<std::uint64_t> Evictions_{0};
+    std::atomic<std::uint64_t> Expirations_{0};
+    std::atomic<std::uint64_t> StaleHits_{0};
+    std::atomic<std::uint64_t> Refreshes_{0};
+    std::atomic<std::uint64_t> DiskHits_{0};
+
+    std::unique_ptr<TDiskCache> Disk_;
+
+    std::optional<boost::asio::steady_timer> SweepTimer_;
 };
 
 }
@@ -0,0 +1,431 @@
+#include <DiskCache.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace NHttpProxy {
+
+namespace {
+
+constexpr std::uint32_t RecordMagic = 0x31435250; // "PRC1"
+
+// Precedes the URL, the serialized head and the body of every record
+struct TRecordHeader {
+    std::uint32_t Magic;
+    std::uint32_t URLSize;
+    std::uint32_t HeadSize;
+    std::uint32_t Reserved;
+    std::uint64_t BodySize;
+    // Seconds since the epoch
+    std::int64_t Expire;
+};
+
+static_assert(sizeof(TRecordHeader) == 32);
+
+std::uint64_t Hash(std::string_view url) {
+    return std::hash<std::string_view>()(url);
+}
+
+std::int64_t ToSeconds(TDiskCache::TWallTime time) {
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
+
+TDiskCache::TWallTime FromSeconds(std::int64_t seconds) {
+    return TDiskCache::TWallTime(std::chrono::seconds(seconds));
+}
+
+// What a queued record holds in memory
+std::size_t PendingSize(const std::string& url, const TCachedResponse& response) {
+    return url.size() + response.SerializedHead.size() + response.Body.size();
+}
+
+std::string SegmentPath(const std::string& directory, std::uint32_t id) {
+    std::array<char, 32> name;
+    std::snprintf(name.data(), name.size(), "%08u.seg", id);
+    return (std::filesystem::path(directory) / name.data()).string();
+}
+
+bool ReadAt(int fd, void* data, std::size_t size, std::uint64_t offset) {
+    char* out = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = pread(fd, out, size, offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        out += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+}
+
+struct TDiskCache::TMapping {
+    ~TMapping() {
+        if (Data != MAP_FAILED) {
+            munmap(Data, Size);
+        }
+    }
+
+    void* Data = MAP_FAILED;
+    std::size_t Size = 0;
+};
+
+TDiskCache::TDiskCache(const TDiskCacheOptions& options)
+    : Options_(options)
+{
+    std::filesystem::create_directories(Options_.Directory);
+    Recover();
+    Writer_ = std::thread([this]() { RunWriter(); });
+}
+
+TDiskCache::~TDiskCache() {
+    {
+        std::lock_guard<std::mutex> guard(QueueLock_);
+        Stopped_ = true;
+    }
+    QueueChanged_.notify_all();
+    Writer_.join();
+    if (ActiveFd_ != -1) {
+        close(ActiveFd_);
+    }
+}
+
+void TDiskCache::Recover() {
+    std::vector<std::uint32_t> ids;
+    for (const auto& file : std::filesystem::directory_iterator(Options_.Directory)) {
+        std::string name = file.path().filename().string();
+        unsigned id = 0;
+        char tail = 0;
+        if (std::sscanf(name.c_str(), "%u.se%c", &id, &tail) == 2 && tail == 'g' && name.size() == 12) {
+            ids.push_back(id);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+
+    for (std::uint32_t id : ids) {
+        std::string path = SegmentPath(Options_.Directory, id);
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            continue;
+        }
+        struct stat st;
+        std::size_t size = fstat(fd, &st) == 0 ? st.st_size : 0;
+        std::size_t intact = IndexSegment(id, fd, size);
+        close(fd);
+        // A record torn by a crash is cut off, so that appends go after
+        // the last whole one
+        if (intact < size && truncate(path.c_str(), intact) != 0) {
+            intact = size;
+        }
+        Segments_[id] = TSegment{path, intact, nullptr};
+        Bytes_ += intact;
+    }
+
+    OpenSegment(ids.empty() ? 1 : ids.back());
+}
+
+std::size_t TDiskCache::IndexSegment(std::uint32_t id, int fd, std::size_t size) {
+    auto now = std::chrono::system_clock::now();
+    std::uint64_t offset = 0;
+    std::string url;
+    while (offset + sizeof(TRecordHeader) <= size) {
+        TRecordHeader header;
+        if (!ReadAt(fd, &header, sizeof(header), offset) || header.Magic != RecordMagic) {
+            break;
+        }
+        std::uint64_t end = offset + sizeof(header) + header.URLSize + header.HeadSize + header.BodySize;
+        if (end > size) {
+            break;
+        }
+        url.resize(header.URLSize);
+        if (!ReadAt(fd, url.data(), url.size(), offset + sizeof(header))) {
+            break;
+        }
+        // Later records replace the earlier ones for the same URL
+        IndexVary(url);
+        TWallTime expire = FromSeconds(header.Expire);
+        if (expire > now) {
+            Index_[Hash(url)] = TLocation{id, offset, expire};
+        } else {
+            Index_.erase(Hash(url));
+        }
+        offset = end;
+    }
+    return offset;
+}
+
+void TDiskCache::OpenSegment(std::uint32_t id) {
+    std::string path = SegmentPath(Options_.Directory, id);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1) {
+        throw std::runtime_error("Couldn't open " + path + ": " + std::strerror(errno));
+    }
+    if (ActiveFd_ != -1) {
+        close(ActiveFd_);
+    }
+    ActiveFd_ = fd;
+    Active_ = id;
+    std::lock_guard<std::mutex> guard(Lock_);
+    Segments_.try_emplace(id, TSegment{path, 0, nullptr});
+}
+
+void TDiskCache::DropOldestSegment() {
+    auto oldest = Segments_.begin();
+    for (auto it = Index_.begin(); it != Index_.end();) {
+        if (it->second.Segment == oldest->first) {
+            it = Index_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Mapped parts stay readable for the responses being sent
+    unlink(oldest->second.Path.c_str());
+    Bytes_ -= oldest->second.Size;
+    Segments_.erase(oldest);
+}
+
+void TDiskCache::Store(const std::string& url, std::shared_ptr<const TCachedResponse> response, TWallTime expire) {
+    std::size_t size = PendingSize(url, *response);
+    {
+        std::lock_guard<std::mutex> guard(QueueLock_);
+        if (Stopped_ || Disabled_ || PendingBytes_ + size > Options_.MaxPendingBytes) {
+            return;
+        }
+        Queue_.push_back(TWrite{url, std::move(response), expire});
+        PendingBytes_ += size;
+    }
+    QueueChanged_.notify_all();
+}
+
+void TDiskCache::Write(const TWrite& write) {
+    const TCachedResponse& response = *write.Response;
+    TRecordHeader header{
+        RecordMagic,
+        static_cast<std::uint32_t>(write.URL.size()),
+        static_cast<std::uint32_t>(response.SerializedHead.size()),
+        0,
+        response.Body.size(),
+        ToSeconds(write.Expire)
+    };
+    std::size_t total = sizeof(header) + write.URL.size() + response.SerializedHead.size() + response.Body.size();
+
+    std::uint64_t offset = 0;
+    {
+        std::lock_guard<std::mutex> guard(Lock_);
+        offset = Segments_[Active_].Size;
+    }
+    if (offset > 0 && offset + total > Options_.SegmentSize) {
+        OpenSegment(Active_ + 1);
+        offset = 0;
+    }
+    {
+        std::lock_guard<std::mutex> guard(Lock_);
+        while (Bytes_ + total > Options_.MaxBytes && Segments_.begin()->first != Active_) {
+            DropOldestSegment();
+        }
+    }
+
+    std::array<iovec, 4> parts = {
+        iovec{&header, sizeof(header)},
+        iovec{const_cast<char*>(write.URL.data()), write.URL.size()},
+        iovec{const_cast<char*>(response.SerializedHead.data()), response.SerializedHead.size()},
+        iovec{const_cast<char*>(response.Body.data()), response.Body.size()}
+    };
+    std::size_t written = 0;
+    std::size_t first = 0;
+    while (written < total) {
+        ssize_t n = writev(ActiveFd_, parts.data() + first, parts.size() - first);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            std::cerr << "[DISK]  write failed: " << std::strerror(errno) << std::endl;
+            Failures_++;
+            // Cut the partial record off, so that the next one starts clean
+            if (ftruncate(ActiveFd_, offset) != 0) {
+                OpenSegment(Active_ + 1);
+            }
+            return;
+        }
+        written += n;
+        // Skips what has been written
+        while (first < parts.size() && static_cast<std::size_t>(n) >= parts[first].iov_len) {
+            n -= parts[first].iov_len;
+            first++;
+        }
+        if (first < parts.size()) {
+            parts[first].iov_base = static_cast<char*>(parts[first].iov_base) + n;
+            parts[first].iov_len -= n;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(Lock_);
+    Segments_[Active_].Size += total;
+    Bytes_ += total;
+    Index_[Hash(write.URL)] = TLocation{Active_, offset, write.Expire};
+    IndexVary(write.URL);
+}
+
+void TDiskCache::IndexVary(std::string_view key) {
+    std::size_t end = key.find('\0');
+    std::uint64_t url = Hash(key.substr(0, end));
+    if (end == std::string_view::npos) {
+        Vary_.erase(url);
+        return;
+    }
+    std::vector<std::string> names;
+    // The URL is followed by "\0name=value" for each of them
+    while (end != std::string_view::npos) {
+        std::size_t start = end + 1;
+        end = key.find('\0', start);
+        std::string_view part = key.substr(start, end == std::string_view::npos ? end : end - start);
+        names.emplace_back(part.substr(0, part.find('=')));
+    }
+    Vary_[url] = std::move(names);
+}
+
+void TDiskCache::RunWriter() {
+    std::unique_lock<std::mutex> lock(QueueLock_);
+    while (true) {
+        QueueChanged_.wait(lock, [this]() { return Stopped_ || !Queue_.empty(); });
+        if (Queue_.empty()) {
+            return;
+        }
+        TWrite write = std::move(Queue_.front());
+        Queue_.pop_front();
+        Writing_ = true;
+        lock.unlock();
+
+        bool failed = false;
+        try {
+            Write(write);
+        } catch (const std::exception& e) {
+            std::cerr << "[DISK]  " << e.what() << ", writes disabled" << std::endl;
+            Failures_++;
+            failed = true;
+        }
+
+        lock.lock();
+        PendingBytes_ -= PendingSize(write.URL, *write.Response);
+        if (failed) {
+            Disabled_ = true;
+            for (const auto& queued : Queue_) {
+                PendingBytes_ -= PendingSize(queued.URL, *queued.Response);
+            }
+            Queue_.clear();
+        }
+        Writing_ = false;
+        QueueChanged_.notify_all();
+    }
+}
+
+void TDiskCache::Flush() {
+    std::unique_lock<std::mutex> lock(QueueLock_);
+    QueueChanged_.wait(lock, [this]() { return Queue_.empty() && !Writing_; });
+}
+
+std::vector<std::string> TDiskCache::Vary(const std::string& url) const {
+    std::lock_guard<std::mutex> guard(Lock_);
+    auto it = Vary_.find(Hash(url));
+    return it == Vary_.end() ? std::vector<std::string>() : it->second;
+}
+
+std::shared_ptr<const TCachedResponse> TDiskCache::Load(const std::string& url, TWallTime& expire) {
+    std::shared_ptr<TMapping> mapping;
+    std::uint32_t id = 0;
+    std::string path;
+    std::size_t size = 0;
+    std::uint64_t offset = 0;
+    {
+        std::lock_guard<std::mutex> guard(Lock_);
+        auto it = Index_.find(Hash(url));
+        if (it == Index_.end()) {
+            return nullptr;
+        }
+        if (it->second.Expire <= std::chrono::system_clock::now()) {
+            Index_.erase(it);
+            return nullptr;
+        }
+        const TSegment& segment = Segments_.at(it->second.Segment);
+        // The active segment grows, so it is mapped again when the
+        // record lies past the current mapping
+        if (segment.Mapping && segment.Mapping->Size >= segment.Size) {
+            mapping = segment.Mapping;
+        } else {
+            path = segment.Path;
+            size = segment.Size;
+        }
+        id = it->second.Segment;
+        offset = it->second.Offset;
+        expire = it->second.Expire;
+    }
+
+    // Mapping takes a while, so other lookups go on meanwhile
+    if (!mapping) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return nullptr;
+        }
+        mapping = std::make_shared<TMapping>();
+        mapping->Data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        mapping->Size = size;
+        close(fd);
+        if (mapping->Data == MAP_FAILED) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> guard(Lock_);
+        auto segment = Segments_.find(id);
+        // A concurrent lookup may have mapped more of it already
+        if (segment != Segments_.end() && (!segment->second.Mapping || segment->second.Mapping->Size < size)) {
+            segment->second.Mapping = mapping;
+        }
+    }
+
+    const char* data = static_cast<const char*>(mapping->Data);
+    TRecordHeader header;
+    std::memcpy(&header, data + offset, sizeof(header));
+    std::string_view record(data + offset + sizeof(header), mapping->Size - offset - sizeof(header));
+    // Different URLs may share a hash
+    if (header.Magic != RecordMagic || record.substr(0, header.URLSize) != url) {
+        return nullptr;
+    }
+    record.remove_prefix(header.URLSize);
+    std::string_view head = record.substr(0, header.HeadSize);
+    std::string_view body = record.substr(header.HeadSize, header.BodySize);
+    return MakeCachedResponse(head, body, std::move(mapping));
+}
+
+std::size_t TDiskCache::Entries() const {
+    std::lock_guard<std::mutex> guard(Lock_);
+    return Index_.size();
+}
+
+std::size_t TDiskCache::Bytes() const {
+    std::lock_guard<std::mutex> guard(Lock_);
+    return Bytes_;
+}
+
+std::uint64_t TDiskCache::Failures() const {
+    return Failures_;
+}
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <CachedResponse.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace NHttpProxy {
+
+struct TDiskCacheOptions {
+    // Where the segment files live
+    std::string Directory;
+    // A segment is closed for writing once it grows past this size
+    std::size_t SegmentSize = 64 << 20;
+    // The oldest segments are deleted to stay within this budget
+    std::size_t MaxBytes = 1 << 30;
+    // Writes waiting for the writer thread. Responses stored beyond that
+    // are kept in memory only.
+    std::size_t MaxPendingBytes = 64 << 20;
+};
+
+// Second cache tier surviving restarts. Responses are appended to segment
+// files by a background thread; an in-memory index maps the URL hash to
+// the record. Reads map the segment into memory, so a body is served
+// from the page cache without being copied. At startup the index is
+// rebuilt from the record headers only.
+class TDiskCache {
+public:
+    using TWallTime = std::chrono::system_clock::time_point;
+
+    // Creates the directory if needed and indexes the segments in it
+    explicit TDiskCache(const TDiskCacheOptions& options);
+    // Writes out the pending responses
+    ~TDiskCache();
+
+    TDiskCache(const TDiskCache&) = delete;
+    TDiskCache& operator=(const TDiskCache&) = delete;
+
+    // Thread-safe. Queues the response for writing.
+    void Store(const std::string& url, std::shared_ptr<const TCachedResponse> response, TWallTime expire);
+
+    // Thread-safe. Returns a fresh response and sets its expiration time,
+    // or returns nullptr.
+    std::shared_ptr<const TCachedResponse> Load(const std::string& url, TWallTime& expire);
+
+    // Thread-safe. Returns the request headers the latest record stored for
+    // the URL varies on, as recorded in its key (see CacheKey).
+    std::vector<std::string> Vary(const std::string& url) const;
+
+    // Waits until everything stored so far is written
+    void Flush();
+
+    std::size_t Entries() const;
+    std::size_t Bytes() const;
+    // Records that couldn't be written
+    std::uint64_t Failures() const;
+
+private:
+    struct TMapping;
+
+    struct TSegment {
+        std::string Path;
+        std::size_t Size = 0;
+        // Covers the segment as it was when last mapped
+        std::shared_ptr<TMapping> Mapping;
+    };
+
+    struct TLocation {
+        std::uint32_t Segment;
+        std::uint64_t Offset;
+        TWallTime Expire;
+    };
+
+    struct TWrite {
+        std::string URL;
+        std::shared_ptr<const TCachedResponse> Response;
+        TWallTime Expire;
+    };
+
+    void Recover();
+    // Notes the headers the record key varies on. Lock_ must be held.
+    void IndexVary(std::string_view key);
+    // Indexes the records of a segment, returns the size of its intact part
+    std::size_t IndexSegment(std::uint32_t id, int fd, std::size_t size);
+    void OpenSegment(std::uint32_t id);
+    void DropOldestSegment();
+    void Write(const TWrite& write);
+    void RunWriter();
+
+    TDiskCacheOptions Options_;
+
+    // Guards the index and the segments
+    mutable std::mutex Lock_;
+    std::unordered_map<std::uint64_t, TLocation> Index_;
+    // By the hash of the URL without the varying headers
+    std::unordered_map<std::uint64_t, std::vector<std::string>> Vary_;
+    std::map<std::uint32_t, TSegment> Segments_;
+    std::size_t Bytes_ = 0;
+    // The segment being appended to
+    std::uint32_t Active_ = 0;
+    int ActiveFd_ = -1;
+
+    std::mutex QueueLock_;
+    std::condition_variable QueueChanged_;
+    std::deque<TWrite> Queue_;
+    std::size_t PendingBytes_ = 0;
+    bool Writing_ = false;
+    bool Stopped_ = false;
+    // Set once a segment can't be opened: what is on disk is still served,
+    // but nothing more is written
+    bool Disabled_ = false;
+    std::atomic<std::uint64_t> Failures_{0};
+    std::thread Writer_;
+};
+
+}
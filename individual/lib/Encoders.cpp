@@ -0,0 +1,305 @@
+#include <Encoders.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#ifdef PROXY_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#ifdef PROXY_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace NHttpProxy {
+namespace {
+
+std::string_view Trim(std::string_view sv) {
+    while (!sv.empty() && (sv.front() == ' ' || sv.front() == '\t')) {
+        sv.remove_prefix(1);
+    }
+    while (!sv.empty() && (sv.back() == ' ' || sv.back() == '\t')) {
+        sv.remove_suffix(1);
+    }
+    return sv;
+}
+
+std::string ToLower(std::string_view sv) {
+    std::string ret(sv);
+    for (char& c : ret) {
+        c = std::tolower(static_cast<unsigned char>(c));
+    }
+    return ret;
+}
+
+// Free space appended to out for each round of a compressor
+constexpr std::size_t OutputStep = 4096;
+
+class TGzipStream : public TEncoderStream {
+public:
+    TGzipStream() {
+        // 16 on top of the window bits asks for the gzip wrapper
+        if (deflateInit2(&Stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("deflateInit2 failed");
+        }
+    }
+
+    ~TGzipStream() override {
+        deflateEnd(&Stream_);
+    }
+
+    void Write(std::string_view piece, std::string& out) override {
+        Deflate(piece, Z_NO_FLUSH, out);
+    }
+
+    void Flush(std::string& out) override {
+        Deflate({}, Z_SYNC_FLUSH, out);
+    }
+
+    void Finish(std::string& out) override {
+        Deflate({}, Z_FINISH, out);
+        deflateReset(&Stream_);
+    }
+
+private:
+    void Deflate(std::string_view piece, int flush, std::string& out) {
+        Stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(piece.data()));
+        Stream_.avail_in = piece.size();
+        // A round that fills all the space means zlib may have more to say
+        do {
+            std::size_t offset = out.size();
+            out.resize(offset + OutputStep);
+            Stream_.next_out = reinterpret_cast<Bytef*>(out.data() + offset);
+            Stream_.avail_out = OutputStep;
+            int ret = deflate(&Stream_, flush);
+            out.resize(out.size() - Stream_.avail_out);
+            if (ret == Z_STREAM_ERROR) {
+                throw std::runtime_error("deflate failed");
+            }
+        } while (Stream_.avail_out == 0);
+    }
+
+    z_stream Stream_{};
+};
+
+#ifdef PROXY_WITH_BROTLI
+class TBrotliStream : public TEncoderStream {
+public:
+    TBrotliStream() {
+        Reset();
+    }
+
+    ~TBrotliStream() override {
+        BrotliEncoderDestroyInstance(State_);
+    }
+
+    void Write(std::string_view piece, std::string& out) override {
+        Compress(piece, BROTLI_OPERATION_PROCESS, out);
+    }
+
+    void Flush(std::string& out) override {
+        Compress({}, BROTLI_OPERATION_FLUSH, out);
+    }
+
+    void Finish(std::string& out) override {
+        Compress({}, BROTLI_OPERATION_FINISH, out);
+        // A finished encoder can't be restarted
+        BrotliEncoderDestroyInstance(State_);
+        Reset();
+    }
+
+private:
+    void Reset() {
+        State_ = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+        if (State_ == nullptr) {
+            throw std::runtime_error("BrotliEncoderCreateInstance failed");
+        }
+        // Qualities above 5 are too slow to keep up with the network, and
+        // a 256 KiB window bounds the memory
+        BrotliEncoderSetParameter(State_, BROTLI_PARAM_QUALITY, 5);
+        BrotliEncoderSetParameter(State_, BROTLI_PARAM_LGWIN, 18);
+    }
+
+    void Compress(std::string_view piece, BrotliEncoderOperation operation, std::string& out) {
+        std::size_t availableIn = piece.size();
+        const std::uint8_t* nextIn = reinterpret_cast<const std::uint8_t*>(piece.data());
+        do {
+            std::size_t offset = out.size();
+            out.resize(offset + OutputStep);
+            std::size_t availableOut = OutputStep;
+            std::uint8_t* nextOut = reinterpret_cast<std::uint8_t*>(out.data() + offset);
+            if (!BrotliEncoderCompressStream(State_, operation, &availableIn, &nextIn, &availableOut, &nextOut, nullptr)) {
+                throw std::runtime_error("BrotliEncoderCompressStream failed");
+            }
+            out.resize(out.size() - availableOut);
+        } while (availableIn > 0 || BrotliEncoderHasMoreOutput(State_)
+            || (operation == BROTLI_OPERATION_FINISH && !BrotliEncoderIsFinished(State_)));
+    }
+
+    BrotliEncoderState* State_ = nullptr;
+};
+#endif
+
+#ifdef PROXY_WITH_ZSTD
+class TZstdStream : public TEncoderStream {
+public:
+    TZstdStream()
+        : Context_(ZSTD_createCCtx())
+    {
+        if (Context_ == nullptr) {
+            throw std::runtime_error("ZSTD_createCCtx failed");
+        }
+        // Low levels are several times cheaper than gzip with a similar ratio
+        ZSTD_CCtx_setParameter(Context_, ZSTD_c_compressionLevel, 3);
+        // Browsers only promise to decode windows up to 8 MiB
+        ZSTD_CCtx_setParameter(Context_, ZSTD_c_windowLog, 20);
+    }
+
+    ~TZstdStream() override {
+        ZSTD_freeCCtx(Context_);
+    }
+
+    void Write(std::string_view piece, std::string& out) override {
+        Compress(piece, ZSTD_e_continue, out);
+    }
+
+    void Flush(std::string& out) override {
+        Compress({}, ZSTD_e_flush, out);
+    }
+
+    void Finish(std::string& out) override {
+        Compress({}, ZSTD_e_end, out);
+        ZSTD_CCtx_reset(Context_, ZSTD_reset_session_only);
+    }
+
+private:
+    void Compress(std::string_view piece, ZSTD_EndDirective directive, std::string& out) {
+        ZSTD_inBuffer in{piece.data(), piece.size(), 0};
+        std::size_t remaining = 0;
+        do {
+            std::size_t offset = out.size();
+            out.resize(offset + OutputStep);
+            ZSTD_outBuffer output{out.data() + offset, OutputStep, 0};
+            remaining = ZSTD_compressStream2(Context_, &output, &in, directive);
+            if (ZSTD_isError(remaining)) {
+                throw std::runtime_error(ZSTD_getErrorName(remaining));
+            }
+            out.resize(offset + output.pos);
+        } while (in.pos < in.size || (directive != ZSTD_e_continue && remaining > 0));
+    }
+
+    ZSTD_CCtx* Context_;
+};
+#endif
+
+}
+
+std::vector<TAcceptedCoding> ParseAcceptEncoding(std::string_view value) {
+    std::vector<TAcceptedCoding> ret;
+    while (!value.empty()) {
+        auto comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+
+        auto semicolon = item.find(';');
+        std::string_view name = Trim(item.substr(0, semicolon));
+        if (name.empty()) {
+            continue;
+        }
+        TAcceptedCoding coding{ToLower(name), 1};
+        while (semicolon != std::string_view::npos) {
+            item.remove_prefix(semicolon + 1);
+            semicolon = item.find(';');
+            std::string_view param = Trim(item.substr(0, semicolon));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                // from_chars for double is missing in older standard libraries
+                std::string quality(param.substr(2));
+                coding.Quality = std::clamp(std::strtod(quality.c_str(), nullptr), 0.0, 1.0);
+            }
+        }
+        ret.push_back(std::move(coding));
+    }
+    return ret;
+}
+
+double AcceptQuality(const std::vector<TAcceptedCoding>& accepted, std::string_view coding) {
+    const TAcceptedCoding* any = nullptr;
+    for (const auto& item : accepted) {
+        if (item.Name == coding) {
+            return item.Quality;
+        }
+        if (item.Name == "*") {
+            any = &item;
+        }
+    }
+    if (any != nullptr) {
+        return any->Quality;
+    }
+    return coding == "identity" ? 1 : 0;
+}
+
+TEncoderRegistry TEncoderRegistry::Builtin() {
+    TEncoderRegistry registry;
+    registry.Register({"gzip", 1, 1, []() { return std::make_unique<TGzipStream>(); }});
+#ifdef PROXY_WITH_BROTLI
+    registry.Register({"br", 1.2, 0.85, []() { return std::make_unique<TBrotliStream>(); }});
+#endif
+#ifdef PROXY_WITH_ZSTD
+    registry.Register({"zstd", 0.4, 0.9, []() { return std::make_unique<TZstdStream>(); }});
+#endif
+    return registry;
+}
+
+void TEncoderRegistry::Register(TEncoder encoder) {
+    for (auto& existing : Encoders_) {
+        if (existing.Name == encoder.Name) {
+            existing = std::move(encoder);
+            return;
+        }
+    }
+    Encoders_.push_back(std::move(encoder));
+}
+
+const TEncoder* TEncoderRegistry::Find(std::string_view name) const {
+    for (const auto& encoder : Encoders_) {
+        if (encoder.Name == name) {
+            return &encoder;
+        }
+    }
+    return nullptr;
+}
+
+const TEncoder* TEncoderRegistry::Choose(std::string_view acceptEncoding, double cpuWeight) const {
+    auto accepted = ParseAcceptEncoding(acceptEncoding);
+
+    const TEncoder* best = nullptr;
+    double bestQuality = 0;
+    double bestScore = 0;
+    for (const auto& encoder : Encoders_) {
+        double quality = AcceptQuality(accepted, encoder.Name);
+        if (quality <= 0) {
+            continue;
+        }
+        double score = cpuWeight * encoder.Cost + (1 - cpuWeight) * encoder.Size;
+        if (best == nullptr || quality > bestQuality || (quality == bestQuality && score < bestScore)) {
+            best = &encoder;
+            bestQuality = quality;
+            bestScore = score;
+        }
+    }
+    // Identity is always acceptable, but wins only when the client asks
+    // for it explicitly
+    for (const auto& item : accepted) {
+        if (item.Name == "identity" && item.Quality > bestQuality) {
+            return nullptr;
+        }
+    }
+    return best;
+}
+
+}
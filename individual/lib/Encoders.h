@@ -0,0 +1,73 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace NHttpProxy {
+
+// Compresses a body piece by piece. Whatever the body size, it keeps
+// nothing but the compressor state.
+class TEncoderStream {
+public:
+    virtual ~TEncoderStream() = default;
+
+    // Compresses the piece, appending to out whatever output is ready
+    virtual void Write(std::string_view piece, std::string& out) = 0;
+
+    // Appends everything written so far to out, so that the receiver can
+    // decode it right away
+    virtual void Flush(std::string& out) = 0;
+
+    // Appends the rest of the output and the trailer to out. The stream
+    // can be reused for another body afterwards.
+    virtual void Finish(std::string& out) = 0;
+};
+
+// A content coding the proxy can produce
+struct TEncoder {
+    // Token used in Accept-Encoding and Content-Encoding
+    std::string Name;
+    // Rough CPU time and output size on text relative to gzip, used to
+    // choose between the codings a client accepts
+    double Cost = 1;
+    double Size = 1;
+    std::function<std::unique_ptr<TEncoderStream>()> MakeStream;
+};
+
+struct TAcceptedCoding {
+    // Lowercase token, "*" included
+    std::string Name;
+    double Quality = 1;
+};
+
+// Parses an Accept-Encoding value, q-values included
+std::vector<TAcceptedCoding> ParseAcceptEncoding(std::string_view value);
+
+// Quality the client gives to the coding: its own entry, otherwise "*",
+// otherwise 1 for identity and 0 for the rest
+double AcceptQuality(const std::vector<TAcceptedCoding>& accepted, std::string_view coding);
+
+class TEncoderRegistry {
+public:
+    // gzip, and br and zstd if the proxy is built with them
+    static TEncoderRegistry Builtin();
+
+    // Replaces an encoder with the same name, if any
+    void Register(TEncoder encoder);
+
+    const TEncoder* Find(std::string_view name) const;
+
+    // Picks the coding for a client among the ones it prefers most. Ties
+    // are broken by cost and size: cpuWeight 1 picks the cheapest encoder,
+    // 0 the smallest output. Returns nullptr if none is acceptable or the
+    // client explicitly prefers identity.
+    const TEncoder* Choose(std::string_view acceptEncoding, double cpuWeight) const;
+
+private:
+    std::vector<TEncoder> Encoders_;
+};
+
+}
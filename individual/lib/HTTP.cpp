@@ -1,109 +1,320 @@
 #include <HTTP.h>
+#include <Chunked.h>
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cctype>
 #include <charconv>
+#include <cstring>
 
 namespace NHttpProxy {
 
+namespace {
+
+constexpr std::string_view LineBreak = "\r\n";
+// Longest start line and header fields together
+constexpr std::size_t MaxHeadSize = 64 << 10;
+
+boost::asio::const_buffer Buffer(std::string_view s) {
+    return boost::asio::buffer(s.data(), s.size());
+}
+
+// Copies what the buffers reference into one string
+std::string Join(const TBuffers& buffers) {
+    std::string ret;
+    ret.reserve(boost::asio::buffer_size(buffers));
+    for (const auto& buffer : buffers) {
+        ret.append(static_cast<const char*>(buffer.data()), buffer.size());
+    }
+    return ret;
+}
+
+// Builds a line from the parts, with the line break
+std::pmr::string MakeLine(std::initializer_list<std::string_view> parts, std::pmr::memory_resource* resource) {
+    std::size_t size = LineBreak.size();
+    for (auto part : parts) {
+        size += part.size();
+    }
+    std::pmr::string ret(resource);
+    ret.reserve(size);
+    for (auto part : parts) {
+        ret.append(part);
+    }
+    ret.append(LineBreak);
+    return ret;
+}
+
+std::string_view Slice(const std::pmr::string& line, std::size_t begin, std::size_t end) {
+    return std::string_view(line).substr(begin, end - begin);
+}
+
+}
+
 THttpRequestLine::THttpRequestLine(
-    const std::string& method,
-    const std::string& url,
-    const std::string& httpVersion
+    std::string_view method,
+    std::string_view url,
+    std::string_view httpVersion,
+    std::pmr::memory_resource* resource
 )
-    : Method_(method)
-    , URL_(url)
-    , HttpVersion_(httpVersion)
+    : Line_(MakeLine({method, " ", url, " ", httpVersion}, resource))
+    , First_(method.size())
+    , Second_(method.size() + 1 + url.size())
 {}
 
-const std::string& THttpRequestLine::Method() const {
-    return Method_;
+std::string_view THttpRequestLine::Method() const {
+    return Slice(Line_, 0, First_);
 }
 
-const std::string& THttpRequestLine::URL() const {
-    return URL_;
+std::string_view THttpRequestLine::URL() const {
+    return Slice(Line_, First_ + 1, Second_);
 }
 
-const std::string& THttpRequestLine::HttpVersion() const {
-    return HttpVersion_;
+std::string_view THttpRequestLine::HttpVersion() const {
+    return Slice(Line_, Second_ + 1, Line_.size() - LineBreak.size());
 }
 
 std::string THttpRequestLine::Serialize() const {
-    return Method_ + " " + URL_ + " " + HttpVersion_;
+    return std::string(Line_, 0, Line_.size() - LineBreak.size());
+}
+
+void THttpRequestLine::Serialize(TBuffers& buffers) const {
+    buffers.push_back(Buffer(Line_));
 }
 
 THttpResponseStatusLine::THttpResponseStatusLine(
-    const std::string& httpVersion,
-    const std::string& statusCode,
-    const std::string& reason
+    std::string_view httpVersion,
+    std::string_view statusCode,
+    std::string_view reason,
+    std::pmr::memory_resource* resource
 )
-    : HttpVersion_(httpVersion)
-    , StatusCode_(statusCode)
-    , Reason_(reason)
+    : Line_(MakeLine({httpVersion, " ", statusCode, " ", reason}, resource))
+    , First_(httpVersion.size())
+    , Second_(httpVersion.size() + 1 + statusCode.size())
 {}
 
-const std::string& THttpResponseStatusLine::HttpVersion() const {
-    return HttpVersion_;
+std::string_view THttpResponseStatusLine::HttpVersion() const {
+    return Slice(Line_, 0, First_);
 }
 
-const std::string& THttpResponseStatusLine::StatusCode() const {
-    return StatusCode_;
+std::string_view THttpResponseStatusLine::StatusCode() const {
+    return Slice(Line_, First_ + 1, Second_);
 }
 
-const std::string& THttpResponseStatusLine::Reason() const {
-    return Reason_;
+std::string_view THttpResponseStatusLine::Reason() const {
+    return Slice(Line_, Second_ + 1, Line_.size() - LineBreak.size());
 }
 
 std::string THttpResponseStatusLine::Serialize() const {
-    return HttpVersion_ + " " + StatusCode_ + " " + Reason_;
+    return std::string(Line_, 0, Line_.size() - LineBreak.size());
+}
+
+void THttpResponseStatusLine::Serialize(TBuffers& buffers) const {
+    buffers.push_back(Buffer(Line_));
+}
+
+namespace {
+
+bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+// FNV-1a of the name in lowercase
+std::uint32_t HashIgnoreCase(std::string_view name) {
+    std::uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash ^= static_cast<unsigned char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr std::string_view HeaderNames[] = {
+    "",
+    "Accept",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Age",
+    "Authorization",
+    "Cache-Control",
+    "Connection",
+    "Content-Encoding",
+    "Content-Length",
+    "Content-Type",
+    "Date",
+    "ETag",
+    "Expect",
+    "Expires",
+    "Host",
+    "If-Modified-Since",
+    "If-None-Match",
+    "Keep-Alive",
+    "Last-Modified",
+    "Pragma",
+    "Proxy-Connection",
+    "Transfer-Encoding",
+    "Upgrade",
+    "User-Agent",
+    "Vary"
+};
+static_assert(std::size(HeaderNames) == static_cast<std::size_t>(EHeader::Count));
+
+// Open addressing table of the well-known names by their hash
+class TKnownHeaders {
+public:
+    TKnownHeaders() {
+        Slots_.fill(EHeader::Unknown);
+        for (std::size_t i = 1; i < std::size(HeaderNames); i++) {
+            std::size_t slot = HashIgnoreCase(HeaderNames[i]) % Slots_.size();
+            while (Slots_[slot] != EHeader::Unknown) {
+                slot = (slot + 1) % Slots_.size();
+            }
+            Slots_[slot] = static_cast<EHeader>(i);
+        }
+    }
+
+    EHeader Find(std::string_view name, std::uint32_t hash) const {
+        for (std::size_t slot = hash % Slots_.size(); Slots_[slot] != EHeader::Unknown; slot = (slot + 1) % Slots_.size()) {
+            if (EqualsIgnoreCase(HeaderName(Slots_[slot]), name)) {
+                return Slots_[slot];
+            }
+        }
+        return EHeader::Unknown;
+    }
+
+private:
+    std::array<EHeader, 64> Slots_;
+};
+
+EHeader KnownHeader(std::string_view name, std::uint32_t hash) {
+    static const TKnownHeaders known;
+    return known.Find(name, hash);
+}
+
+}
+
+EHeader HeaderId(std::string_view name) {
+    return KnownHeader(name, HashIgnoreCase(name));
+}
+
+std::string_view HeaderName(EHeader id) {
+    return HeaderNames[static_cast<std::size_t>(id)];
 }
 
 THttpHeader::THttpHeader(
-    const std::string& key,
-    const std::string& value
+    std::string_view key,
+    std::string_view value,
+    std::pmr::memory_resource* resource
 )
-    : Key_(key)
-    , Value_(value)
+    : Line_(MakeLine({key, ": ", value}, resource))
+    , KeySize_(key.size())
+    , Hash_(HashIgnoreCase(key))
+    , Id_(KnownHeader(key, Hash_))
 {}
 
-const std::string& THttpHeader::Key() const {
-    return Key_;
+THttpHeader::THttpHeader(
+    EHeader id,
+    std::string_view value,
+    std::pmr::memory_resource* resource
+)
+    : Line_(MakeLine({HeaderName(id), ": ", value}, resource))
+    , KeySize_(HeaderName(id).size())
+    , Hash_(HashIgnoreCase(HeaderName(id)))
+    , Id_(id)
+{}
+
+THttpHeader::THttpHeader(const THttpHeader& other, std::pmr::memory_resource* resource)
+    : Line_(other.Line_, resource)
+    , KeySize_(other.KeySize_)
+    , Hash_(other.Hash_)
+    , Id_(other.Id_)
+{}
+
+std::string_view THttpHeader::Key() const {
+    return Slice(Line_, 0, KeySize_);
 }
 
-const std::string& THttpHeader::Value() const {
-    return Value_;
+std::string_view THttpHeader::Value() const {
+    return Slice(Line_, KeySize_ + 2, Line_.size() - LineBreak.size());
+}
+
+EHeader THttpHeader::Id() const {
+    return Id_;
+}
+
+bool THttpHeader::Is(std::string_view name) const {
+    return Hash_ == HashIgnoreCase(name) && EqualsIgnoreCase(Key(), name);
+}
+
+bool THttpHeader::Is(EHeader id) const {
+    return id != EHeader::Unknown && Id_ == id;
 }
 
 std::vector<std::string_view> THttpHeader::SplitValue() const {
+    std::string_view value = Value();
     std::vector<std::string_view> ret;
     std::size_t start = 0;
-    for (std::size_t i = 0; i != Value_.size(); i++) {
-        if (Value_[i] == ' ' || Value_[i] == ',') {
+    for (std::size_t i = 0; i != value.size(); i++) {
+        if (value[i] == ' ' || value[i] == ',') {
             if (i > start) {
-                ret.emplace_back(std::string_view(Value_).substr(start, i - start));
+                ret.emplace_back(value.substr(start, i - start));
             }
             start = i + 1;
         }
     }
-    if (start < Value_.size()) {
-        ret.emplace_back(std::string_view(Value_).substr(start, Value_.size() - start));
+    if (start < value.size()) {
+        ret.emplace_back(value.substr(start, value.size() - start));
     }
     return ret;
 }
 
 std::string THttpHeader::Serialize() const {
-    return Key_ + ": " + Value_;
+    return std::string(Line_, 0, Line_.size() - LineBreak.size());
+}
+
+void THttpHeader::SetValue(std::string_view value) {
+    std::size_t begin = KeySize_ + 2;
+    Line_.replace(begin, Line_.size() - LineBreak.size() - begin, value);
 }
 
+THttpHeaders::THttpHeaders()
+    : Resource_(std::pmr::get_default_resource())
+{}
+
+THttpHeaders::THttpHeaders(std::pmr::memory_resource* resource)
+    : Resource_(resource)
+{}
+
 THttpHeaders::THttpHeaders(const std::vector<THttpHeader>& headers)
-    : Headers_(headers)
+    : Resource_(std::pmr::get_default_resource())
+    , Headers_(headers.begin(), headers.end())
+{}
+
+THttpHeaders::THttpHeaders(const THttpHeaders& other)
+    : Resource_(std::pmr::get_default_resource())
+    , Headers_(other.Headers_)
+{}
+
+THttpHeaders::THttpHeaders(const THttpHeaders& other, std::pmr::memory_resource* resource)
+    : Resource_(resource)
 {
-    for (const auto& header : Headers_) {
-        auto hint = Values_.find(header.Key());
-        if (hint == Values_.end() || hint->first != header.Key()) {
-            Values_.emplace_hint(hint, header.Key(), header.Value());
-        }
+    for (const THttpHeader& header : other.Headers_) {
+        Append(header);
+    }
+}
+
+THttpHeaders& THttpHeaders::operator=(const THttpHeaders& other) {
+    if (this == &other) {
+        return *this;
+    }
+    // The headers stay on the resource they are on
+    Headers_.clear();
+    for (const THttpHeader& header : other.Headers_) {
+        Append(header);
     }
+    return *this;
 }
 
 std::size_t THttpHeaders::Size() const {
@@ -114,71 +325,146 @@ const THttpHeader& THttpHeaders::operator[](std::size_t i) const {
     return Headers_[i];
 }
 
-const std::string& THttpHeaders::operator[](const std::string& key) const {
-    return Values_[key];
+std::string_view THttpHeaders::operator[](std::string_view name) const {
+    const THttpHeader* header = Find(name);
+    return header == nullptr ? std::string_view() : header->Value();
 }
 
 void THttpHeaders::Append(const THttpHeader& header) {
-    Headers_.emplace_back(header);
-    auto hint = Values_.find(header.Key());
-    if (hint == Values_.end() || hint->first != header.Key()) {
-        Values_.emplace_hint(hint, header.Key(), header.Value());
-    }
+    Headers_.emplace_back(header, Resource_);
+}
+
+void THttpHeaders::Append(std::string_view key, std::string_view value) {
+    Headers_.emplace_back(key, value, Resource_);
+}
+
+void THttpHeaders::Append(EHeader id, std::string_view value) {
+    Headers_.emplace_back(id, value, Resource_);
 }
 
 void THttpHeaders::Update(const THttpHeader& header) {
-    auto it = Values_.find(header.Key());
-    if (it == Values_.end()) {
-        Append(header);
-        return;
-    }
-    it->second = header.Value();
+    bool found = false;
     for (auto& h : Headers_) {
-        if (h.Key() == header.Key()) {
-            h = header;
+        if (h.Hash_ == header.Hash_ && EqualsIgnoreCase(h.Key(), header.Key())) {
+            h.SetValue(header.Value());
+            found = true;
         }
     }
+    if (!found) {
+        Append(header);
+    }
 }
 
-void THttpHeaders::Remove(const std::string& key) {
-    Values_.erase(key);
+void THttpHeaders::Remove(std::string_view name) {
+    std::uint32_t hash = HashIgnoreCase(name);
     Headers_.erase(
         std::remove_if(
             Headers_.begin(),
             Headers_.end(),
-            [&key](const THttpHeader& header) {
-                return header.Key() == key;
+            [hash, name](const THttpHeader& header) {
+                return header.Hash_ == hash && EqualsIgnoreCase(header.Key(), name);
             }
         ),
         Headers_.end()
     );
 }
 
-std::optional<THttpHeader> THttpHeaders::Find(const std::string& key) const {
-    auto it = Values_.find(key);
+void THttpHeaders::Remove(EHeader id) {
+    Headers_.erase(
+        std::remove_if(
+            Headers_.begin(),
+            Headers_.end(),
+            [id](const THttpHeader& header) {
+                return header.Is(id);
+            }
+        ),
+        Headers_.end()
+    );
+}
 
-    if (it == Values_.end()) {
-        return {};
+const THttpHeader* THttpHeaders::Find(std::string_view name) const {
+    std::uint32_t hash = HashIgnoreCase(name);
+    for (const THttpHeader& header : Headers_) {
+        if (header.Hash_ == hash && EqualsIgnoreCase(header.Key(), name)) {
+            return &header;
+        }
     }
+    return nullptr;
+}
 
-    return THttpHeader{it->first, it->second};
+const THttpHeader* THttpHeaders::Find(EHeader id) const {
+    for (const THttpHeader& header : Headers_) {
+        if (header.Is(id)) {
+            return &header;
+        }
+    }
+    return nullptr;
 }
 
 std::string THttpHeaders::Serialize() const {
-    std::string ret;
-    for (const THttpHeader& header : Headers_)
-        ret += header.Serialize() + "\r\n";
-    return ret;
+    TBuffers buffers;
+    Serialize(buffers);
+    return Join(buffers);
+}
+
+void THttpHeaders::Serialize(TBuffers& buffers) const {
+    for (const THttpHeader& header : Headers_) {
+        buffers.push_back(Buffer(header.Line_));
+    }
+}
+
+void RemoveHopByHopHeaders(THttpHeaders& headers) {
+    headers.Remove(EHeader::Connection);
+    headers.Remove(EHeader::KeepAlive);
+    headers.Remove(EHeader::ProxyConnection);
+}
+
+std::pair<std::string, std::string> SplitURL(std::string_view url) {
+    std::size_t i = 0;
+    auto ss = url.find("://");
+    if (ss != std::string_view::npos) {
+        i = ss + 3;
+    }
+    auto j = url.substr(i).find('/');
+    std::string scheme(ss == std::string_view::npos ? "http" : url.substr(0, ss));
+    std::string_view host = url.substr(i, j);
+    auto colon = host.rfind(':');
+    if (colon != std::string_view::npos && host.find(']', colon) == std::string_view::npos) {
+        return {std::string(host.substr(0, colon)), std::string(host.substr(colon + 1))};
+    }
+    return {std::string(host), scheme};
+}
+
+bool KeepsConnection(std::string_view httpVersion, const THttpHeaders& headers) {
+    bool keepAlive = httpVersion != "HTTP/1.0";
+    const THttpHeader* connection = headers.Find(EHeader::Connection);
+    if (connection != nullptr) {
+        for (auto token : connection->SplitValue()) {
+            if (EqualsIgnoreCase(token, "close")) {
+                return false;
+            }
+            if (EqualsIgnoreCase(token, "keep-alive")) {
+                keepAlive = true;
+            }
+        }
+    }
+    return keepAlive;
 }
 
 THttpRequest::THttpRequest(
-    const THttpRequestLine& requestLine,
-    const THttpHeaders& headers,
-    const std::string& data
+    THttpRequestLine requestLine,
+    THttpHeaders headers,
+    std::string data
 )
-    : RequestLine_(requestLine)
-    , Headers_(headers)
-    , Data_(data)
+    : RequestLine_(std::move(requestLine))
+    , Headers_(std::move(headers))
+    , Data_(std::move(data))
+{}
+
+THttpRequest::THttpRequest(const THttpRequest& other, std::pmr::memory_resource* resource)
+    : RequestLine_(other.RequestLine_.Method(), other.RequestLine_.URL(), other.RequestLine_.HttpVersion(), resource)
+    , Headers_(other.Headers_, resource)
+    , Data_(other.Data_)
 {}
 
 const THttpRequestLine& THttpRequest::RequestLine() const {
@@ -198,19 +484,28 @@ const std::string& THttpRequest::Data() const {
 }
 
 std::string THttpRequest::Serialize() const {
-    return RequestLine_.Serialize()
-        + "\r\n" + Headers_.Serialize()
-        + "\r\n" + Data_;
+    TBuffers buffers;
+    Serialize(buffers);
+    return Join(buffers);
+}
+
+void THttpRequest::Serialize(TBuffers& buffers) const {
+    RequestLine_.Serialize(buffers);
+    Headers_.Serialize(buffers);
+    buffers.push_back(Buffer(LineBreak));
+    if (!Data_.empty()) {
+        buffers.push_back(Buffer(Data_));
+    }
 }
 
 THttpResponse::THttpResponse(
-    const THttpResponseStatusLine& requestLine,
-    const THttpHeaders& headers,
-    const std::string& data
+    THttpResponseStatusLine statusLine,
+    THttpHeaders headers,
+    std::string data
 )
-    : StatusLine_(requestLine)
-    , Headers_(headers)
-    , Data_(data)
+    : StatusLine_(std::move(statusLine))
+    , Headers_(std::move(headers))
+    , Data_(std::move(data))
 {}
 
 const THttpResponseStatusLine& THttpResponse::ResponseStatusLine() const {
@@ -229,434 +524,532 @@ const std::string& THttpResponse::Data() const {
     return Data_;
 }
 
-void THttpResponse::UpdateContentLength() {
-    Headers_.Update({"Content-Length", std::to_string(Data_.size())});
+std::string THttpResponse::TakeData() && {
+    return std::move(Data_);
 }
 
-std::string THttpResponse::Serialize() const {
-    return StatusLine_.Serialize()
-        + "\r\n" + Headers_.Serialize()
-        + "\r\n" + Data_;
+void THttpRequest::UpdateContentLength() {
+    Headers_.Update({EHeader::ContentLength, std::to_string(Data_.size())});
 }
 
-namespace {
-
-bool EndsWith(const std::string& s, const std::string& t) {
-    if (t.size() > s.size()) {
-        return false;
-    }
-    for (std::size_t i = 0; i < t.size(); i++) {
-        if (s[s.size() - 1 - i] != t[t.size() - 1 - i]) {
-            return false;
-        }
-    }
-    return true;
+void THttpResponse::UpdateContentLength() {
+    Headers_.Update({EHeader::ContentLength, std::to_string(Data_.size())});
 }
 
-class TUntilParser {
-public:
-    TUntilParser(const std::string& delimiter)
-        : Delimiter_(delimiter)
-    {}
-
-    EParseResult Consume(char c) {
-        Parsed_.push_back(c);
-        if (EndsWith(Parsed_, Delimiter_)) {
-            Parsed_.erase(Parsed_.end() - Delimiter_.size(), Parsed_.end());
-            return EParseResult::Parsed;
-        }
-        return EParseResult::Await;
-    }
-
-    void Reset() {
-        Parsed_.clear();
-    }
+std::string THttpResponse::Serialize() const {
+    TBuffers buffers;
+    Serialize(buffers);
+    return Join(buffers);
+}
 
-    const std::string& Parsed() const {
-        return Parsed_;
+void THttpResponse::Serialize(TBuffers& buffers) const {
+    StatusLine_.Serialize(buffers);
+    Headers_.Serialize(buffers);
+    buffers.push_back(Buffer(LineBreak));
+    if (!Data_.empty()) {
+        buffers.push_back(Buffer(Data_));
     }
+}
 
-private:
-    std::string Delimiter_;
-    std::string Parsed_;
-};
-
-class TNParser {
-public:
-    struct TParseResult {
-        EParseResult Result;
-        std::optional<std::string> Parsed_;
-    };
+bool IsInterim(const THttpResponse& head) {
+    std::string_view code = head.ResponseStatusLine().StatusCode();
+    return code.size() == 3 && code.front() == '1' && code != "101";
+}
 
-    TNParser() {}
+namespace {
 
-    void SetN(int n) {
-        N_ = n;
-        Parsed_.clear();
-        Parsed_.reserve(N_);
+std::string_view Trim(std::string_view sv) {
+    while (!sv.empty() && (sv.front() == ' ' || sv.front() == '\t')) {
+        sv.remove_prefix(1);
     }
-
-    EParseResult Consume(char c) {
-        Parsed_.push_back(c);
-        N_--;
-        if (N_ == 0) {
-            return EParseResult::Parsed;
-        }
-        return EParseResult::Await;
+    while (!sv.empty() && (sv.back() == ' ' || sv.back() == '\t')) {
+        sv.remove_suffix(1);
     }
+    return sv;
+}
 
-    const std::string& Parsed() const {
-        return Parsed_;
+// Splits the start line into three tokens. The last one may contain spaces
+// (it is the reason phrase of a response status line)
+std::array<std::string_view, 3> SplitStartLine(std::string_view line) {
+    std::array<std::string_view, 3> ret;
+    for (std::size_t i = 0; i < 2; i++) {
+        auto space = line.find(' ');
+        ret[i] = line.substr(0, space);
+        line = space == std::string_view::npos ? std::string_view() : line.substr(space + 1);
     }
+    ret[2] = line;
+    return ret;
+}
 
-private:
-    int N_;
-    std::string Parsed_;
-};
-
-class THttpRequestLineParser {
+// Accumulates the start line and the header fields up to the empty line
+// into a single buffer. Lines are located with memchr over whole blocks,
+// and the parsed tokens are views into that buffer. A head longer than
+// MaxHeadSize is an error.
+class THttpHeadParser {
 public:
-    THttpRequestLineParser()
-        : MethodParser_(" ")
-        , URLParser_(" ")
-        , HttpVersionParser_("\r\n")
-        , State_(EState::METHOD)
-    {}
+    using TField = std::pair<std::string_view, std::string_view>;
+
+    EParseResult Consume(std::string_view& data) {
+        while (!data.empty()) {
+            const char* lf = static_cast<const char*>(std::memchr(data.data(), '\n', data.size()));
+            std::size_t size = lf == nullptr ? data.size() : lf - data.data() + 1;
+            if (Buffer_.size() + size > MaxHeadSize) {
+                return EParseResult::Error;
+            }
+            if (lf == nullptr) {
+                Buffer_.append(data);
+                data.remove_prefix(data.size());
+                return EParseResult::Await;
+            }
+            Buffer_.append(data.data(), size);
+            data.remove_prefix(size);
 
-    EParseResult Consume(char c) {
-        if (State_ == EState::METHOD) {
-            if (MethodParser_.Consume(c) == EParseResult::Parsed) {
-                State_ = EState::URL;
+            std::size_t length = Buffer_.size() - LineStart_ - 1;
+            if (length > 0 && Buffer_[LineStart_ + length - 1] == '\r') {
+                length--;
             }
-        } else if (State_ == EState::URL) {
-            if (URLParser_.Consume(c) == EParseResult::Parsed) {
-                State_ = EState::HTTP_VERSION;
+            if (length == 0 && Lines_.empty()) {
+                // Stray line breaks before the start line are ignored
+                Buffer_.clear();
+                continue;
             }
-        } else {
-            if (HttpVersionParser_.Consume(c) == EParseResult::Parsed) {
+            if (length == 0) {
+                Finish();
                 return EParseResult::Parsed;
             }
+            Lines_.emplace_back(LineStart_, length);
+            LineStart_ = Buffer_.size();
         }
         return EParseResult::Await;
     }
 
-    THttpRequestLine Parsed() const {
-        return THttpRequestLine(
-            MethodParser_.Parsed(),
-            URLParser_.Parsed(),
-            HttpVersionParser_.Parsed()
-        );
+    // Valid only after the head is parsed
+    const std::array<std::string_view, 3>& StartLine() const {
+        return StartLine_;
     }
 
-private:
-    TUntilParser MethodParser_;
-    TUntilParser URLParser_;
-    TUntilParser HttpVersionParser_;
-
-    enum class EState {
-        METHOD,
-        URL,
-        HTTP_VERSION
-    };
-
-    EState State_;
-};
-
-class THttpResponseStatusLineParser {
-public:
-    THttpResponseStatusLineParser()
-        : HttpVersionParser_(" ")
-        , StatusCodeParser_(" ")
-        , ReasonParser_("\r\n")
-        , State_(EState::HTTP_VERSION)
-    {}
+    // Valid only after the head is parsed
+    const std::vector<TField>& Fields() const {
+        return Fields_;
+    }
 
-    EParseResult Consume(char c) {
-        if (State_ == EState::HTTP_VERSION) {
-            if (HttpVersionParser_.Consume(c) == EParseResult::Parsed) {
-                State_ = EState::STATUS_CODE;
-            }
-        } else if (State_ == EState::STATUS_CODE) {
-            if (StatusCodeParser_.Consume(c) == EParseResult::Parsed) {
-                State_ = EState::REASON;
-            }
-        } else {
-            if (ReasonParser_.Consume(c) == EParseResult::Parsed) {
-                return EParseResult::Parsed;
-            }
+    THttpHeaders Headers(std::pmr::memory_resource* resource) const {
+        THttpHeaders headers(resource);
+        for (const auto& [key, value] : Fields_) {
+            headers.Append(key, value);
         }
-        return EParseResult::Await;
+        return headers;
     }
 
-    THttpResponseStatusLine Parsed() const {
-        return THttpResponseStatusLine(
-            HttpVersionParser_.Parsed(),
-            StatusCodeParser_.Parsed(),
-            ReasonParser_.Parsed()
-        );
+    void Reset() {
+        Buffer_.clear();
+        LineStart_ = 0;
+        Lines_.clear();
+        StartLine_ = {};
+        Fields_.clear();
     }
 
 private:
-    TUntilParser HttpVersionParser_;
-    TUntilParser StatusCodeParser_;
-    TUntilParser ReasonParser_;
+    void Finish() {
+        std::string_view buffer(Buffer_);
+        StartLine_ = SplitStartLine(buffer.substr(Lines_[0].first, Lines_[0].second));
+        Fields_.reserve(Lines_.size() - 1);
+        for (std::size_t i = 1; i < Lines_.size(); i++) {
+            auto line = buffer.substr(Lines_[i].first, Lines_[i].second);
+            auto colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            Fields_.emplace_back(Trim(line.substr(0, colon)), Trim(line.substr(colon + 1)));
+        }
+    }
 
-    enum class EState {
-        HTTP_VERSION,
-        STATUS_CODE,
-        REASON
-    };
+    std::string Buffer_;
+    std::size_t LineStart_ = 0;
+    std::vector<std::pair<std::size_t, std::size_t>> Lines_;
 
-    EState State_;
+    std::array<std::string_view, 3> StartLine_;
+    std::vector<TField> Fields_;
 };
 
-THttpHeader ParseHeader(const std::string& header) {
-    TUntilParser key(": ");
-    auto it = header.begin();
-    auto status = EParseResult::Await;
-    while (it != header.end() && status == EParseResult::Await) {
-        status = key.Consume(*(it++));
-    }
-    return THttpHeader(
-        key.Parsed(),
-        std::string(it, header.end())
-    );
+bool IsHttpVersion(std::string_view token) {
+    return token.size() == 8 && token.substr(0, 5) == "HTTP/";
 }
 
-class THttpHeadersParser {
+// Method, target and version
+bool IsRequestLine(const std::array<std::string_view, 3>& line) {
+    return !line[0].empty() && !line[1].empty() && IsHttpVersion(line[2]);
+}
+
+// Version, three-digit status code and a reason phrase, maybe empty
+bool IsStatusLine(const std::array<std::string_view, 3>& line) {
+    return IsHttpVersion(line[0]) && line[1].size() == 3
+        && std::all_of(line[1].begin(), line[1].end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+// Passes exactly N bytes to the sink
+class TNParser {
 public:
-    THttpHeadersParser()
-        : LineParser_("\r\n")
-    {}
 
-    EParseResult Consume(char c) {
-        if (LineParser_.Consume(c) == EParseResult::Parsed) {
-            if (LineParser_.Parsed().empty()) {
-                return EParseResult::Parsed;
-            }
-            Parsed_.emplace_back(ParseHeader(LineParser_.Parsed()));
-            LineParser_ = TUntilParser("\r\n");
-        }
-        return EParseResult::Await;
+    void SetN(std::size_t n) {
+        N_ = n;
     }
 
-    THttpHeaders Parsed() const {
-        return THttpHeaders(Parsed_);
+    template<typename TSink>
+    EParseResult Consume(std::string_view& data, TSink&& sink) {
+        std::size_t size = std::min(N_, data.size());
+        sink(data.substr(0, size));
+        data.remove_prefix(size);
+        N_ -= size;
+        if (N_ == 0) {
+            return EParseResult::Parsed;
+        }
+        return EParseResult::Await;
     }
 
 private:
-    TUntilParser LineParser_;
-    std::vector<THttpHeader> Parsed_;
+    std::size_t N_ = 0;
 };
 
-int DataLength(THttpHeaders headers) {
-    int dataLength = 0;
-    for (std::size_t i = 0; i != headers.Size(); i++) {
-        const auto& header = headers[i];
-        if (header.Key() == "Content-Length") {
-            auto [_, e] = std::from_chars(
-                header.Value().c_str(),
-                header.Value().c_str() + header.Value().length(),
-                dataLength
-            );
-            if (e != std::errc()) {
-                dataLength = 0;
-            }
+std::optional<std::size_t> DataLength(const std::vector<THttpHeadParser::TField>& fields) {
+    std::optional<std::size_t> ret;
+    for (const auto& [key, value] : fields) {
+        if (EqualsIgnoreCase(key, HeaderName(EHeader::ContentLength))) {
+            std::size_t dataLength = 0;
+            auto [_, e] = std::from_chars(value.data(), value.data() + value.size(), dataLength);
+            ret = e == std::errc() ? dataLength : 0;
+        }
+    }
+    return ret;
+}
+
+// Responses to HEAD and 1xx, 204 and 304 responses never have a body
+bool HasBody(std::string_view requestMethod, std::string_view statusCode) {
+    if (requestMethod == "HEAD") {
+        return false;
+    }
+    return !(statusCode.substr(0, 1) == "1" || statusCode == "204" || statusCode == "304");
+}
+
+bool IsChunked(const std::vector<THttpHeadParser::TField>& fields) {
+    for (const auto& [key, value] : fields) {
+        if (EqualsIgnoreCase(key, HeaderName(EHeader::TransferEncoding)) && value.find("chunked") != std::string_view::npos) {
+            return true;
         }
     }
-    return dataLength;
+    return false;
 }
 
 }
 
 class THttpRequestParser::TImpl {
 public:
-    TImpl()
-        : State_(EState::REQUEST_LINE)
+    TImpl(std::pmr::memory_resource* resource)
+        : Resource_(resource)
+        , State_(EState::HEAD)
     {}
 
-    EParseResult Consume(char c) {
-        if (State_ == EState::REQUEST_LINE) {
-            if (RequestLineParser_.Consume(c) == EParseResult::Parsed) {
-                State_ = EState::HEADERS;
+    EParseResult Consume(std::string_view& data) {
+        if (State_ == EState::HEAD) {
+            EParseResult head = HeadParser_.Consume(data);
+            if (head != EParseResult::Parsed) {
+                return head;
+            }
+            if (!IsRequestLine(HeadParser_.StartLine())) {
+                return EParseResult::Error;
             }
-        } else if (State_ == EState::HEADERS) {
-            if (HeadersParser_.Consume(c) == EParseResult::Parsed) {
-                int dataLength = DataLength(HeadersParser_.Parsed());
-                if (dataLength == 0) {
-                    return EParseResult::Parsed;
-                }
+            // Transfer-Encoding overrides Content-Length
+            Chunked_ = IsChunked(HeadParser_.Fields());
+            std::size_t dataLength = DataLength(HeadParser_.Fields()).value_or(0);
+            if (Chunked_) {
+                State_ = EState::CHUNKED_DATA;
+            } else if (dataLength > 0) {
                 State_ = EState::DATA;
                 DataParser_.SetN(dataLength);
-            }
-        } else {
-            if (DataParser_.Consume(c) == EParseResult::Parsed) {
+            } else {
+                State_ = EState::DONE;
                 return EParseResult::Parsed;
             }
+            return EParseResult::Head;
         }
-        return EParseResult::Await;
+        auto sink = [this](std::string_view piece) {
+            if (BodyCallback_) {
+                BodyCallback_(piece);
+            } else {
+                Data_.append(piece);
+            }
+        };
+        if (State_ == EState::DATA) {
+            if (DataParser_.Consume(data, sink) == EParseResult::Await) {
+                return EParseResult::Await;
+            }
+            State_ = EState::DONE;
+        } else if (State_ == EState::CHUNKED_DATA) {
+            EParseResult status = ChunkedDecoder_.Consume(data, sink);
+            if (status != EParseResult::Parsed) {
+                return status;
+            }
+            State_ = EState::DONE;
+        }
+        return EParseResult::Parsed;
     }
 
-    THttpRequest Parsed() const {
-        return THttpRequest(
-            RequestLineParser_.Parsed(),
-            HeadersParser_.Parsed(),
-            DataParser_.Parsed()
+    void StreamBody(TBodyCallback callback) {
+        BodyCallback_ = std::move(callback);
+        ChunkedDecoder_ = TChunkedDecoder(EChunkedMode::Verbatim);
+    }
+
+    THttpRequest TakeParsed() {
+        const auto& startLine = HeadParser_.StartLine();
+        auto ret = THttpRequest(
+            THttpRequestLine(startLine[0], startLine[1], startLine[2], Resource_),
+            HeadParser_.Headers(Resource_),
+            std::move(Data_)
         );
+        if (Chunked_ && !BodyCallback_ && State_ == EState::DONE) {
+            ret.UpdateContentLength();
+            ret.Headers().Remove(EHeader::TransferEncoding);
+        }
+        return ret;
+    }
+
+    void Reset() {
+        HeadParser_.Reset();
+        DataParser_ = {};
+        Chunked_ = false;
+        ChunkedDecoder_ = TChunkedDecoder();
+        BodyCallback_ = nullptr;
+        // A body may be large; the head buffers are kept
+        std::string().swap(Data_);
+        State_ = EState::HEAD;
     }
 
 private:
-    THttpRequestLineParser RequestLineParser_;
-    THttpHeadersParser HeadersParser_;
+    std::pmr::memory_resource* Resource_;
+    THttpHeadParser HeadParser_;
     TNParser DataParser_;
 
+    bool Chunked_ = false;
+    TChunkedDecoder ChunkedDecoder_;
+
+    TBodyCallback BodyCallback_;
+    std::string Data_;
+
     enum class EState {
-        REQUEST_LINE,
-        HEADERS,
-        DATA
+        HEAD,
+        DATA,
+        CHUNKED_DATA,
+        DONE
     };
 
     EState State_;
 };
 
-THttpRequestParser::THttpRequestParser()
-    : Impl_(new TImpl())
+THttpRequestParser::THttpRequestParser(std::pmr::memory_resource* resource)
+    : Impl_(new TImpl(resource))
 {}
 
 THttpRequestParser::~THttpRequestParser() = default;
 
 void THttpRequestParser::Reset() {
-    Impl_.reset(new TImpl());
-}
-
-EParseResult THttpRequestParser::Consume(char c) {
-    return Impl_->Consume(c);
+    Impl_->Reset();
 }
 
-THttpRequest THttpRequestParser::Parsed() const {
-    return Impl_->Parsed();
+EParseResult THttpRequestParser::Consume(std::string_view& data) {
+    return Impl_->Consume(data);
 }
 
-namespace {
-
-bool IsChunked(const THttpHeaders& headers) {
-    auto mbHeader = headers.Find("Transfer-Encoding");
-    if (!mbHeader.has_value()) {
-        return false;
-    }
-    auto directives = mbHeader.value().SplitValue();
-    return std::find(directives.begin(), directives.end(), "chunked") != directives.end();
+void THttpRequestParser::StreamBody(TBodyCallback callback) {
+    Impl_->StreamBody(std::move(callback));
 }
 
+THttpRequest THttpRequestParser::TakeParsed() {
+    return Impl_->TakeParsed();
 }
 
 class THttpResponseParser::TImpl {
 public:
-    TImpl()
-        : ChunkLengthParser_("\r\n")
-        , State_(EState::RESPONSE_LINE)
+    TImpl(std::pmr::memory_resource* resource)
+        : Resource_(resource)
+        , State_(EState::HEAD)
     {}
 
-    EParseResult Consume(char c) {
-        if (State_ == EState::RESPONSE_LINE) {
-            if (ResponseStatusLineParser_.Consume(c) == EParseResult::Parsed) {
-                State_ = EState::HEADERS;
+    EParseResult Consume(std::string_view& data) {
+        if (State_ == EState::HEAD) {
+            EParseResult head = HeadParser_.Consume(data);
+            if (head != EParseResult::Parsed) {
+                return head;
             }
-        } else if (State_ == EState::HEADERS) {
-            if (HeadersParser_.Consume(c) == EParseResult::Parsed) {
-                int dataLength = DataLength(HeadersParser_.Parsed());
-                bool isChunked = IsChunked(HeadersParser_.Parsed());
-                if (dataLength == 0 && !isChunked) {
-                    return EParseResult::Parsed;
-                }
-                if (!isChunked) {
-                    State_ = EState::DATA;
-                    DataParser_.SetN(dataLength);
-                } else {
-                    State_ = EState::CHUNK_LENGTH;
-                    Chunked_ = true;
-                }
+            if (!IsStatusLine(HeadParser_.StartLine())) {
+                return EParseResult::Error;
             }
-        } else if (State_ == EState::DATA) {
-            if (DataParser_.Consume(c) == EParseResult::Parsed) {
+            auto dataLength = DataLength(HeadParser_.Fields());
+            Chunked_ = IsChunked(HeadParser_.Fields());
+            if (!HasBody(RequestMethod_, HeadParser_.StartLine()[1])) {
+                State_ = EState::DONE;
+                return EParseResult::Parsed;
+            } else if (Chunked_) {
+                State_ = EState::CHUNKED_DATA;
+            } else if (!dataLength.has_value()) {
+                State_ = EState::UNTIL_CLOSE;
+                CloseDelimited_ = true;
+            } else if (dataLength.value() > 0) {
+                State_ = EState::DATA;
+                DataParser_.SetN(dataLength.value());
+            } else {
+                State_ = EState::DONE;
                 return EParseResult::Parsed;
             }
-        } else if (State_ == EState::CHUNK_LENGTH) {
-            if (ChunkLengthParser_.Consume(c) == EParseResult::Parsed) {
-                const std::string& lengthStr = ChunkLengthParser_.Parsed();
-                int length;
-                std::from_chars(
-                    lengthStr.c_str(),
-                    lengthStr.c_str() + lengthStr.size(),
-                    length,
-                    16
-                );
-                if (length == 0) {
-                    return EParseResult::Parsed;
-                }
-                State_ = EState::CHUNK_DATA;
-                ChunkParser_.SetN(length + 2);
-                ChunkLengthParser_.Reset();
+            return EParseResult::Head;
+        }
+        auto sink = [this](std::string_view piece) {
+            if (BodyCallback_) {
+                BodyCallback_(piece);
+            } else {
+                Data_.append(piece);
             }
-        } else {
-            if (ChunkParser_.Consume(c) == EParseResult::Parsed) {
-                State_ = EState::CHUNK_LENGTH;
-                ChunkedData_ += ChunkParser_.Parsed();
+        };
+        if (State_ == EState::DATA) {
+            if (DataParser_.Consume(data, sink) == EParseResult::Await) {
+                return EParseResult::Await;
             }
+            State_ = EState::DONE;
+        } else if (State_ == EState::CHUNKED_DATA) {
+            EParseResult status = ChunkedDecoder_.Consume(data, sink);
+            if (status != EParseResult::Parsed) {
+                return status;
+            }
+            State_ = EState::DONE;
+        } else if (State_ == EState::UNTIL_CLOSE) {
+            sink(data);
+            data.remove_prefix(data.size());
+            return EParseResult::Await;
         }
-        return EParseResult::Await;
+        return EParseResult::Parsed;
+    }
+
+    EParseResult Finish() {
+        if (State_ == EState::UNTIL_CLOSE) {
+            State_ = EState::DONE;
+        }
+        return State_ == EState::DONE ? EParseResult::Parsed : EParseResult::Await;
+    }
+
+    bool CloseDelimited() const {
+        return CloseDelimited_;
+    }
+
+    bool Chunked() const {
+        return Chunked_;
+    }
+
+    void SetRequestMethod(std::string_view method) {
+        RequestMethod_ = method;
     }
 
-    THttpResponse Parsed() const {
+    void StreamBody(TBodyCallback callback) {
+        BodyCallback_ = std::move(callback);
+    }
+
+    THttpResponse Head() const {
+        const auto& startLine = HeadParser_.StartLine();
+        return THttpResponse(
+            THttpResponseStatusLine(startLine[0], startLine[1], startLine[2], Resource_),
+            HeadParser_.Headers(Resource_),
+            ""
+        );
+    }
+
+    THttpResponse TakeParsed() {
+        const auto& startLine = HeadParser_.StartLine();
         auto ret = THttpResponse(
-            ResponseStatusLineParser_.Parsed(),
-            HeadersParser_.Parsed(),
-            Chunked_ ? ChunkedData_ : DataParser_.Parsed()
+            THttpResponseStatusLine(startLine[0], startLine[1], startLine[2], Resource_),
+            HeadParser_.Headers(Resource_),
+            std::move(Data_)
         );
-        if (Chunked_) {
+        if (Chunked_ || CloseDelimited_) {
             ret.UpdateContentLength();
-            ret.Headers().Remove("Transfer-Encoding");
+            ret.Headers().Remove(EHeader::TransferEncoding);
         }
         return ret;
     }
 
+    void Reset() {
+        RequestMethod_.clear();
+        HeadParser_.Reset();
+        DataParser_ = {};
+        Chunked_ = false;
+        ChunkedDecoder_.Reset();
+        CloseDelimited_ = false;
+        BodyCallback_ = nullptr;
+        std::string().swap(Data_);
+        State_ = EState::HEAD;
+    }
+
 private:
-    THttpResponseStatusLineParser ResponseStatusLineParser_;
-    THttpHeadersParser HeadersParser_;
+    std::pmr::memory_resource* Resource_;
+    std::string RequestMethod_;
+    THttpHeadParser HeadParser_;
     TNParser DataParser_;
 
     bool Chunked_ = false;
-    TUntilParser ChunkLengthParser_;
-    TNParser ChunkParser_;
-    std::string ChunkedData_;
+    TChunkedDecoder ChunkedDecoder_;
+    bool CloseDelimited_ = false;
+
+    TBodyCallback BodyCallback_;
+    std::string Data_;
 
     enum class EState {
-        RESPONSE_LINE,
-        HEADERS,
+        HEAD,
         DATA,
-        CHUNK_LENGTH,
-        CHUNK_DATA
+        CHUNKED_DATA,
+        UNTIL_CLOSE,
+        DONE
     };
 
     EState State_;
 };
 
-THttpResponseParser::THttpResponseParser()
-    : Impl_(new TImpl())
+THttpResponseParser::THttpResponseParser(std::pmr::memory_resource* resource)
+    : Impl_(new TImpl(resource))
 {}
 
 THttpResponseParser::~THttpResponseParser() = default;
 
 void THttpResponseParser::Reset() {
-    Impl_.reset(new TImpl());
+    Impl_->Reset();
+}
+
+void THttpResponseParser::SetRequestMethod(std::string_view method) {
+    Impl_->SetRequestMethod(method);
+}
+
+EParseResult THttpResponseParser::Consume(std::string_view& data) {
+    return Impl_->Consume(data);
+}
+
+EParseResult THttpResponseParser::Finish() {
+    return Impl_->Finish();
+}
+
+bool THttpResponseParser::CloseDelimited() const {
+    return Impl_->CloseDelimited();
+}
+
+bool THttpResponseParser::Chunked() const {
+    return Impl_->Chunked();
+}
+
+void THttpResponseParser::StreamBody(TBodyCallback callback) {
+    Impl_->StreamBody(std::move(callback));
 }
 
-EParseResult THttpResponseParser::Consume(char c) {
-    return Impl_->Consume(c);
+THttpResponse THttpResponseParser::Head() const {
+    return Impl_->Head();
 }
 
-THttpResponse THttpResponseParser::Parsed() const {
-    return Impl_->Parsed();
+THttpResponse THttpResponseParser::TakeParsed() {
+    return Impl_->TakeParsed();
 }
 
 }
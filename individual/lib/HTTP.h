@@ -1,102 +1,221 @@
 #pragma once
 
-#include <map>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include <boost/asio/buffer.hpp>
+#include <boost/container/small_vector.hpp>
+
 namespace NHttpProxy {
 
+// Buffers referencing the storage of a message, to be written without
+// joining the pieces. They are valid while the message is alive and
+// unchanged.
+using TBuffers = std::vector<boost::asio::const_buffer>;
+
+// The start lines and headers of messages are allocated from a memory
+// resource, normally the arena of the session that parses them. A copy
+// always lives on the default resource, so that whatever outlives the
+// exchange (the cache, a shared fetch) is made by copying; a move keeps the
+// resource.
+
 class THttpRequestLine {
 public:
     THttpRequestLine(
-        const std::string& method,
-        const std::string& url,
-        const std::string& httpVersion
+        std::string_view method,
+        std::string_view url,
+        std::string_view httpVersion,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
     );
 
-    const std::string& Method() const;
-    const std::string& URL() const;
-    const std::string& HttpVersion() const;
+    std::string_view Method() const;
+    std::string_view URL() const;
+    std::string_view HttpVersion() const;
 
+    // Without the line break
     std::string Serialize() const;
+    // With the line break
+    void Serialize(TBuffers& buffers) const;
 
 private:
-    std::string Method_;
-    std::string URL_;
-    std::string HttpVersion_;
+    // The whole line, sent as it is, and the positions of its spaces
+    std::pmr::string Line_;
+    std::uint32_t First_;
+    std::uint32_t Second_;
 };
 
 class THttpResponseStatusLine {
 public:
     THttpResponseStatusLine(
-        const std::string& httpVersion,
-        const std::string& statusCode,
-        const std::string& reason
+        std::string_view httpVersion,
+        std::string_view statusCode,
+        std::string_view reason,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
     );
 
-    const std::string& HttpVersion() const;
-    const std::string& StatusCode() const;
-    const std::string& Reason() const;
+    std::string_view HttpVersion() const;
+    std::string_view StatusCode() const;
+    std::string_view Reason() const;
 
+    // Without the line break
     std::string Serialize() const;
+    // With the line break
+    void Serialize(TBuffers& buffers) const;
 
 private:
-    std::string HttpVersion_;
-    std::string StatusCode_;
-    std::string Reason_;
+    // The whole line, sent as it is, and the positions of its spaces
+    std::pmr::string Line_;
+    std::uint32_t First_;
+    std::uint32_t Second_;
 };
 
+// Header names the proxy looks at, recognized once, when a header is made,
+// so that looking them up compares numbers rather than strings
+enum class EHeader : std::uint8_t {
+    Unknown,
+    Accept,
+    AcceptEncoding,
+    AcceptLanguage,
+    Age,
+    Authorization,
+    CacheControl,
+    Connection,
+    ContentEncoding,
+    ContentLength,
+    ContentType,
+    Date,
+    ETag,
+    Expect,
+    Expires,
+    Host,
+    IfModifiedSince,
+    IfNoneMatch,
+    KeepAlive,
+    LastModified,
+    Pragma,
+    ProxyConnection,
+    TransferEncoding,
+    Upgrade,
+    UserAgent,
+    Vary,
+    Count
+};
+
+// Returns the well-known header of the name, whatever its case
+EHeader HeaderId(std::string_view name);
+
+// Returns the canonical spelling of a well-known header name
+std::string_view HeaderName(EHeader id);
+
 class THttpHeader {
 public:
     THttpHeader(
-        const std::string& key,
-        const std::string& value
+        std::string_view key,
+        std::string_view value,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
     );
+    THttpHeader(
+        EHeader id,
+        std::string_view value,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+    );
+    THttpHeader(const THttpHeader& other, std::pmr::memory_resource* resource);
+
+    std::string_view Key() const;
+    std::string_view Value() const;
+    EHeader Id() const;
 
-    const std::string& Key() const;
-    const std::string& Value() const;
+    // Whether the header has the name, whatever its case
+    bool Is(std::string_view name) const;
+    bool Is(EHeader id) const;
 
     std::vector<std::string_view> SplitValue() const;
 
     std::string Serialize() const;
 
 private:
-    std::string Key_;
-    std::string Value_;
+    friend class THttpHeaders;
+
+    void SetValue(std::string_view value);
+
+    // The whole field line, "Key: Value\r\n", sent as it is
+    std::pmr::string Line_;
+    std::uint32_t KeySize_;
+    // Case-insensitive hash of the name, compared before the name itself
+    std::uint32_t Hash_;
+    EHeader Id_;
 };
 
+// Header fields in the order they came in. Names are looked up ignoring
+// their case; a typical message has few enough fields to keep them inline
+// and scan them.
 class THttpHeaders {
 public:
+    THttpHeaders();
+    explicit THttpHeaders(std::pmr::memory_resource* resource);
     THttpHeaders(const std::vector<THttpHeader>& headers);
 
+    THttpHeaders(const THttpHeaders& other);
+    THttpHeaders(const THttpHeaders& other, std::pmr::memory_resource* resource);
+    THttpHeaders(THttpHeaders&& other) = default;
+    THttpHeaders& operator=(const THttpHeaders& other);
+    THttpHeaders& operator=(THttpHeaders&& other) = default;
+
     std::size_t Size() const;
 
     const THttpHeader& operator[](std::size_t i) const;
-    const std::string& operator[](const std::string& key) const;
+    // The value of the first header of the name, empty if there is none
+    std::string_view operator[](std::string_view name) const;
 
     void Append(const THttpHeader& header);
+    void Append(std::string_view key, std::string_view value);
+    void Append(EHeader id, std::string_view value);
 
     std::string Serialize() const;
+    void Serialize(TBuffers& buffers) const;
 
-    std::optional<THttpHeader> Find(const std::string& name) const;
+    // The first header of the name or nullptr
+    const THttpHeader* Find(std::string_view name) const;
+    const THttpHeader* Find(EHeader id) const;
 
+    // Replaces the value of every header of the name or appends one
     void Update(const THttpHeader& header);
 
-    void Remove(const std::string& key);
+    void Remove(std::string_view name);
+    void Remove(EHeader id);
 
 private:
-    std::vector<THttpHeader> Headers_;
-    mutable std::map<std::string, std::string> Values_;
+    // Where the appended headers are allocated
+    std::pmr::memory_resource* Resource_;
+    boost::container::small_vector<THttpHeader, 12> Headers_;
 };
 
+// Hop-by-hop headers describe a single connection and are never forwarded
+void RemoveHopByHopHeaders(THttpHeaders& headers);
+
+// Returns host and service (port or scheme) to connect to for the URL
+std::pair<std::string, std::string> SplitURL(std::string_view url);
+
+// Whether the connection stays open after a message with the given version
+// and headers
+bool KeepsConnection(std::string_view httpVersion, const THttpHeaders& headers);
+
 class THttpRequest {
 public:
     THttpRequest(
-        const THttpRequestLine& requestLine,
-        const THttpHeaders& headers,
-        const std::string& data
+        THttpRequestLine requestLine,
+        THttpHeaders headers,
+        std::string data
     );
+    // A copy on the given resource rather than the default one
+    THttpRequest(const THttpRequest& other, std::pmr::memory_resource* resource);
 
     const THttpRequestLine& RequestLine() const;
     const THttpHeaders& Headers() const;
@@ -104,6 +223,10 @@ public:
     const std::string& Data() const;
 
     std::string Serialize() const;
+    // Appends the buffers of the whole message
+    void Serialize(TBuffers& buffers) const;
+
+    void UpdateContentLength();
 
 private:
     THttpRequestLine RequestLine_;
@@ -113,19 +236,38 @@ private:
 
 enum class EParseResult {
     Await,
-    Parsed
+    // The head of a message with a body is parsed
+    Head,
+    Parsed,
+    // The start line is malformed, the head is too long or the framing of
+    // the body is broken; nothing more is consumed
+    Error
 };
 
+using TBodyCallback = std::function<void(std::string_view)>;
+
 class THttpRequestParser {
 public:
-    THttpRequestParser();
+    // The parsed messages are allocated from the resource
+    explicit THttpRequestParser(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
     ~THttpRequestParser();
 
+    // Gets ready for the next message, keeping the buffers
     void Reset();
 
-    EParseResult Consume(char c);
+    // Consumes the prefix of data that belongs to the message.
+    // Once the message is parsed, the rest of data is left untouched.
+    // Returns Head once the head of a request with a body is parsed.
+    EParseResult Consume(std::string_view& data);
+
+    // Passes the body to the callback as it is, chunked framing included,
+    // instead of keeping it
+    void StreamBody(TBodyCallback callback);
 
-    THttpRequest Parsed() const;
+    // Builds the parsed message, handing the body over to it. Called once
+    // per message, before Reset(): once it is parsed, or once its head is
+    // if the body is streamed.
+    THttpRequest TakeParsed();
 
 private:
     class TImpl;
@@ -135,17 +277,20 @@ private:
 class THttpResponse {
 public:
     THttpResponse(
-        const THttpResponseStatusLine& responseStatusLine,
-        const THttpHeaders& headers,
-        const std::string& data
+        THttpResponseStatusLine responseStatusLine,
+        THttpHeaders headers,
+        std::string data
     );
 
     const THttpResponseStatusLine& ResponseStatusLine() const;
     const THttpHeaders& Headers() const;
     THttpHeaders& Headers();
     const std::string& Data() const;
+    std::string TakeData() &&;
 
     std::string Serialize() const;
+    // Appends the buffers of the whole message
+    void Serialize(TBuffers& buffers) const;
 
     void UpdateContentLength();
 
@@ -155,16 +300,44 @@ private:
     std::string Data_;
 };
 
+// Interim responses precede the final one and are not forwarded. Switching
+// protocols is not supported, so 101 is taken as a final one.
+bool IsInterim(const THttpResponse& head);
+
 class THttpResponseParser {
 public:
-    THttpResponseParser();
+    // The parsed messages are allocated from the resource
+    explicit THttpResponseParser(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
     ~THttpResponseParser();
 
+    // Gets ready for the next message, keeping the buffers
     void Reset();
 
-    EParseResult Consume(char c);
+    // Responses to HEAD requests have no body regardless of their headers
+    void SetRequestMethod(std::string_view method);
+
+    // Consumes the prefix of data that belongs to the message.
+    // Once the message is parsed, the rest of data is left untouched.
+    EParseResult Consume(std::string_view& data);
+
+    // Signals that the connection is closed. Completes a body delimited by
+    // the end of the connection; otherwise the response is truncated.
+    EParseResult Finish();
+
+    // Whether the body lasts until the connection is closed
+    bool CloseDelimited() const;
+    // Whether the body comes in chunks
+    bool Chunked() const;
+
+    // Passes the decoded body to the callback instead of keeping it
+    void StreamBody(TBodyCallback callback);
+
+    // Status line and headers as received, available once the head is parsed
+    THttpResponse Head() const;
 
-    THttpResponse Parsed() const;
+    // Builds the parsed message, handing the body over to it. Called once
+    // per message, before Reset().
+    THttpResponse TakeParsed();
 
 private:
     class TImpl;
@@ -0,0 +1,80 @@
+#include <Histogram.h>
+
+#include <sstream>
+
+namespace NHttpProxy {
+
+THistogram::THistogram()
+    : Count_(0)
+    , Sum_(0)
+{
+    for (auto& count : Counts_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+std::size_t THistogram::Bucket(std::uint64_t value) {
+    if (value < SubBuckets) {
+        return value;
+    }
+    std::size_t power = 63 - __builtin_clzll(value);
+    std::size_t sub = (value >> (power - 2)) & (SubBuckets - 1);
+    return (power - 1) * SubBuckets + sub;
+}
+
+std::uint64_t THistogram::UpperBound(std::size_t bucket) {
+    if (bucket < SubBuckets) {
+        return bucket;
+    }
+    std::size_t power = bucket / SubBuckets + 1;
+    std::uint64_t sub = bucket % SubBuckets;
+    return ((SubBuckets + sub + 1) << (power - 2)) - 1;
+}
+
+void THistogram::Record(TDuration duration) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    Counts_[Bucket(us > 0 ? us : 0)].fetch_add(1, std::memory_order_relaxed);
+    Count_.fetch_add(1, std::memory_order_relaxed);
+    Sum_.fetch_add(us > 0 ? us : 0, std::memory_order_relaxed);
+}
+
+std::uint64_t THistogram::Count() const {
+    return Count_.load(std::memory_order_relaxed);
+}
+
+std::chrono::microseconds THistogram::Percentile(double q) const {
+    std::uint64_t count = Count();
+    if (count == 0) {
+        return std::chrono::microseconds(0);
+    }
+    std::uint64_t rank = static_cast<std::uint64_t>(q * (count - 1)) + 1;
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < Buckets; i++) {
+        seen += Counts_[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::chrono::microseconds(UpperBound(i));
+        }
+    }
+    return std::chrono::microseconds(UpperBound(Buckets - 1));
+}
+
+std::string THistogram::Summary() const {
+    std::ostringstream out;
+    out << "count=" << Count()
+        << " p50=" << Percentile(0.5).count() << "us"
+        << " p90=" << Percentile(0.9).count() << "us"
+        << " p99=" << Percentile(0.99).count() << "us"
+        << " max=" << Percentile(1).count() << "us";
+    return out.str();
+}
+
+THistogram::TSnapshot THistogram::Snapshot() const {
+    TSnapshot snapshot;
+    for (std::size_t i = 0; i < Buckets; i++) {
+        snapshot.Counts[i] = Counts_[i].load(std::memory_order_relaxed);
+    }
+    snapshot.Sum = std::chrono::microseconds(Sum_.load(std::memory_order_relaxed));
+    return snapshot;
+}
+
+}
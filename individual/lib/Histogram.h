@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace NHttpProxy {
+
+// Lock-free latency histogram with logarithmic buckets: every power of two
+// of microseconds is split into four linear sub-buckets, so any reported
+// percentile is within 25% of the real value
+class THistogram {
+public:
+    using TDuration = std::chrono::steady_clock::duration;
+
+    static constexpr std::size_t SubBuckets = 4;
+    static constexpr std::size_t Buckets = 64 * SubBuckets;
+
+    // Counts of the buckets read one by one, so not quite consistent with
+    // each other while values are being recorded
+    struct TSnapshot {
+        std::array<std::uint64_t, Buckets> Counts;
+        std::chrono::microseconds Sum;
+    };
+
+    THistogram();
+
+    THistogram(const THistogram&) = delete;
+    THistogram& operator=(const THistogram&) = delete;
+
+    // Thread-safe
+    void Record(TDuration duration);
+
+    std::uint64_t Count() const;
+
+    // Upper bound of the bucket holding the q-th quantile, q in [0, 1]
+    std::chrono::microseconds Percentile(double q) const;
+
+    // Human-readable one-line summary
+    std::string Summary() const;
+
+    TSnapshot Snapshot() const;
+
+    // The largest value of the bucket, in microseconds
+    static std::uint64_t UpperBound(std::size_t bucket);
+
+private:
+    static std::size_t Bucket(std::uint64_t value);
+
+    std::array<std::atomic<std::uint64_t>, Buckets> Counts_;
+    std::atomic<std::uint64_t> Count_;
+    std::atomic<std::uint64_t> Sum_;
+};
+
+}
@@ -0,0 +1,103 @@
+#include <InFlight.h>
+
+namespace NHttpProxy {
+
+void TInFlight::SetHead(const THttpHeaders& request, const THttpResponse& head) {
+    std::unique_lock<std::mutex> lock(Lock_);
+    if (Finished_ || Abandoned_ || Head_.has_value()) {
+        return;
+    }
+    Request_ = request;
+    Head_ = head;
+    Wake(lock);
+}
+
+void TInFlight::Append(std::string_view piece) {
+    if (piece.empty()) {
+        return;
+    }
+    auto shared = std::make_shared<const std::string>(piece);
+    std::unique_lock<std::mutex> lock(Lock_);
+    if (Finished_ || Abandoned_) {
+        return;
+    }
+    Pieces_.push_back(std::move(shared));
+    Wake(lock);
+}
+
+void TInFlight::Finish() {
+    std::unique_lock<std::mutex> lock(Lock_);
+    if (Finished_ || Abandoned_ || !Head_.has_value()) {
+        return;
+    }
+    Finished_ = true;
+    Wake(lock);
+}
+
+void TInFlight::Abandon() {
+    std::unique_lock<std::mutex> lock(Lock_);
+    if (Finished_ || Abandoned_) {
+        return;
+    }
+    Abandoned_ = true;
+    // Nobody is going to take the pieces anymore
+    Pieces_.clear();
+    Wake(lock);
+}
+
+std::optional<TInFlight::TUpdate> TInFlight::Poll(TCursor& cursor, TWake wake) {
+    std::lock_guard<std::mutex> guard(Lock_);
+    TUpdate update;
+    if (Abandoned_) {
+        update.Abandoned = true;
+        return update;
+    }
+    bool fresh = Head_.has_value() && (!cursor.HeadSeen || cursor.Pieces < Pieces_.size() || Finished_);
+    if (!fresh) {
+        Wakes_.push_back(std::move(wake));
+        return {};
+    }
+    if (!cursor.HeadSeen) {
+        update.Head = Head_;
+        update.Request = Request_;
+        cursor.HeadSeen = true;
+    }
+    update.Pieces.assign(Pieces_.begin() + cursor.Pieces, Pieces_.end());
+    cursor.Pieces = Pieces_.size();
+    update.Finished = Finished_;
+    return update;
+}
+
+void TInFlight::Wake(std::unique_lock<std::mutex>& lock) {
+    auto wakes = std::move(Wakes_);
+    Wakes_.clear();
+    lock.unlock();
+    for (auto& wake : wakes) {
+        wake();
+    }
+}
+
+std::pair<std::shared_ptr<TInFlight>, bool> TInFlightTable::Join(const std::string& url) {
+    std::lock_guard<std::mutex> guard(Lock_);
+    auto [it, inserted] = Flights_.try_emplace(url);
+    if (inserted) {
+        it->second = std::make_shared<TInFlight>();
+    } else {
+        Coalesced_++;
+    }
+    return {it->second, inserted};
+}
+
+void TInFlightTable::Remove(const std::string& url, const std::shared_ptr<TInFlight>& flight) {
+    std::lock_guard<std::mutex> guard(Lock_);
+    auto it = Flights_.find(url);
+    if (it != Flights_.end() && it->second == flight) {
+        Flights_.erase(it);
+    }
+}
+
+std::size_t TInFlightTable::Coalesced() const {
+    return Coalesced_;
+}
+
+}
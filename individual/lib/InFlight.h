@@ -0,0 +1,97 @@
+#pragma once
+
+#include <HTTP.h>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace NHttpProxy {
+
+// An upstream response fetched by one session, the leader, and shared with
+// the sessions that asked for the same URL meanwhile. The body is kept
+// decoded, in the pieces it arrived in, so that a waiter may join at any
+// moment and still get it from the start.
+class TInFlight {
+public:
+    using TPiece = std::shared_ptr<const std::string>;
+    using TWake = std::function<void()>;
+
+    // What a waiter has already taken
+    struct TCursor {
+        bool HeadSeen = false;
+        std::size_t Pieces = 0;
+    };
+
+    // What has happened since the waiter looked last time
+    struct TUpdate {
+        // Set on the first update after the head has arrived, along with the
+        // headers of the leader's request, which the response may vary on
+        std::optional<THttpResponse> Head;
+        std::optional<THttpHeaders> Request;
+        std::vector<TPiece> Pieces;
+        // The body is complete with these pieces
+        bool Finished = false;
+        // The leader gave up: the response cannot be shared or failed
+        bool Abandoned = false;
+    };
+
+    // Leader side, all thread-safe. Nothing is published after Finish or
+    // Abandon.
+    void SetHead(const THttpHeaders& request, const THttpResponse& head);
+    void Append(std::string_view piece);
+    void Finish();
+    void Abandon();
+
+    // Waiter side, thread-safe. Returns the news past the cursor and moves
+    // the cursor, or, if there are none yet, arranges for wake to be called
+    // once, from whatever thread, when there are.
+    std::optional<TUpdate> Poll(TCursor& cursor, TWake wake);
+
+private:
+    // Runs the waiting wake callbacks outside of the lock
+    void Wake(std::unique_lock<std::mutex>& lock);
+
+    std::mutex Lock_;
+    std::optional<THttpHeaders> Request_;
+    std::optional<THttpResponse> Head_;
+    std::vector<TPiece> Pieces_;
+    bool Finished_ = false;
+    bool Abandoned_ = false;
+    std::vector<TWake> Wakes_;
+};
+
+// The fetches in flight by URL, shared by all the sessions
+class TInFlightTable {
+public:
+    TInFlightTable() = default;
+
+    TInFlightTable(const TInFlightTable&) = delete;
+    TInFlightTable& operator=(const TInFlightTable&) = delete;
+
+    // Thread-safe. Returns the fetch of the URL and whether the caller has
+    // started it and so is to lead it.
+    std::pair<std::shared_ptr<TInFlight>, bool> Join(const std::string& url);
+
+    // Thread-safe. Called by the leader once new sessions should not join
+    // the fetch anymore.
+    void Remove(const std::string& url, const std::shared_ptr<TInFlight>& flight);
+
+    // Requests that joined a fetch instead of starting their own
+    std::size_t Coalesced() const;
+
+private:
+    std::mutex Lock_;
+    std::unordered_map<std::string, std::shared_ptr<TInFlight>> Flights_;
+    std::atomic<std::size_t> Coalesced_ = 0;
+};
+
+}
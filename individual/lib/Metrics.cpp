@@ -0,0 +1,98 @@
+#include <Metrics.h>
+
+#include <sstream>
+
+namespace NHttpProxy {
+
+namespace {
+
+// Histogram buckets are rendered at powers of two, up to about two minutes
+constexpr std::uint64_t MaxRenderedBound = (std::uint64_t(1) << 27) - 1;
+
+void RenderHistogram(std::ostream& out, const std::string& name, const THistogram& histogram) {
+    auto snapshot = histogram.Snapshot();
+    std::uint64_t count = 0;
+    for (std::size_t i = 0; i < THistogram::Buckets; i++) {
+        count += snapshot.Counts[i];
+        std::uint64_t bound = THistogram::UpperBound(i);
+        if (i % THistogram::SubBuckets == THistogram::SubBuckets - 1 && bound <= MaxRenderedBound) {
+            out << name << "_bucket{le=\"" << bound * 1e-6 << "\"} " << count << "\n";
+        }
+    }
+    out << name << "_bucket{le=\"+Inf\"} " << count << "\n";
+    out << name << "_sum " << snapshot.Sum.count() * 1e-6 << "\n";
+    out << name << "_count " << count << "\n";
+}
+
+}
+
+void TCounter::Add(std::uint64_t n) {
+    Value_.fetch_add(n, std::memory_order_relaxed);
+}
+
+std::uint64_t TCounter::Value() const {
+    return Value_.load(std::memory_order_relaxed);
+}
+
+void TGauge::Add(std::int64_t n) {
+    Value_.fetch_add(n, std::memory_order_relaxed);
+}
+
+std::int64_t TGauge::Value() const {
+    return Value_.load(std::memory_order_relaxed);
+}
+
+TCounter& TMetricsRegistry::AddCounter(const std::string& name, const std::string& help) {
+    TMetric metric{name, help, "counter"};
+    metric.Counter = &Counters_.emplace_back();
+    Metrics_.push_back(std::move(metric));
+    return Counters_.back();
+}
+
+TGauge& TMetricsRegistry::AddGauge(const std::string& name, const std::string& help) {
+    TMetric metric{name, help, "gauge"};
+    metric.Gauge = &Gauges_.emplace_back();
+    Metrics_.push_back(std::move(metric));
+    return Gauges_.back();
+}
+
+THistogram& TMetricsRegistry::AddHistogram(const std::string& name, const std::string& help) {
+    TMetric metric{name, help, "histogram"};
+    metric.Histogram = &Histograms_.emplace_back();
+    Metrics_.push_back(std::move(metric));
+    return Histograms_.back();
+}
+
+void TMetricsRegistry::AddCounterFunction(const std::string& name, const std::string& help, TValueFunction value) {
+    TMetric metric{name, help, "counter"};
+    metric.Value = std::move(value);
+    Metrics_.push_back(std::move(metric));
+}
+
+void TMetricsRegistry::AddGaugeFunction(const std::string& name, const std::string& help, TValueFunction value) {
+    TMetric metric{name, help, "gauge"};
+    metric.Value = std::move(value);
+    Metrics_.push_back(std::move(metric));
+}
+
+std::string TMetricsRegistry::Render() const {
+    std::ostringstream out;
+    // Enough for the values of function metrics to come out whole
+    out.precision(15);
+    for (const TMetric& metric : Metrics_) {
+        out << "# HELP " << metric.Name << " " << metric.Help << "\n";
+        out << "# TYPE " << metric.Name << " " << metric.Type << "\n";
+        if (metric.Counter != nullptr) {
+            out << metric.Name << " " << metric.Counter->Value() << "\n";
+        } else if (metric.Gauge != nullptr) {
+            out << metric.Name << " " << metric.Gauge->Value() << "\n";
+        } else if (metric.Histogram != nullptr) {
+            RenderHistogram(out, metric.Name, *metric.Histogram);
+        } else {
+            out << metric.Name << " " << metric.Value() << "\n";
+        }
+    }
+    return out.str();
+}
+
+}
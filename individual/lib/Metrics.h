@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Histogram.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace NHttpProxy {
+
+// Thread-safe, lock-free
+class TCounter {
+public:
+    void Add(std::uint64_t n = 1);
+    std::uint64_t Value() const;
+
+private:
+    std::atomic<std::uint64_t> Value_{0};
+};
+
+// Thread-safe, lock-free
+class TGauge {
+public:
+    void Add(std::int64_t n);
+    std::int64_t Value() const;
+
+private:
+    std::atomic<std::int64_t> Value_{0};
+};
+
+// Named metrics rendered in the Prometheus text format. Metrics are added
+// before the server runs; after that they are only updated and rendered,
+// from any thread.
+class TMetricsRegistry {
+public:
+    using TValueFunction = std::function<double()>;
+
+    TMetricsRegistry() = default;
+
+    TMetricsRegistry(const TMetricsRegistry&) = delete;
+    TMetricsRegistry& operator=(const TMetricsRegistry&) = delete;
+
+    TCounter& AddCounter(const std::string& name, const std::string& help);
+    TGauge& AddGauge(const std::string& name, const std::string& help);
+    // Durations, rendered in seconds
+    THistogram& AddHistogram(const std::string& name, const std::string& help);
+
+    // Metrics kept elsewhere, read each time the metrics are rendered
+    void AddCounterFunction(const std::string& name, const std::string& help, TValueFunction value);
+    void AddGaugeFunction(const std::string& name, const std::string& help, TValueFunction value);
+
+    std::string Render() const;
+
+private:
+    struct TMetric {
+        std::string Name;
+        std::string Help;
+        std::string Type;
+        const TCounter* Counter = nullptr;
+        const TGauge* Gauge = nullptr;
+        const THistogram* Histogram = nullptr;
+        TValueFunction Value = nullptr;
+    };
+
+    // Deques keep the metrics where they are as more are added
+    std::deque<TCounter> Counters_;
+    std::deque<TGauge> Gauges_;
+    std::deque<THistogram> Histograms_;
+    std::vector<TMetric> Metrics_;
+};
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace NHttpProxy {
+
+// Bounded lock-free queue for many producers and one consumer. Each slot
+// carries a sequence number telling whose turn it is: a producer claims a
+// position with a CAS and publishes the slot by bumping its sequence, the
+// consumer frees it by bumping it once more. Values are copied into the
+// slots, so values that own memory reuse the capacity of the previous ones.
+template <class T>
+class TMpscRing {
+public:
+    // The capacity is rounded up to a power of two
+    explicit TMpscRing(std::size_t capacity)
+        : Capacity_(RoundUp(capacity))
+        , Slots_(new TSlot[Capacity_])
+    {
+        for (std::size_t i = 0; i < Capacity_; i++) {
+            Slots_[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    TMpscRing(const TMpscRing&) = delete;
+    TMpscRing& operator=(const TMpscRing&) = delete;
+
+    // Thread-safe. Returns false if the ring is full.
+    bool TryPush(const T& value) {
+        std::size_t position = Head_.load(std::memory_order_relaxed);
+        while (true) {
+            TSlot& slot = Slots_[position & (Capacity_ - 1)];
+            std::size_t sequence = slot.Sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+            if (diff == 0) {
+                if (Head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.Value = value;
+                    slot.Sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // The consumer has not freed the slot of the previous lap
+                return false;
+            } else {
+                position = Head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer only. Passes the oldest value to the callback, returns
+    // false if there is none.
+    template <class F>
+    bool TryPop(F&& consume) {
+        TSlot& slot = Slots_[Tail_ & (Capacity_ - 1)];
+        if (slot.Sequence.load(std::memory_order_acquire) != Tail_ + 1) {
+            return false;
+        }
+        consume(static_cast<const T&>(slot.Value));
+        slot.Sequence.store(Tail_ + Capacity_, std::memory_order_release);
+        Tail_++;
+        return true;
+    }
+
+    std::size_t Capacity() const {
+        return Capacity_;
+    }
+
+private:
+    struct TSlot {
+        std::atomic<std::size_t> Sequence;
+        T Value;
+    };
+
+    static std::size_t RoundUp(std::size_t capacity) {
+        std::size_t ret = 1;
+        while (ret < capacity) {
+            ret *= 2;
+        }
+        return ret;
+    }
+
+    const std::size_t Capacity_;
+    std::unique_ptr<TSlot[]> Slots_;
+    // Kept apart so that producers and the consumer don't share a cache line
+    alignas(64) std::atomic<std::size_t> Head_{0};
+    alignas(64) std::size_t Tail_ = 0;
+};
+
+}
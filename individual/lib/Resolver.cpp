@@ -0,0 +1,91 @@
+#include <Resolver.h>
+
+#include <memory>
+
+namespace NHttpProxy {
+
+namespace {
+
+// Expired entries are swept out once the cache grows past this size
+constexpr std::size_t CacheSweepThreshold = 4096;
+
+}
+
+TResolver::TResolver(boost::asio::io_context& context, const TResolverOptions& options)
+    : IOContext_(context)
+    , Options_(options)
+{}
+
+void TResolver::AsyncResolve(const std::string& host, const std::string& service, TResolveCallback callback) {
+    std::string key = host + ":" + service;
+    {
+        std::unique_lock<std::mutex> guard(Lock_);
+        auto it = Cache_.find(key);
+        if (it != Cache_.end() && it->second.Expire >= std::chrono::steady_clock::now()) {
+            auto entry = it->second;
+            guard.unlock();
+            callback(entry.Error, entry.Results);
+            return;
+        }
+
+        auto& pending = Pending_[key];
+        pending.emplace_back(std::move(callback));
+        if (pending.size() > 1) {
+            return;
+        }
+    }
+
+    Lookups_++;
+    // Resolver objects are not thread-safe, so every lookup gets its own
+    auto resolver = std::make_shared<boost::asio::ip::tcp::resolver>(IOContext_);
+    resolver->async_resolve(
+        host,
+        service,
+        [this, key, resolver](
+            boost::system::error_code ec,
+            boost::asio::ip::tcp::resolver::results_type results
+        ) {
+            Complete(key, ec, results);
+        }
+    );
+}
+
+std::uint64_t TResolver::Lookups() const {
+    return Lookups_;
+}
+
+void TResolver::Complete(
+    const std::string& key,
+    boost::system::error_code ec,
+    boost::asio::ip::tcp::resolver::results_type results
+) {
+    std::vector<TResolveCallback> callbacks;
+    {
+        std::lock_guard<std::mutex> guard(Lock_);
+        // An aborted lookup is not remembered, the next one starts afresh
+        if (ec != boost::asio::error::operation_aborted) {
+            auto now = std::chrono::steady_clock::now();
+            if (Cache_.size() >= CacheSweepThreshold) {
+                for (auto it = Cache_.begin(); it != Cache_.end();) {
+                    it = it->second.Expire < now ? Cache_.erase(it) : std::next(it);
+                }
+            }
+            Cache_[key] = TEntry {
+                ec,
+                results,
+                now + (ec ? Options_.NegativeTtl : Options_.Ttl)
+            };
+        }
+
+        // The waiters get the error of an aborted lookup too
+        auto it = Pending_.find(key);
+        callbacks = std::move(it->second);
+        Pending_.erase(it);
+    }
+
+    for (auto& callback : callbacks) {
+        callback(ec, results);
+    }
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace NHttpProxy {
+
+using TResolveCallback = std::function<void(
+    boost::system::error_code,
+    boost::asio::ip::tcp::resolver::results_type
+)>;
+
+struct TResolverOptions {
+    // getaddrinfo doesn't report record TTLs, so a fixed one is used
+    std::chrono::seconds Ttl{60};
+    // How long a failed lookup is remembered
+    std::chrono::seconds NegativeTtl{5};
+};
+
+// Asynchronous resolver with a cache shared by all the sessions.
+// Concurrent lookups of the same name are merged into one.
+class TResolver {
+public:
+    TResolver(boost::asio::io_context& context, const TResolverOptions& options);
+
+    TResolver(const TResolver&) = delete;
+    TResolver& operator=(const TResolver&) = delete;
+
+    // Thread-safe. The callback is invoked either inline (on a cache hit)
+    // or on an arbitrary thread running the io_context.
+    void AsyncResolve(const std::string& host, const std::string& service, TResolveCallback callback);
+
+    // Lookups actually made, without the cache hits and the merged ones
+    std::uint64_t Lookups() const;
+
+private:
+    using TTimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+    struct TEntry {
+        boost::system::error_code Error;
+        boost::asio::ip::tcp::resolver::results_type Results;
+        TTimePoint Expire;
+    };
+
+    void Complete(
+        const std::string& key,
+        boost::system::error_code ec,
+        boost::asio::ip::tcp::resolver::results_type results
+    );
+
+    boost::asio::io_context& IOContext_;
+    TResolverOptions Options_;
+
+    std::mutex Lock_;
+    std::unordered_map<std::string, TEntry> Cache_;
+    std::unordered_map<std::string, std::vector<TResolveCallback>> Pending_;
+    std::atomic<std::uint64_t> Lookups_{0};
+};
+
+}
@@ -0,0 +1,266 @@
+#include <Revalidator.h>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace NHttpProxy {
+
+namespace {
+
+// One background conditional request. Every pending handler holds a
+// reference to it.
+class TRevalidation : public std::enable_shared_from_this<TRevalidation> {
+public:
+    TRevalidation(
+        std::chrono::seconds timeout,
+        boost::asio::io_context& context,
+        TResolver& resolver,
+        TConnectionPool& connectionPool,
+        TDatabase& database,
+        const THttpRequest& request
+    )
+        : Strand_(boost::asio::make_strand(context))
+        , Deadline_(Strand_, timeout)
+        , Socket_(context)
+        , Resolver_(resolver)
+        , ConnectionPool_(connectionPool)
+        , Database_(database)
+        , Request_(request)
+        , Serialized_(request.Serialize())
+    {
+        std::tie(Host_, Service_) = SplitURL(Request_.RequestLine().URL());
+    }
+
+    void Start() {
+        boost::asio::post(Strand_, [this, self = shared_from_this()]() {
+            Deadline_.async_wait([this, self](boost::system::error_code ec) {
+                if (!ec) {
+                    Fail();
+                }
+            });
+            auto pooled = ConnectionPool_.Borrow(Host_, Service_);
+            if (pooled.has_value()) {
+                Socket_ = std::move(pooled.value());
+                Reused_ = true;
+                Send();
+                return;
+            }
+            Connect();
+        });
+    }
+
+private:
+    void Connect() {
+        Resolver_.AsyncResolve(
+            Host_,
+            Service_,
+            [this, self = shared_from_this()](
+                boost::system::error_code ec,
+                boost::asio::ip::tcp::resolver::results_type endpoints
+            ) {
+                boost::asio::post(Strand_, [this, self, ec, endpoints]() {
+                    if (Finished_) {
+                        return;
+                    }
+                    if (ec) {
+                        Fail();
+                        return;
+                    }
+                    boost::asio::async_connect(
+                        Socket_,
+                        endpoints,
+                        boost::asio::bind_executor(Strand_, [this, self](boost::system::error_code ec, const auto&) {
+                            if (ec) {
+                                Fail();
+                                return;
+                            }
+                            boost::system::error_code ignored;
+                            Socket_.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+                            Send();
+                        })
+                    );
+                });
+            }
+        );
+    }
+
+    // A pooled connection may have been closed by the server meanwhile
+    bool Retry() {
+        if (!Reused_ || Received_ || Finished_) {
+            return false;
+        }
+        Reused_ = false;
+        boost::system::error_code ignored;
+        Socket_.close(ignored);
+        Connect();
+        return true;
+    }
+
+    void Send() {
+        boost::asio::async_write(
+            Socket_,
+            boost::asio::buffer(Serialized_),
+            boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                    if (!Retry()) {
+                        Fail();
+                    }
+                    return;
+                }
+                Read();
+            })
+        );
+    }
+
+    void Read() {
+        Socket_.async_read_some(
+            boost::asio::buffer(Buffer_),
+            boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+                if (ec == boost::asio::error::eof) {
+                    if (Retry()) {
+                        return;
+                    }
+                    KeepAlive_ = false;
+                    if (Parser_.Finish() == EParseResult::Parsed) {
+                        Done();
+                    } else {
+                        Fail();
+                    }
+                    return;
+                }
+                if (ec) {
+                    Fail();
+                    return;
+                }
+                Received_ = true;
+
+                std::string_view data(Buffer_.data(), size);
+                EParseResult status = Parser_.Consume(data);
+                while (status != EParseResult::Await && status != EParseResult::Error && !HeadParsed_) {
+                    if (IsInterim(Parser_.Head())) {
+                        Parser_.Reset();
+                        Parser_.SetRequestMethod(Request_.RequestLine().Method());
+                        status = Parser_.Consume(data);
+                        continue;
+                    }
+                    HeadParsed_ = true;
+                    if (!StartResponse()) {
+                        Fail();
+                        return;
+                    }
+                    if (status == EParseResult::Head) {
+                        status = Parser_.Consume(data);
+                    }
+                }
+                if (TooLarge_ || status == EParseResult::Error) {
+                    Fail();
+                    return;
+                }
+                if (status == EParseResult::Parsed) {
+                    Done();
+                    return;
+                }
+                Read();
+            })
+        );
+    }
+
+    // Returns false if the response is of no use to the cache
+    bool StartResponse() {
+        auto head = Parser_.Head();
+        KeepAlive_ = !Parser_.CloseDelimited() && KeepsConnection(
+            head.ResponseStatusLine().HttpVersion(),
+            head.Headers()
+        );
+        if (head.ResponseStatusLine().StatusCode() == "304") {
+            return true;
+        }
+        if (head.ResponseStatusLine().StatusCode() != "200" || !Database_.Cacheable(Request_, head)) {
+            return false;
+        }
+        Parser_.StreamBody([this](std::string_view piece) {
+            if (Body_.size() + piece.size() > Database_.MaxEntrySize()) {
+                TooLarge_ = true;
+                return;
+            }
+            Body_.append(piece);
+        });
+        return true;
+    }
+
+    void Done() {
+        Finished_ = true;
+        Deadline_.cancel();
+        auto head = Parser_.Head();
+        if (head.ResponseStatusLine().StatusCode() == "304") {
+            Database_.Refresh(Request_, head);
+        } else {
+            THttpResponse response(head.ResponseStatusLine(), head.Headers(), std::move(Body_));
+            // The body is stored decoded
+            response.Headers().Remove(EHeader::TransferEncoding);
+            response.UpdateContentLength();
+            Database_.CacheResponse(Request_, std::move(response));
+        }
+        if (KeepAlive_) {
+            ConnectionPool_.Return(Host_, Service_, std::move(Socket_));
+        }
+    }
+
+    void Fail() {
+        if (std::exchange(Finished_, true)) {
+            return;
+        }
+        Deadline_.cancel();
+        Database_.AbortRevalidation(Request_);
+        boost::system::error_code ignored;
+        Socket_.close(ignored);
+    }
+
+    boost::asio::strand<boost::asio::io_context::executor_type> Strand_;
+    boost::asio::steady_timer Deadline_;
+    boost::asio::ip::tcp::socket Socket_;
+    TResolver& Resolver_;
+    TConnectionPool& ConnectionPool_;
+    TDatabase& Database_;
+
+    THttpRequest Request_;
+    std::string Serialized_;
+    std::string Host_;
+    std::string Service_;
+    bool Reused_ = false;
+    bool Received_ = false;
+    bool KeepAlive_ = false;
+    // Done or given up
+    bool Finished_ = false;
+
+    std::array<char, 4096> Buffer_;
+    THttpResponseParser Parser_;
+    bool HeadParsed_ = false;
+    bool TooLarge_ = false;
+    std::string Body_;
+};
+
+}
+
+TRevalidator::TRevalidator(
+    const TRevalidatorOptions& options,
+    boost::asio::io_context& context,
+    TResolver& resolver,
+    TConnectionPool& connectionPool,
+    TDatabase& database
+)
+    : Options_(options)
+    , Context_(context)
+    , Resolver_(resolver)
+    , ConnectionPool_(connectionPool)
+    , Database_(database)
+{}
+
+void TRevalidator::Revalidate(const THttpRequest& request) {
+    std::make_shared<TRevalidation>(Options_.Timeout, Context_, Resolver_, ConnectionPool_, Database_, request)->Start();
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <ConnectionPool.h>
+#include <Database.h>
+#include <HTTP.h>
+#include <Resolver.h>
+
+#include <chrono>
+
+#include <boost/asio.hpp>
+
+namespace NHttpProxy {
+
+struct TRevalidatorOptions {
+    // A revalidation not done by then is given up and the entry stays stale
+    std::chrono::seconds Timeout{30};
+};
+
+// Revalidates cache entries in background, on behalf of the hits served
+// stale within stale-while-revalidate. Each revalidation is a conditional
+// request of its own over a pooled or a new upstream connection.
+class TRevalidator {
+public:
+    TRevalidator(
+        const TRevalidatorOptions& options,
+        boost::asio::io_context& context,
+        TResolver& resolver,
+        TConnectionPool& connectionPool,
+        TDatabase& database
+    );
+
+    TRevalidator(const TRevalidator&) = delete;
+    TRevalidator& operator=(const TRevalidator&) = delete;
+
+    // Thread-safe. Sends the request, which is to carry the validators of
+    // the cached response, and refreshes the entry with a 304 response or
+    // replaces it with a new one. Any other outcome leaves the entry stale.
+    void Revalidate(const THttpRequest& request);
+
+private:
+    TRevalidatorOptions Options_;
+    boost::asio::io_context& Context_;
+    TResolver& Resolver_;
+    TConnectionPool& ConnectionPool_;
+    TDatabase& Database_;
+};
+
+}
@@ -1,8 +1,16 @@
 #include <Server.h>
+#include <Admin.h>
 #include <Session.h>
 #include <Database.h>
+#include <Metrics.h>
 
+#include <algorithm>
+#include <iostream>
 #include <iterator>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <boost/asio.hpp>
 
@@ -16,51 +24,179 @@ TServerError::TServerError(const std::string& message)
 
 class TServer::TImpl {
 public:
-    TImpl()
-        : IOContext_(1)
+    TImpl(const TServerOptions& options)
+        : Options_(options)
+        , IOContext_(static_cast<int>(std::max<std::size_t>(options.Threads, 1)))
         , Signals_(IOContext_)
         , Acceptor_(IOContext_)
+        , Database_(options.Database)
+        , Resolver_(IOContext_, options.Resolver)
+        , ConnectionPool_(options.ConnectionPool)
+        , CompressionPool_(options.Compression)
+        , Revalidator_(options.Revalidator, IOContext_, Resolver_, ConnectionPool_, Database_)
+        , SessionMetrics_{
+            Metrics_.AddHistogram("proxy_resolve_duration_seconds", "Time to resolve upstream host names"),
+            Metrics_.AddHistogram("proxy_connect_duration_seconds", "Time to connect to upstream servers"),
+            Metrics_.AddHistogram("proxy_first_byte_duration_seconds", "Time from a parsed request to the first byte of its response"),
+            Metrics_.AddHistogram("proxy_request_duration_seconds", "Time from a parsed request to the last byte of its response"),
+            Metrics_.AddCounter("proxy_requests_total", "Requests received from clients"),
+            Metrics_.AddCounter("proxy_client_received_bytes_total", "Bytes received from clients"),
+            Metrics_.AddCounter("proxy_client_sent_bytes_total", "Bytes sent to clients"),
+            Metrics_.AddCounter("proxy_upstream_received_bytes_total", "Bytes received from upstream servers"),
+            Metrics_.AddCounter("proxy_upstream_sent_bytes_total", "Bytes sent to upstream servers"),
+            Metrics_.AddCounter("proxy_compression_input_bytes_total", "Response bytes compressed"),
+            Metrics_.AddCounter("proxy_compression_output_bytes_total", "Compressed response bytes")
+        }
+        , AccessLog_(options.AccessLog, options.AccessLogCapacity)
+        , SessionContext_{
+            options.Session,
+            Database_,
+            Resolver_,
+            ConnectionPool_,
+            CompressionPool_,
+            InFlight_,
+            Revalidator_,
+            SessionMetrics_,
+            AccessLog_
+        }
+        , Admin_(IOContext_, Metrics_)
     {
         Signals_.add(SIGINT);
         Signals_.add(SIGTERM);
         Signals_.add(SIGQUIT);
+        AddMetrics();
     }
 
     void Bind(const std::string& host, const std::string& port) {
-        boost::asio::ip::tcp::resolver resolver(IOContext_);
-        boost::asio::ip::tcp::resolver::query query(host, port);
-        auto endpoints = resolver.resolve(query);
-
-        if (endpoints.empty()) {
-            throw TServerError("Couldn't resolve " + host + ":" + port);
-        }
-
-        boost::asio::ip::tcp::endpoint endpoint = *endpoints.begin();
+        boost::asio::ip::tcp::endpoint endpoint = Resolve(host, port);
         Acceptor_.open(endpoint.protocol());
         Acceptor_.set_option(
             boost::asio::ip::tcp::acceptor::reuse_address(true)
         );
         Acceptor_.bind(endpoint);
+
+        if (!Options_.AdminPort.empty()) {
+            Admin_.Bind(Resolve(Options_.AdminHost, Options_.AdminPort));
+        }
     }
 
     void Run() {
         Signals_.async_wait(
-            [this](...) {
-                Acceptor_.close();
-                for (TSession& session : Sessions_) {
-                    session.Stop();
+            [this](boost::system::error_code ec, int) {
+                if (!ec) {
+                    Stop();
                 }
-                Sessions_.clear();
             }
         );
 
         Acceptor_.listen();
         AsyncAccept();
+        Admin_.Start();
+        Database_.StartSweeping(IOContext_);
+        ConnectionPool_.StartSweeping(IOContext_);
 
+        std::vector<std::thread> workers;
+        for (std::size_t i = 1; i < Options_.Threads; i++) {
+            workers.emplace_back([this]() { IOContext_.run(); });
+        }
         IOContext_.run();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        CompressionPool_.Stop();
+
+        // No handler can run anymore, so sessions may be destroyed right away
+        std::lock_guard<std::mutex> guard(SessionsLock_);
+        Sessions_.clear();
+        AccessLog_.Stop();
+
+        std::cout << "[STAT]  resolve " << SessionMetrics_.ResolveLatency.Summary() << std::endl;
+        std::cout << "[STAT]  connect " << SessionMetrics_.ConnectLatency.Summary() << std::endl;
+        auto stats = Database_.Stats();
+        std::cout << "[STAT]  cache hits=" << stats.Hits
+                  << " misses=" << stats.Misses
+                  << " evictions=" << stats.Evictions
+                  << " expirations=" << stats.Expirations
+                  << " stale=" << stats.StaleHits
+                  << " refreshed=" << stats.Refreshes
+                  << " entries=" << stats.Entries
+                  << " bytes=" << stats.Bytes
+                  << " coalesced=" << InFlight_.Coalesced() << std::endl;
+        if (!Options_.Database.Disk.Directory.empty()) {
+            std::cout << "[STAT]  disk hits=" << stats.DiskHits
+                      << " entries=" << stats.DiskEntries
+                      << " bytes=" << stats.DiskBytes
+                      << " failures=" << stats.DiskFailures << std::endl;
+        }
+        if (AccessLog_.Enabled()) {
+            std::cout << "[STAT]  access written=" << AccessLog_.Written()
+                      << " dropped=" << AccessLog_.Dropped() << std::endl;
+        }
+    }
+
+    void Stop() {
+        boost::asio::post(
+            IOContext_,
+            [this]() {
+                Signals_.cancel();
+                Acceptor_.close();
+                Admin_.Stop();
+                IOContext_.stop();
+            }
+        );
     }
 
 private:
+    boost::asio::ip::tcp::endpoint Resolve(const std::string& host, const std::string& port) {
+        boost::asio::ip::tcp::resolver resolver(IOContext_);
+        boost::asio::ip::tcp::resolver::query query(host, port);
+        auto endpoints = resolver.resolve(query);
+
+        if (endpoints.empty()) {
+            throw TServerError("Couldn't resolve " + host + ":" + port);
+        }
+        return *endpoints.begin();
+    }
+
+    // Metrics the sessions don't update themselves, read when rendered
+    void AddMetrics() {
+        // Sessions may outlive the registry in the handlers left in the
+        // io_context, so they are counted here rather than by themselves
+        Metrics_.AddGaugeFunction("proxy_active_sessions", "Open client connections",
+            [this] {
+                std::lock_guard<std::mutex> guard(SessionsLock_);
+                return Sessions_.size();
+            });
+        Metrics_.AddCounterFunction("proxy_cache_hits_total", "Responses served from the cache",
+            [this] { return Database_.Stats().Hits; });
+        Metrics_.AddCounterFunction("proxy_cache_misses_total", "Cache lookups that found nothing to serve",
+            [this] { return Database_.Stats().Misses; });
+        Metrics_.AddGaugeFunction("proxy_cache_hit_ratio", "Share of cache lookups served from the cache",
+            [this] {
+                auto stats = Database_.Stats();
+                return stats.Hits + stats.Misses == 0 ? 0.0 : static_cast<double>(stats.Hits) / (stats.Hits + stats.Misses);
+            });
+        Metrics_.AddCounterFunction("proxy_cache_evictions_total", "Entries evicted to fit the cache budget",
+            [this] { return Database_.Stats().Evictions; });
+        Metrics_.AddGaugeFunction("proxy_cache_entries", "Entries in the memory cache",
+            [this] { return Database_.Stats().Entries; });
+        Metrics_.AddGaugeFunction("proxy_cache_bytes", "Bytes held by the memory cache",
+            [this] { return Database_.Stats().Bytes; });
+        Metrics_.AddCounterFunction("proxy_dns_lookups_total", "Upstream host names resolved, cache hits aside",
+            [this] { return Resolver_.Lookups(); });
+        Metrics_.AddCounterFunction("proxy_coalesced_requests_total", "Requests that joined a fetch of the same URL",
+            [this] { return InFlight_.Coalesced(); });
+        Metrics_.AddGaugeFunction("proxy_compression_ratio", "Compressed response bytes per input byte",
+            [this] {
+                auto in = SessionMetrics_.CompressionBytesIn.Value();
+                return in == 0 ? 0.0 : static_cast<double>(SessionMetrics_.CompressionBytesOut.Value()) / in;
+            });
+        Metrics_.AddCounterFunction("proxy_compression_failures_total", "Responses sent uncompressed as the encoder failed",
+            [this] { return CompressionPool_.Failures(); });
+        Metrics_.AddCounterFunction("proxy_access_log_dropped_total", "Access log records dropped as the writer fell behind",
+            [this] { return AccessLog_.Dropped(); });
+    }
+
     void AsyncAccept() {
         Acceptor_.async_accept(
             [this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
@@ -68,6 +204,9 @@ private:
                     return;
                 }
                 if (!ec) {
+                    // Responses are written in several pieces, don't hold them back
+                    boost::system::error_code ignored;
+                    socket.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
                     Serve(std::move(socket));
                 }
                 AsyncAccept();
@@ -76,24 +215,43 @@ private:
     }
 
     void Serve(boost::asio::ip::tcp::socket socket) {
-        Sessions_.emplace_back(std::move(socket), IOContext_, Database_);
-        Sessions_.back().SetEndCallback(
+        std::lock_guard<std::mutex> guard(SessionsLock_);
+        auto session = std::make_shared<TSession>(std::move(socket), IOContext_, SessionContext_);
+        Sessions_.push_back(session);
+        session->SetEndCallback(
             [this, it = std::prev(Sessions_.end())]() {
+                std::lock_guard<std::mutex> guard(SessionsLock_);
                 Sessions_.erase(it);
             }
         );
-        Sessions_.back().Start();
+        session->Start();
     }
 
+    TServerOptions Options_;
     boost::asio::io_context IOContext_;
     boost::asio::signal_set Signals_;
     boost::asio::ip::tcp::acceptor Acceptor_;
-    std::list<TSession> Sessions_;
+    std::mutex SessionsLock_;
+    std::list<std::shared_ptr<TSession>> Sessions_;
     TDatabase Database_;
+    TResolver Resolver_;
+    TConnectionPool ConnectionPool_;
+    TCompressionPool CompressionPool_;
+    TInFlightTable InFlight_;
+    TRevalidator Revalidator_;
+    TMetricsRegistry Metrics_;
+    TSessionMetrics SessionMetrics_;
+    TAccessLog AccessLog_;
+    TSessionContext SessionContext_;
+    TAdminServer Admin_;
 };
 
 TServer::TServer()
-    : Impl_(new TImpl())
+    : TServer(TServerOptions{})
+{}
+
+TServer::TServer(const TServerOptions& options)
+    : Impl_(new TImpl(options))
 {}
 
 TServer::~TServer() = default;
@@ -110,4 +268,8 @@ void TServer::Run() {
     Impl_->Run();
 }
 
+void TServer::Stop() {
+    Impl_->Stop();
+}
+
 }
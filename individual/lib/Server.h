@@ -1,5 +1,13 @@
 #pragma once
 
+#include <CompressionPool.h>
+#include <ConnectionPool.h>
+#include <Database.h>
+#include <Resolver.h>
+#include <Revalidator.h>
+#include <Session.h>
+
+#include <cstddef>
 #include <memory>
 #include <stdexcept>
 #include <string>
@@ -11,9 +19,32 @@ public:
     TServerError(const std::string& message);
 };
 
+struct TServerOptions {
+    // Number of threads running the shared io_context. Every session is
+    // bound to its own strand, so its handlers never run concurrently.
+    std::size_t Threads = 1;
+
+    TDatabaseOptions Database;
+    TResolverOptions Resolver;
+    TConnectionPoolOptions ConnectionPool;
+    TRevalidatorOptions Revalidator;
+    TCompressionPoolOptions Compression;
+    TSessionOptions Session;
+
+    // File the access log is appended to, "-" for stdout, none if empty
+    std::string AccessLog = "-";
+    // Records waiting to be written; the ones beyond that are dropped
+    std::size_t AccessLogCapacity = 65536;
+
+    // Where the metrics are served, nowhere if the port is empty
+    std::string AdminHost = "127.0.0.1";
+    std::string AdminPort;
+};
+
 class TServer {
 public:
     TServer();
+    explicit TServer(const TServerOptions& options);
     ~TServer();
 
     TServer(const TServer&) = delete;
@@ -24,6 +55,9 @@ public:
     void Bind(const std::string& host, const std::string& port);
     void Run();
 
+    // Thread-safe; makes Run() return
+    void Stop();
+
 private:
     class TImpl;
     std::unique_ptr<TImpl> Impl_;
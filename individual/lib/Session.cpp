@@ -1,20 +1,75 @@
 #include <Session.h>
+#include <CachePolicy.h>
 #include <Compress.h>
 
-#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <tuple>
+#include <utility>
+#include <sstream>
 #include <string_view>
+#include <vector>
 
 namespace NHttpProxy {
 
+namespace {
+
+int StatusCode(std::string_view code) {
+    int ret = 0;
+    std::from_chars(code.data(), code.data() + code.size(), ret);
+    return ret;
+}
+
+std::string_view ContentEncoding(const THttpHeaders& headers) {
+    const THttpHeader* header = headers.Find(EHeader::ContentEncoding);
+    return header == nullptr ? std::string_view() : header->Value();
+}
+
+// Whether the Expect value is the only expectation there is, 100-continue
+bool ExpectsContinue(std::string_view expect) {
+    std::string_view expected = "100-continue";
+    return std::equal(expect.begin(), expect.end(), expected.begin(), expected.end(), [](char a, char b) {
+        return std::tolower(static_cast<unsigned char>(a)) == b;
+    });
+}
+
+bool IsConditional(const THttpRequest& request) {
+    return request.Headers().Find(EHeader::IfModifiedSince) != nullptr
+        || request.Headers().Find(EHeader::IfNoneMatch) != nullptr;
+}
+
+// Whether the response to the request may be shared with other clients
+// asking for the same URL. Those asking for a part of it or for its update
+// get their own.
+bool Coalescible(const THttpRequest& request) {
+    if (request.RequestLine().Method() != "GET" || IsConditional(request)) {
+        return false;
+    }
+    for (std::string_view name : {"Range", "Authorization"}) {
+        if (request.Headers().Find(name) != nullptr) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
 TSession::TSession(
     boost::asio::ip::tcp::socket socket,
     boost::asio::io_context& context,
-    TDatabase& database
+    TSessionContext& sessionContext
 )
-    : ClientSocket_(std::move(socket))
+    : Strand_(boost::asio::make_strand(context))
+    , ClientSocket_(std::move(socket))
     , ForeignSocket_(context)
-    , IOContext_(context)
-    , Database_(database)
+    , IdleTimer_(Strand_)
+    , RequestParser_(Arena_.Resource())
+    , ResponseParser_(Arena_.Resource())
+    , Context_(sessionContext)
+    , Database_(sessionContext.Database)
 {}
 
 void TSession::SetEndCallback(TSessionEndCallback callback) {
@@ -22,164 +77,889 @@ void TSession::SetEndCallback(TSessionEndCallback callback) {
 }
 
 void TSession::Start() {
-    ReadClient();
+    boost::asio::post(Strand_, [this, self = shared_from_this()]() { ReadClient(); });
 }
 
 void TSession::Stop() {
-    ClientSocket_.close();
-    ForeignSocket_.close();
+    if (Stopped_) {
+        return;
+    }
+    Stopped_ = true;
+    if (ClientRequest_.has_value()) {
+        LogAccess(std::chrono::steady_clock::now() - ExchangeStart_);
+    }
+    LeaveFlight();
+    boost::system::error_code ignored;
+    ClientSocket_.close(ignored);
+    ForeignSocket_.close(ignored);
+    IdleTimer_.cancel();
     if (EndCallback_.has_value()) {
         EndCallback_.value()();
     }
 }
 
 void TSession::ReadClient() {
+    if (!ClientPending_.empty()) {
+        ConsumeRequest(std::exchange(ClientPending_, {}));
+        return;
+    }
+
+    StartIdleTimer();
     ClientSocket_.async_read_some(
         boost::asio::buffer(ClientBuffer_),
-        [this](boost::system::error_code ec, std::size_t size) {
+        boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+            Context_.Metrics.ClientBytesIn.Add(size);
+            IdleTimer_.cancel();
             if (ec && ec != boost::asio::error::operation_aborted) {
                 Stop();
             }
             if (ec) {
                 return;
             }
-            EParseResult status = EParseResult::Await;
-            for (std::size_t i = 0; i < size && status == EParseResult::Await; i++) {
-                status = RequestParser_.Consume(ClientBuffer_[i]);
-            }
-            if (status == EParseResult::Await) {
-                ReadClient();
-            } else {
-                WriteForeign();
+            ConsumeRequest(std::string_view(ClientBuffer_.data(), size));
+        })
+    );
+}
+
+void TSession::StartIdleTimer() {
+    IdleTimer_.expires_after(Context_.Options.IdleTimeout);
+    IdleTimer_.async_wait(
+        [this, self = shared_from_this()](boost::system::error_code ec) {
+            // The timer may have been restarted after it had fired
+            if (!ec && IdleTimer_.expiry() <= std::chrono::steady_clock::now()) {
+                Stop();
             }
         }
     );
 }
 
-namespace {
-
-std::pair<std::string, std::string> SplitURL(const std::string& url) {
-    std::size_t i = 0;
-    auto ss = std::strstr(url.c_str(), "://");
-    if (ss != nullptr) {
-        i = ss - url.c_str() + 3;
+void TSession::ConsumeRequest(std::string_view data) {
+    EParseResult status = RequestParser_.Consume(data);
+    ClientPending_ = data;
+    if (status == EParseResult::Await) {
+        ReadClient();
+        return;
     }
-    auto j = std::string_view(url.c_str() + i, url.size() - i).find('/');
-    if (j == std::string_view::npos) {
-        j = url.size();
+    if (status == EParseResult::Error) {
+        // Nothing more is taken from the client
+        ClientPending_ = {};
+        ExchangeStart_ = std::chrono::steady_clock::now();
+        Access_ = TAccessRecord();
+        Access_.Time = std::chrono::system_clock::now();
+        WriteError("400 Bad Request");
+        return;
     }
-    if (ss == nullptr) {
-        return {"http", url.substr(i, j)};
-    } else {
-        return {url.substr(0, i - 3), url.substr(i, j)};
+    ClientRequest_ = RequestParser_.TakeParsed();
+    Context_.Metrics.Requests.Add();
+    ExchangeStart_ = std::chrono::steady_clock::now();
+    Access_.Time = std::chrono::system_clock::now();
+    Access_.Method = ClientRequest_->RequestLine().Method();
+    Access_.URL = ClientRequest_->RequestLine().URL();
+    Access_.Status = 0;
+    Access_.Cache = ECacheResult::None;
+    Access_.Encoding.clear();
+    Access_.Bytes = 0;
+    Access_.FirstByte = {};
+    ClientBodyPending_ = status == EParseResult::Head;
+    if (ClientBodyPending_) {
+        // The body is not kept but sent upstream as it arrives, each read
+        // of the client right from ClientBuffer_
+        RequestParser_.StreamBody([this](std::string_view piece) {
+            Upload_.push_back(boost::asio::buffer(piece.data(), piece.size()));
+        });
     }
+    WriteForeign();
 }
 
-void LogRequest(const std::string& url) {
-    std::cout << "[REQ]   " << url << std::endl;
+void TSession::FinishExchange() {
+    auto total = std::chrono::steady_clock::now() - ExchangeStart_;
+    Context_.Metrics.TotalLatency.Record(total);
+    LogAccess(total);
+    LeaveFlight();
+    // What is left of an unread body would be taken for the next request
+    if (!ClientKeepAlive_ || ClientBodyPending_) {
+        boost::system::error_code ignored;
+        ClientSocket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+        Stop();
+        return;
+    }
+
+    ClientRequest_.reset();
+    ForeignRequest_.reset();
+    ForeignHead_.reset();
+    ClientHead_.reset();
+    RequestParser_.Reset();
+    ResponseParser_.Reset();
+    Arena_.Reset();
+    Response_.clear();
+    ForeignReused_ = false;
+    ForeignReceived_ = false;
+    ForeignKeepAlive_ = false;
+    ForeignBodySent_ = false;
+    ClientExpectsContinue_ = false;
+    FirstByteSent_ = false;
+    AccessLogged_ = false;
+    Upload_.clear();
+    Encoder_ = nullptr;
+    HeadParsed_ = false;
+    Encoding_ = false;
+    ClientChunked_ = false;
+    Dechunking_ = false;
+    Encoded_.clear();
+    SharedPieces_.clear();
+    CacheTee_ = false;
+    std::string().swap(CachedBody_);
+    Stale_.reset();
+
+    ReadClient();
 }
 
-void LogResponse(const std::string& url, bool compressed) {
-    std::cout << "[RESP]  " << url;
-    if (compressed) {
-        std::cout << " (gzip)";
+void TSession::RecordFirstByte() {
+    if (!FirstByteSent_) {
+        FirstByteSent_ = true;
+        auto firstByte = std::chrono::steady_clock::now() - ExchangeStart_;
+        Context_.Metrics.FirstByteLatency.Record(firstByte);
+        Access_.FirstByte = std::chrono::duration_cast<std::chrono::microseconds>(firstByte);
     }
-    std::cout << std::endl;
 }
 
-void LogCachedResponse(const std::string& url, bool compressed) {
-    std::cout << "[CACHE] " << url;
-    if (compressed) {
-        std::cout << " (gzip)";
+void TSession::LogAccess(std::chrono::steady_clock::duration total) {
+    if (AccessLogged_) {
+        return;
     }
-    std::cout << std::endl;
+    AccessLogged_ = true;
+    Access_.Total = std::chrono::duration_cast<std::chrono::microseconds>(total);
+    Context_.AccessLog.Log(Access_);
 }
 
+void TSession::PrepareForClient(THttpHeaders& headers) const {
+    RemoveHopByHopHeaders(headers);
+    headers.Append(EHeader::Connection, ClientKeepAlive_ ? "keep-alive" : "close");
 }
 
-void TSession::WriteForeign() {
-    auto request = RequestParser_.Parsed();
+THttpRequest TSession::ForeignRequest() {
+    THttpRequest request(*ClientRequest_, Arena_.Resource());
     request.Headers().Remove("Accept-Encoding");
+    // The proxy answers the expectation itself
+    request.Headers().Remove(EHeader::Expect);
+    if (request.Headers().Find(EHeader::TransferEncoding) != nullptr) {
+        // The body is forwarded chunked, whatever the length says
+        request.Headers().Remove(EHeader::ContentLength);
+    }
+    RemoveHopByHopHeaders(request.Headers());
+    request.Headers().Append(EHeader::Connection, "keep-alive");
+    return request;
+}
+
+void TSession::WriteForeign() {
+    auto request = ForeignRequest();
+    std::string url(request.RequestLine().URL());
+    ClientKeepAlive_ = ++Served_ < Context_.Options.MaxRequests && KeepsConnection(
+        request.RequestLine().HttpVersion(),
+        ClientRequest_->Headers()
+    );
+    std::tie(ForeignHost_, ForeignService_) = SplitURL(url);
+
+    if (const THttpHeader* expect = ClientRequest_->Headers().Find(EHeader::Expect)) {
+        if (!ExpectsContinue(expect->Value())) {
+            WriteError("417 Expectation Failed");
+            return;
+        }
+        ClientExpectsContinue_ = ClientBodyPending_ && request.RequestLine().HttpVersion() != "HTTP/1.0";
+    }
+
+    Encoder_ = Context_.CompressionPool.ChooseEncoder(*ClientRequest_);
+    ResponseParser_.SetRequestMethod(request.RequestLine().Method());
+
+    // A request with a body always goes upstream, the body with it
+    if (!ClientBodyPending_ && ServeFromCache(url)) {
+        return;
+    }
+    if (ParseRequestCacheControl(ClientRequest_->Headers()).OnlyIfCached) {
+        WriteError("504 Gateway Timeout");
+        return;
+    }
+    // An expired response is fetched only if it has changed
+    if (Stale_ != nullptr) {
+        AddValidators(*Stale_, request.Headers());
+    }
+    ForeignRequest_ = std::move(request);
+    ForeignBuffers_.clear();
+    ForeignRequest_->Serialize(ForeignBuffers_);
 
-    Request_ = request.Serialize();
-    std::string url = request.RequestLine().URL();
-    auto [scheme, host] = SplitURL(url);
-    LogRequest(url);
+    if (!ClientBodyPending_ && Coalescible(*ClientRequest_)) {
+        auto [flight, leader] = Context_.InFlight.Join(url);
+        Flight_ = std::move(flight);
+        FlightURL_ = url;
+        FlightCursor_ = {};
+        FlightLeader_ = leader;
+        if (!leader) {
+            WaitFlight();
+            return;
+        }
+    }
+    FetchForeign();
+}
 
-    auto cached = Database_.ServeCached(url);
-    if (cached.has_value()) {
-        bool compressed = false;
-        if (CompressionSupported(RequestParser_.Parsed())) {
-            Compress(cached.value());
-            compressed = true;
+bool TSession::ServeFromCache(const std::string& url) {
+    auto hit = Database_.ServeCached(*ClientRequest_, Encoder_ != nullptr ? Encoder_->Name : "");
+    if (!hit.has_value()) {
+        return false;
+    }
+    if (hit.value().Stale) {
+        // Conditional requests of the client itself are passed as they are
+        if (!IsConditional(*ClientRequest_)) {
+            Stale_ = std::move(hit.value().Response);
         }
-        LogCachedResponse(url, compressed);
-        Response_ = cached.value().Serialize();
-        WriteClient();
+        return false;
+    }
+    if (hit.value().Revalidate) {
+        THttpRequest request(THttpRequestLine("GET", url, "HTTP/1.1"), ForeignRequest().Headers(), "");
+        AddValidators(*hit.value().Response, request.Headers());
+        Context_.Revalidator.Revalidate(request);
+    }
+
+    Access_.Cache = hit.value().Revalidate ? ECacheResult::Stale : ECacheResult::Hit;
+    if (hit.value().BuildVariant) {
+        CompressCached(hit.value().Key, std::move(hit.value().Response));
+    } else {
+        WriteCached(std::move(hit.value().Response));
+    }
+    return true;
+}
+
+void TSession::ServeRefreshed() {
+    const THttpResponse& head = *ForeignHead_;
+    ForeignKeepAlive_ = KeepsConnection(head.ResponseStatusLine().HttpVersion(), head.Headers());
+    ReleaseForeign();
+
+    std::string url(ClientRequest_->RequestLine().URL());
+    Database_.Refresh(*ClientRequest_, head);
+    auto stale = std::move(Stale_);
+    // The sessions waiting for this fetch find the response in the cache
+    LeaveFlight();
+    if (ServeFromCache(url)) {
+        Access_.Cache = ECacheResult::Refreshed;
+        return;
+    }
+    // The entry is gone or is already stale again
+    Access_.Cache = ECacheResult::Refreshed;
+    WriteCached(RefreshCachedResponse(*stale, head.Headers()));
+}
+
+void TSession::FetchForeign() {
+    Access_.Cache = ECacheResult::Miss;
+    auto pooled = Context_.ConnectionPool.Borrow(ForeignHost_, ForeignService_);
+    if (pooled.has_value()) {
+        ForeignSocket_ = std::move(pooled.value());
+        ForeignReused_ = true;
+        SendRequest();
         return;
     }
+    ConnectForeign();
+}
+
+void TSession::ConnectForeign() {
+    auto start = std::chrono::steady_clock::now();
+    Context_.Resolver.AsyncResolve(
+        ForeignHost_,
+        ForeignService_,
+        [this, self = shared_from_this(), start](
+            boost::system::error_code ec,
+            boost::asio::ip::tcp::resolver::results_type endpoints
+        ) {
+            boost::asio::post(Strand_, [this, self, start, ec, endpoints]() {
+                Context_.Metrics.ResolveLatency.Record(std::chrono::steady_clock::now() - start);
+                // The client may have gone away during the lookup
+                if (Stopped_) {
+                    return;
+                }
+                if (ec) {
+                    WriteError("502 Bad Gateway");
+                    return;
+                }
+                Connect(endpoints);
+            });
+        }
+    );
+}
+
+void TSession::Connect(const boost::asio::ip::tcp::resolver::results_type& endpoints) {
+    auto start = std::chrono::steady_clock::now();
+    boost::asio::async_connect(
+        ForeignSocket_,
+        endpoints,
+        boost::asio::bind_executor(Strand_, [this, self = shared_from_this(), start](boost::system::error_code ec, const auto&) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            Context_.Metrics.ConnectLatency.Record(std::chrono::steady_clock::now() - start);
+            if (ec) {
+                WriteError("502 Bad Gateway");
+                return;
+            }
+            boost::system::error_code ignored;
+            ForeignSocket_.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+            SendRequest();
+        })
+    );
+}
+
+bool TSession::RetryOnFreshConnection() {
+    // A pooled connection may be closed by the server right when it is
+    // reused. Nothing has been received then, so it is safe to try again,
+    // unless the client has already sent a part of the body.
+    if (!ForeignReused_ || ForeignReceived_ || ForeignBodySent_) {
+        return false;
+    }
+    ForeignReused_ = false;
+    boost::system::error_code ignored;
+    ForeignSocket_.close(ignored);
+    ConnectForeign();
+    return true;
+}
 
-    boost::asio::ip::tcp::resolver resolver(IOContext_);
-    auto endpoints = resolver.resolve(host, scheme);
-    boost::asio::connect(ForeignSocket_, endpoints);
+void TSession::SendRequest() {
     boost::asio::async_write(
         ForeignSocket_,
-        boost::asio::buffer(Request_),
-        [this](boost::system::error_code ec, std::size_t) {
+        ForeignBuffers_,
+        boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+            Context_.Metrics.UpstreamBytesOut.Add(size);
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (ec) {
+                if (!RetryOnFreshConnection()) {
+                    Stop();
+                }
+                return;
+            }
+            if (ClientBodyPending_) {
+                SendRequestBody();
+            } else {
+                ReadForeign();
+            }
+        })
+    );
+}
+
+void TSession::SendRequestBody() {
+    if (ClientExpectsContinue_ && ClientPending_.empty()) {
+        static const std::string continue_ = "HTTP/1.1 100 Continue\r\n\r\n";
+        ClientExpectsContinue_ = false;
+        boost::asio::async_write(
+            ClientSocket_,
+            boost::asio::buffer(continue_),
+            boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+                Context_.Metrics.ClientBytesOut.Add(size);
+                Access_.Bytes += size;
+                if (ec && ec != boost::asio::error::operation_aborted) {
+                    Stop();
+                }
+                if (ec) {
+                    return;
+                }
+                SendRequestBody();
+            })
+        );
+        return;
+    }
+    if (!ClientPending_.empty()) {
+        ConsumeRequestBody(std::exchange(ClientPending_, {}));
+        return;
+    }
+
+    StartIdleTimer();
+    ClientSocket_.async_read_some(
+        boost::asio::buffer(ClientBuffer_),
+        boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+            Context_.Metrics.ClientBytesIn.Add(size);
+            IdleTimer_.cancel();
+            // The body is cut short if the client goes away
             if (ec && ec != boost::asio::error::operation_aborted) {
                 Stop();
             }
             if (ec) {
                 return;
             }
-            ReadForeign();
-        }
+            ConsumeRequestBody(std::string_view(ClientBuffer_.data(), size));
+        })
+    );
+}
+
+void TSession::ConsumeRequestBody(std::string_view data) {
+    Upload_.clear();
+    EParseResult status = RequestParser_.Consume(data);
+    ClientPending_ = data;
+    if (status == EParseResult::Error) {
+        // Upstream gets nothing more; both connections are closed
+        WriteError("400 Bad Request");
+        return;
+    }
+    ClientBodyPending_ = status != EParseResult::Parsed;
+    ForeignBodySent_ = true;
+    // The next piece is read once this one is sent
+    boost::asio::async_write(
+        ForeignSocket_,
+        Upload_,
+        boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+            Context_.Metrics.UpstreamBytesOut.Add(size);
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (ec) {
+                Stop();
+                return;
+            }
+            if (ClientBodyPending_) {
+                SendRequestBody();
+            } else {
+                ReadForeign();
+            }
+        })
     );
 }
 
 void TSession::ReadForeign() {
     ForeignSocket_.async_read_some(
         boost::asio::buffer(ForeignBuffer_),
-        [this](boost::system::error_code ec, std::size_t size) {
+        boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+            Context_.Metrics.UpstreamBytesIn.Add(size);
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (ec == boost::asio::error::eof) {
+                if (RetryOnFreshConnection()) {
+                    return;
+                }
+                if (ResponseParser_.Finish() != EParseResult::Parsed) {
+                    // The response is truncated
+                    Stop();
+                    return;
+                }
+                ForeignKeepAlive_ = false;
+                ProcessResponse(EParseResult::Parsed, {});
+                return;
+            }
+            if (ec) {
+                Stop();
+                return;
+            }
+            ForeignReceived_ = true;
+
+            std::string_view data(ForeignBuffer_.data(), size);
+            EParseResult status = EParseResult::Head;
+            while (!HeadParsed_) {
+                status = ResponseParser_.Consume(data);
+                if (status == EParseResult::Await) {
+                    ReadForeign();
+                    return;
+                }
+                if (status == EParseResult::Error) {
+                    // Nothing has been sent to the client yet
+                    WriteError("502 Bad Gateway");
+                    return;
+                }
+                ForeignHead_ = ResponseParser_.Head();
+                if (IsInterim(*ForeignHead_)) {
+                    ResponseParser_.Reset();
+                    ResponseParser_.SetRequestMethod(ClientRequest_->RequestLine().Method());
+                    continue;
+                }
+                HeadParsed_ = true;
+                if (Stale_ != nullptr && ForeignHead_->ResponseStatusLine().StatusCode() == "304") {
+                    ServeRefreshed();
+                    return;
+                }
+                StartResponse(status);
+            }
+            std::string_view body;
+            if (status != EParseResult::Parsed) {
+                const char* bodyStart = data.data();
+                status = ResponseParser_.Consume(data);
+                body = std::string_view(bodyStart, data.data() - bodyStart);
+            }
+            if (status == EParseResult::Error) {
+                // Part of the response may have been sent already
+                Stop();
+                return;
+            }
+            ProcessResponse(status, body);
+        })
+    );
+}
+
+void TSession::StartResponse(EParseResult status) {
+    const THttpResponse& head = *ForeignHead_;
+    ForeignKeepAlive_ = !ResponseParser_.CloseDelimited() && KeepsConnection(
+        head.ResponseStatusLine().HttpVersion(),
+        head.Headers()
+    );
+    // Without a length the client can only see the end of the body as
+    // the end of the connection
+    if (ResponseParser_.CloseDelimited()) {
+        ClientKeepAlive_ = false;
+    }
+
+    // The body is passed through as soon as it arrives, compressed on the
+    // way if it is worth it. A response parsed along with its head has no
+    // body.
+    Encoding_ = Encoder_ != nullptr
+        && status != EParseResult::Parsed
+        && Context_.CompressionPool.Compressible(head);
+    // An HTTP/1.0 client knows nothing of chunks
+    Dechunking_ = !Encoding_
+        && status != EParseResult::Parsed
+        && ResponseParser_.Chunked()
+        && ClientRequest_->RequestLine().HttpVersion() == "HTTP/1.0";
+    // The body is copied aside only while it may still fit into the cache.
+    // Only such a response is shared with the sessions waiting for it.
+    CacheTee_ = Database_.Cacheable(*ClientRequest_, head);
+    if (CacheTee_ && Flight_ != nullptr) {
+        Flight_->SetHead(ClientRequest_->Headers(), head);
+    } else {
+        LeaveFlight();
+    }
+    ResponseParser_.StreamBody([this](std::string_view piece) {
+        if (Encoding_) {
+            Context_.Metrics.CompressionBytesIn.Add(piece.size());
+            EncoderStream_->Write(piece, Encoded_);
+        } else if (Dechunking_) {
+            Encoded_.append(piece);
+        }
+        if (!CacheTee_) {
+            return;
+        }
+        if (CachedBody_.size() + piece.size() > Database_.MaxEntrySize()) {
+            CacheTee_ = false;
+            std::string().swap(CachedBody_);
+            LeaveFlight();
+            return;
+        }
+        CachedBody_.append(piece);
+        if (Flight_ != nullptr) {
+            Flight_->Append(piece);
+        }
+    });
+
+    // The client gets a copy with its own framing and connection headers
+    ClientHead_ = ResponseParser_.Head();
+    if (Encoding_) {
+        StartEncoding(ClientHead_->Headers());
+    } else if (Dechunking_) {
+        ClientHead_->Headers().Remove(EHeader::ContentLength);
+        ChunkForClient(ClientHead_->Headers());
+    }
+    PrepareForClient(ClientHead_->Headers());
+    Access_.Status = StatusCode(head.ResponseStatusLine().StatusCode());
+    Access_.Encoding = ContentEncoding(ClientHead_->Headers());
+}
+
+void TSession::StartSharedResponse(THttpResponse head) {
+    // The shared body is decoded, so its framing is up to this session
+    if (head.Headers().Find(EHeader::TransferEncoding) != nullptr) {
+        head.Headers().Remove(EHeader::TransferEncoding);
+        head.Headers().Remove(EHeader::ContentLength);
+    }
+    Encoding_ = Encoder_ != nullptr && Context_.CompressionPool.Compressible(head);
+    if (Encoding_) {
+        StartEncoding(head.Headers());
+    } else if (head.Headers().Find(EHeader::ContentLength) == nullptr) {
+        ChunkForClient(head.Headers());
+    }
+    PrepareForClient(head.Headers());
+    Access_.Cache = ECacheResult::Coalesced;
+    Access_.Status = StatusCode(head.ResponseStatusLine().StatusCode());
+    Access_.Encoding = ContentEncoding(head.Headers());
+    ClientHead_ = std::move(head);
+}
+
+void TSession::StartEncoding(THttpHeaders& headers) {
+    if (EncoderStreamOf_ != Encoder_) {
+        EncoderStream_ = Encoder_->MakeStream();
+        EncoderStreamOf_ = Encoder_;
+    }
+    SetContentEncoding(headers, Encoder_->Name);
+    ChunkForClient(headers);
+}
+
+void TSession::ChunkForClient(THttpHeaders& headers) {
+    headers.Remove("Transfer-Encoding");
+    ClientChunked_ = ClientRequest_->RequestLine().HttpVersion() != "HTTP/1.0";
+    if (ClientChunked_) {
+        headers.Append(EHeader::TransferEncoding, "chunked");
+    } else {
+        ClientKeepAlive_ = false;
+    }
+}
+
+void TSession::ProcessResponse(EParseResult status, std::string_view body) {
+    bool last = status == EParseResult::Parsed;
+    if (last) {
+        ReleaseForeign();
+        if (CacheTee_) {
+            // Copied off the arena, as the cache outlives the exchange
+            THttpResponse response(ForeignHead_->ResponseStatusLine(), ForeignHead_->Headers(), std::move(CachedBody_));
+            // The body is stored decoded
+            response.Headers().Remove("Transfer-Encoding");
+            response.UpdateContentLength();
+            Database_.CacheResponse(*ClientRequest_, std::move(response));
+        }
+        // Sessions coming from now on find the response in the cache
+        if (Flight_ != nullptr) {
+            Context_.InFlight.Remove(FlightURL_, Flight_);
+            Flight_->Finish();
+            Flight_.reset();
+        }
+    }
+    if (Encoding_) {
+        // The decoded body has gone to the stream through the body callback
+        if (last) {
+            EncoderStream_->Finish(Encoded_);
+        } else {
+            EncoderStream_->Flush(Encoded_);
+        }
+        Context_.Metrics.CompressionBytesOut.Add(Encoded_.size());
+        body = Encoded_;
+    } else if (Dechunking_) {
+        // The decoded body has gone aside through the body callback
+        body = Encoded_;
+    }
+    WriteClientPart(body, last);
+}
+
+void TSession::ReleaseForeign() {
+    if (ForeignKeepAlive_) {
+        Context_.ConnectionPool.Return(ForeignHost_, ForeignService_, std::move(ForeignSocket_));
+        return;
+    }
+    boost::system::error_code ignored;
+    ForeignSocket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+    ForeignSocket_.close(ignored);
+}
+
+void TSession::CompressCached(const std::string& key, std::shared_ptr<const TCachedResponse> identity) {
+    if (!Context_.CompressionPool.Compressible(identity->Head)) {
+        Database_.AddVariant(key, identity, Encoder_->Name, identity);
+        WriteCached(std::move(identity));
+        return;
+    }
+    THttpResponse response(identity->Head.ResponseStatusLine(), identity->Head.Headers(), std::string(identity->Body));
+    bool submitted = Context_.CompressionPool.Submit(
+        std::move(response),
+        *Encoder_,
+        [this, self = shared_from_this(), key, identity, encoder = Encoder_](std::optional<THttpResponse> compressed) {
+            if (!compressed) {
+                // A later hit may try again
+                Database_.AddVariant(key, identity, encoder->Name, nullptr);
+                boost::asio::post(Strand_, [this, self, identity]() { WriteCached(identity); });
+                return;
+            }
+            Context_.Metrics.CompressionBytesIn.Add(identity->Body.size());
+            Context_.Metrics.CompressionBytesOut.Add(compressed->Data().size());
+            auto variant = MakeCachedResponse(std::move(*compressed));
+            Database_.AddVariant(key, identity, encoder->Name, variant);
+            boost::asio::post(Strand_, [this, self, variant]() { WriteCached(variant); });
+        }
+    );
+    if (!submitted) {
+        Database_.AddVariant(key, identity, Encoder_->Name, nullptr);
+        WriteCached(std::move(identity));
+    }
+}
+
+void TSession::WriteClientPart(std::string_view body, bool last) {
+    WriteClientPart(TBuffers{boost::asio::buffer(body.data(), body.size())}, last);
+}
+
+void TSession::WriteClientPart(const TBuffers& body, bool last) {
+    static const std::string crlf = "\r\n";
+    static const std::string lastChunk = "0\r\n\r\n";
+
+    RecordFirstByte();
+    TBuffers buffers;
+    if (ClientHead_.has_value()) {
+        ClientHead_->Serialize(buffers);
+    }
+    if (!ClientChunked_) {
+        buffers.insert(buffers.end(), body.begin(), body.end());
+    } else {
+        std::size_t bodySize = boost::asio::buffer_size(body);
+        // An empty chunk would end the body
+        if (bodySize != 0) {
+            std::ostringstream size;
+            size << std::hex << bodySize << "\r\n";
+            ChunkSize_ = size.str();
+            buffers.push_back(boost::asio::buffer(ChunkSize_));
+            buffers.insert(buffers.end(), body.begin(), body.end());
+            buffers.push_back(boost::asio::buffer(crlf));
+        }
+        if (last) {
+            buffers.push_back(boost::asio::buffer(lastChunk));
+        }
+    }
+    // The next upstream read waits for the client to take this part
+    boost::asio::async_write(
+        ClientSocket_,
+        buffers,
+        boost::asio::bind_executor(Strand_, [this, self = shared_from_this(), last](boost::system::error_code ec, std::size_t size) {
+            Context_.Metrics.ClientBytesOut.Add(size);
+            Access_.Bytes += size;
             if (ec && ec != boost::asio::error::operation_aborted) {
                 Stop();
             }
             if (ec) {
                 return;
             }
-            EParseResult status = EParseResult::Await;
-            for (std::size_t i = 0; i < size && status == EParseResult::Await; i++) {
-                status = ResponseParser_.Consume(ForeignBuffer_[i]);
-            }
-            if (status == EParseResult::Await) {
-                ReadForeign();
-            } else {
-                ForeignSocket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
-                auto response = ResponseParser_.Parsed();
-                bool compressed = false;
-                if (CompressionSupported(RequestParser_.Parsed())) {
-                    compressed = true;
-                    Compress(response);
+            ClientHead_.reset();
+            Encoded_.clear();
+            SharedPieces_.clear();
+            if (!last) {
+                if (Flight_ != nullptr && !FlightLeader_) {
+                    WaitFlight();
+                } else {
+                    ReadForeign();
                 }
-                Response_ = response.Serialize();
-                LogResponse(RequestParser_.Parsed().RequestLine().URL(), compressed);
-                Database_.CacheResponse(RequestParser_.Parsed(), ResponseParser_.Parsed());
-                WriteClient();
+                return;
+            }
+            FinishExchange();
+        })
+    );
+}
+
+void TSession::WaitFlight() {
+    std::size_t exchange = Served_;
+    auto update = Flight_->Poll(FlightCursor_, [this, weak = weak_from_this(), exchange]() {
+        auto self = weak.lock();
+        if (self == nullptr) {
+            return;
+        }
+        boost::asio::post(Strand_, [this, self, exchange]() {
+            // The session may have moved on since it started waiting
+            if (!Stopped_ && Served_ == exchange && Flight_ != nullptr) {
+                WaitFlight();
             }
+        });
+    });
+    if (!update.has_value()) {
+        return;
+    }
+    if (update.value().Abandoned) {
+        Flight_.reset();
+        if (FlightCursor_.HeadSeen) {
+            // Part of the response has been sent already
+            Stop();
+            return;
+        }
+        // The leader may have refreshed a stale entry
+        if (!ServeFromCache(FlightURL_)) {
+            FetchForeign();
+        }
+        return;
+    }
+
+    if (update.value().Head.has_value()) {
+        // The response may vary on headers this client has sent otherwise
+        auto vary = VaryHeaders(update.value().Head.value().Headers());
+        const THttpHeaders& headers = ClientRequest_->Headers();
+        if (!vary.has_value() || CacheKey({}, vary.value(), update.value().Request.value()) != CacheKey({}, vary.value(), headers)) {
+            LeaveFlight();
+            FetchForeign();
+            return;
         }
+        StartSharedResponse(std::move(update.value().Head.value()));
+    }
+    bool last = update.value().Finished;
+    if (!Encoding_) {
+        // The pieces are written as they are, kept alive until then
+        SharedPieces_ = std::move(update.value().Pieces);
+        TBuffers body;
+        for (const auto& piece : SharedPieces_) {
+            body.push_back(boost::asio::buffer(*piece));
+        }
+        WriteClientPart(body, last);
+        return;
+    }
+    for (const auto& piece : update.value().Pieces) {
+        Context_.Metrics.CompressionBytesIn.Add(piece->size());
+        EncoderStream_->Write(*piece, Encoded_);
+    }
+    if (last) {
+        EncoderStream_->Finish(Encoded_);
+    } else {
+        EncoderStream_->Flush(Encoded_);
+    }
+    Context_.Metrics.CompressionBytesOut.Add(Encoded_.size());
+    WriteClientPart(Encoded_, last);
+}
+
+void TSession::LeaveFlight() {
+    if (Flight_ == nullptr) {
+        return;
+    }
+    if (FlightLeader_) {
+        Context_.InFlight.Remove(FlightURL_, Flight_);
+        Flight_->Abandon();
+    }
+    Flight_.reset();
+}
+
+void TSession::WriteCached(std::shared_ptr<const TCachedResponse> cached) {
+    static const std::string keepAlive = "Connection: keep-alive\r\n\r\n";
+    static const std::string close = "Connection: close\r\n\r\n";
+
+    std::array<boost::asio::const_buffer, 3> buffers = {
+        boost::asio::buffer(cached->SerializedHead),
+        boost::asio::buffer(ClientKeepAlive_ ? keepAlive : close),
+        boost::asio::buffer(cached->Body.data(), cached->Body.size())
+    };
+    RecordFirstByte();
+    Access_.Status = StatusCode(cached->Head.ResponseStatusLine().StatusCode());
+    Access_.Encoding = ContentEncoding(cached->Head.Headers());
+    // The entry stays alive until the write is over, even if it is evicted
+    boost::asio::async_write(
+        ClientSocket_,
+        buffers,
+        boost::asio::bind_executor(Strand_, [this, self = shared_from_this(), cached](boost::system::error_code ec, std::size_t size) {
+            Context_.Metrics.ClientBytesOut.Add(size);
+            Access_.Bytes += size;
+            if (ec && ec != boost::asio::error::operation_aborted) {
+                Stop();
+            }
+            if (ec) {
+                return;
+            }
+            FinishExchange();
+        })
     );
 }
 
+void TSession::WriteError(const std::string& status) {
+    ClientKeepAlive_ = false;
+    Access_.Status = StatusCode(std::string_view(status).substr(0, 3));
+    Response_ = "HTTP/1.1 " + status + "\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+    WriteClient();
+}
+
 void TSession::WriteClient() {
+    RecordFirstByte();
     boost::asio::async_write(
         ClientSocket_,
         boost::asio::buffer(Response_),
-        [this](boost::system::error_code ec, std::size_t) {
-            if (!ec) {
-                ClientSocket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
+        boost::asio::bind_executor(Strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+            Context_.Metrics.ClientBytesOut.Add(size);
+            Access_.Bytes += size;
+            if (ec && ec != boost::asio::error::operation_aborted) {
+                Stop();
             }
-            Stop();
-        }
+            if (ec) {
+                return;
+            }
+            FinishExchange();
+        })
     );
 }
 
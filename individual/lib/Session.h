@@ -1,11 +1,24 @@
 #pragma once
 
+#include <AccessLog.h>
+#include <Arena.h>
+#include <Compress.h>
+#include <CompressionPool.h>
+#include <ConnectionPool.h>
 #include <Database.h>
+#include <Histogram.h>
 #include <HTTP.h>
+#include <InFlight.h>
+#include <Metrics.h>
+#include <Revalidator.h>
+#include <Resolver.h>
 
 #include <array>
+#include <chrono>
+#include <cstddef>
 #include <functional>
 #include <list>
+#include <memory>
 #include <optional>
 
 #include <boost/asio.hpp>
@@ -14,12 +27,55 @@ namespace NHttpProxy {
 
 using TSessionEndCallback = std::function<void()>;
 
-class TSession {
+struct TSessionOptions {
+    // How long a client connection may wait for the next request
+    std::chrono::seconds IdleTimeout{15};
+    // Requests served over one client connection
+    std::size_t MaxRequests = 100;
+};
+
+// What the sessions measure, registered by the server
+struct TSessionMetrics {
+    THistogram& ResolveLatency;
+    THistogram& ConnectLatency;
+    // From a parsed request to the first byte of its response
+    THistogram& FirstByteLatency;
+    // From a parsed request to the last byte of its response
+    THistogram& TotalLatency;
+    TCounter& Requests;
+    TCounter& ClientBytesIn;
+    TCounter& ClientBytesOut;
+    TCounter& UpstreamBytesIn;
+    TCounter& UpstreamBytesOut;
+    // Bytes fed to the encoders and what they made of them
+    TCounter& CompressionBytesIn;
+    TCounter& CompressionBytesOut;
+};
+
+// Services shared by all the sessions of a server
+struct TSessionContext {
+    TSessionOptions Options;
+
+    TDatabase& Database;
+    TResolver& Resolver;
+    TConnectionPool& ConnectionPool;
+    TCompressionPool& CompressionPool;
+    TInFlightTable& InFlight;
+    TRevalidator& Revalidator;
+
+    TSessionMetrics& Metrics;
+    TAccessLog& AccessLog;
+};
+
+// One client connection. It serves requests one after another, pipelined
+// requests included, while the client keeps the connection alive. Every
+// pending handler holds a reference to the session.
+class TSession : public std::enable_shared_from_this<TSession> {
 public:
     TSession(
         boost::asio::ip::tcp::socket,
         boost::asio::io_context& context,
-        TDatabase& database
+        TSessionContext& sessionContext
     );
 
     TSession(const TSession&) = delete;
@@ -34,25 +90,154 @@ public:
     void Stop();
 
 private:
+    // Serves pipelined bytes left from the previous request, if any,
+    // otherwise reads the client
     void ReadClient();
+    // Closes the session if the client sends nothing for a while
+    void StartIdleTimer();
+    void ConsumeRequest(std::string_view data);
+    // Either starts over with the next request or closes the connection
+    void FinishExchange();
+    // Called when a response starts going to the client
+    void RecordFirstByte();
+    // Logs the exchange once, whether it is finished or cut short
+    void LogAccess(std::chrono::steady_clock::duration total);
+    void PrepareForClient(THttpHeaders& headers) const;
+    // The request as it is sent upstream
+    THttpRequest ForeignRequest();
     void WriteForeign();
+    // Answers from the cache if there is a response to serve. Sets Stale_
+    // if there is one to revalidate first.
+    bool ServeFromCache(const std::string& url);
+    // Serves the stale response confirmed by a 304 one
+    void ServeRefreshed();
+    // Gets the response from upstream over a pooled or a new connection
+    void FetchForeign();
+    void ConnectForeign();
+    void Connect(const boost::asio::ip::tcp::resolver::results_type& endpoints);
+    // Replaces a dead pooled connection, returns false if it is too late
+    bool RetryOnFreshConnection();
+    void SendRequest();
+    // Passes the request body upstream as the client sends it, one read at
+    // a time, answering 100-continue first if the client waits for it
+    void SendRequestBody();
+    void ConsumeRequestBody(std::string_view data);
     void ReadForeign();
     void WriteClient();
 
+    // Called once the head of the upstream response is parsed
+    void StartResponse(EParseResult status);
+    void ProcessResponse(EParseResult status, std::string_view body);
+    // Called once the head of a response fetched by another session arrives
+    void StartSharedResponse(THttpResponse head);
+    // Sets up the Encoder_ stream and the headers of the body it makes
+    void StartEncoding(THttpHeaders& headers);
+    // Frames a body of unknown length: chunked for HTTP/1.1 clients, until
+    // the connection is closed otherwise
+    void ChunkForClient(THttpHeaders& headers);
+    // Sends what has arrived of the response another session fetches, or
+    // waits for it to arrive
+    void WaitFlight();
+    // Drops the shared fetch, if any. The waiters of a fetch the session
+    // leads go fetching on their own.
+    void LeaveFlight();
+    // Returns the upstream connection to the pool or closes it
+    void ReleaseForeign();
+    // Sends the pending head (if any) and a piece of the streamed body,
+    // framed as a chunk if the client gets the body chunked
+    void WriteClientPart(std::string_view body, bool last);
+    void WriteClientPart(const TBuffers& body, bool last);
+    // Builds the Encoder_ variant of a cached response and sends it
+    void CompressCached(const std::string& key, std::shared_ptr<const TCachedResponse> identity);
+    // Writes a cached response without copying it
+    void WriteCached(std::shared_ptr<const TCachedResponse> cached);
+    // Answers the client with an empty response of the given status
+    void WriteError(const std::string& status);
+
+    // Serializes all the handlers of this session
+    boost::asio::strand<boost::asio::io_context::executor_type> Strand_;
+
     boost::asio::ip::tcp::socket ClientSocket_;
     boost::asio::ip::tcp::socket ForeignSocket_;
+    std::string ForeignHost_;
+    std::string ForeignService_;
+    bool ForeignReused_ = false;
+    bool ForeignReceived_ = false;
+    bool ForeignKeepAlive_ = false;
+    // Some of the request body has gone upstream, so it can't be resent
+    bool ForeignBodySent_ = false;
+
+    boost::asio::steady_timer IdleTimer_;
+    std::size_t Served_ = 0;
+    // When the request of the current exchange was parsed
+    std::chrono::steady_clock::time_point ExchangeStart_;
+    bool FirstByteSent_ = false;
+    // Filled in as the exchange goes, its strings reused by the next ones
+    TAccessRecord Access_;
+    bool AccessLogged_ = false;
+    bool ClientKeepAlive_ = false;
+    bool Stopped_ = false;
 
     std::array<char, 4096> ClientBuffer_;
-    std::string Request_;
+    // Unparsed bytes of ClientBuffer_ belonging to the request body or to
+    // the next request
+    std::string_view ClientPending_;
+    // Whether the client is yet to send (a part of) the request body
+    bool ClientBodyPending_ = false;
+    bool ClientExpectsContinue_ = false;
+    // The pieces of ClientBuffer_ holding the body, framing included
+    TBuffers Upload_;
     std::array<char, 4096> ForeignBuffer_;
+    // An error response written as it is
     std::string Response_;
 
+    // Backs the messages of one exchange, so it is declared before them
+    TArena Arena_;
     THttpRequestParser RequestParser_;
     THttpResponseParser ResponseParser_;
+    // The request of the client, taken from the parser once it is parsed
+    std::optional<THttpRequest> ClientRequest_;
+    // The request sent upstream and its buffers, kept for a retry
+    std::optional<THttpRequest> ForeignRequest_;
+    TBuffers ForeignBuffers_;
+    // The head of the upstream response as it was received
+    std::optional<THttpResponse> ForeignHead_;
+    // The head of the response, sent along with the first part of the body
+    std::optional<THttpResponse> ClientHead_;
+    // Coding the client gets compressed responses in, if any
+    const TEncoder* Encoder_ = nullptr;
+    bool HeadParsed_ = false;
+    // Whether the body is compressed on the way. Such a body is sent chunked
+    // to HTTP/1.1 clients and until the connection is closed otherwise.
+    bool Encoding_ = false;
+    bool ClientChunked_ = false;
+    // Whether a chunked body is decoded for an HTTP/1.0 client, which gets
+    // it until the connection is closed
+    bool Dechunking_ = false;
+    // Created on the first compressed response and reused while the coding
+    // stays the same
+    std::unique_ptr<TEncoderStream> EncoderStream_;
+    const TEncoder* EncoderStreamOf_ = nullptr;
+    // Compressed or decoded output waiting to be sent
+    std::string Encoded_;
+    // Pieces of a shared fetch being sent as they are
+    std::vector<TInFlight::TPiece> SharedPieces_;
+    std::string ChunkSize_;
+    // Whether the streamed body is being collected for the cache
+    bool CacheTee_ = false;
+    std::string CachedBody_;
+    // The fetch shared with the sessions asking for the same URL, either
+    // led by this session or waited for
+    std::shared_ptr<TInFlight> Flight_;
+    std::string FlightURL_;
+    bool FlightLeader_ = false;
+    TInFlight::TCursor FlightCursor_;
+    // The expired response the upstream request is conditional on
+    std::shared_ptr<const TCachedResponse> Stale_;
 
-    boost::asio::io_context& IOContext_;
     std::optional<TSessionEndCallback> EndCallback_;
 
+    TSessionContext& Context_;
     TDatabase& Database_;
 };
 
@@ -0,0 +1,130 @@
+#include <doctest/doctest.h>
+
+#include <AccessLog.h>
+#include <MpscRing.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace NHttpProxy;
+
+namespace {
+
+TAccessRecord Record(const std::string& url) {
+    TAccessRecord record;
+    record.Time = std::chrono::system_clock::time_point(std::chrono::milliseconds(1791540000123));
+    record.Method = "GET";
+    record.URL = url;
+    record.Status = 200;
+    record.Cache = ECacheResult::Hit;
+    record.Encoding = "gzip";
+    record.Bytes = 1234;
+    record.FirstByte = std::chrono::microseconds(512);
+    record.Total = std::chrono::microseconds(2048);
+    return record;
+}
+
+}
+
+TEST_CASE("A full ring refuses values until the consumer takes some") {
+    TMpscRing<int> ring(3);
+    REQUIRE(ring.Capacity() == 4);
+    for (int i = 0; i < 4; i++) {
+        CHECK(ring.TryPush(i));
+    }
+    CHECK(!ring.TryPush(4));
+
+    int value = -1;
+    CHECK(ring.TryPop([&value](int v) { value = v; }));
+    CHECK(value == 0);
+    CHECK(ring.TryPush(4));
+    for (int i = 1; i <= 4; i++) {
+        CHECK(ring.TryPop([&value](int v) { value = v; }));
+        CHECK(value == i);
+    }
+    CHECK(!ring.TryPop([](int) {}));
+}
+
+TEST_CASE("Values of each producer come out in the order they were pushed") {
+    constexpr int Producers = 4;
+    constexpr int Values = 20000;
+    TMpscRing<std::pair<int, int>> ring(64);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < Producers; p++) {
+        producers.emplace_back([&ring, p]() {
+            for (int i = 0; i < Values; i++) {
+                while (!ring.TryPush({p, i})) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    std::vector<int> next(Producers, 0);
+    bool ordered = true;
+    for (int received = 0; received < Producers * Values;) {
+        bool popped = ring.TryPop([&](const std::pair<int, int>& value) {
+            ordered = ordered && value.second == next[value.first];
+            next[value.first] = value.second + 1;
+        });
+        if (popped) {
+            received++;
+        }
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    CHECK(ordered);
+    CHECK(next == std::vector<int>(Producers, Values));
+}
+
+TEST_CASE("A record is formatted as one line of key=value pairs") {
+    std::string line;
+    FormatAccessRecord(Record("http://example.com/a"), line);
+    CHECK(line == "time=2026-10-09T10:00:00.123Z method=GET url=http://example.com/a status=200 cache=hit "
+        "encoding=gzip bytes=1234 ttfb_us=512 total_us=2048\n");
+
+    TAccessRecord failed;
+    failed.Method = "GET";
+    failed.URL = "http://example.com/b";
+    failed.Status = 502;
+    line.clear();
+    FormatAccessRecord(failed, line);
+    CHECK(line.find(" status=502 cache=none encoding=- bytes=0 ") != std::string::npos);
+}
+
+TEST_CASE("Records logged before the stop are written out, the ones beyond the ring are dropped") {
+    auto path = std::filesystem::temp_directory_path() / ("proxy-access-log-" + std::to_string(getpid()));
+    std::filesystem::remove(path);
+    {
+        TAccessLog log(path.string(), 4);
+        CHECK(log.Enabled());
+        for (int i = 0; i < 1000; i++) {
+            log.Log(Record("http://example.com/" + std::to_string(i)));
+        }
+        log.Stop();
+        CHECK(log.Written() + log.Dropped() == 1000);
+        CHECK(log.Written() >= 4);
+    }
+
+    std::ifstream file(path);
+    std::string line;
+    std::size_t lines = 0;
+    while (std::getline(file, line)) {
+        CHECK(line.rfind("time=", 0) == 0);
+        lines++;
+    }
+    CHECK(lines >= 4);
+    std::filesystem::remove(path);
+
+    TAccessLog disabled("", 4);
+    CHECK(!disabled.Enabled());
+    disabled.Log(Record("http://example.com/"));
+    CHECK(disabled.Dropped() == 0);
+}
@@ -0,0 +1,117 @@
+#include <doctest/doctest.h>
+
+#include <Arena.h>
+#include <HTTP.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <string_view>
+
+using namespace NHttpProxy;
+
+namespace {
+
+std::atomic<std::size_t> Allocations = 0;
+
+const std::string Request =
+    "GET http://example.com/articles/2026/10/some-fairly-long-path?page=2&sort=date HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Referer: http://example.com/articles/2026/10/\r\n"
+    "Cookie: session=7f3c9a1be2d04c5f8a6e; theme=dark\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+// Parses the request and rewrites it the way it is sent upstream
+std::size_t ParseAndRewrite(THttpRequestParser& parser) {
+    std::string_view data = Request;
+    parser.Consume(data);
+    auto request = parser.TakeParsed();
+    request.Headers().Remove(EHeader::AcceptEncoding);
+    RemoveHopByHopHeaders(request.Headers());
+    request.Headers().Append(EHeader::Connection, "keep-alive");
+    return request.Headers().Size();
+}
+
+}
+
+void* operator new(std::size_t size) {
+    Allocations++;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+// The default memory resource allocates with an alignment
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    Allocations++;
+    std::size_t align = std::max(static_cast<std::size_t>(alignment), sizeof(void*));
+    if (void* p = std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+TEST_CASE("Parsing and rewriting a request does not allocate once the arena has grown") {
+    TArena arena(256);
+    THttpRequestParser parser(arena.Resource());
+    for (std::size_t i = 0; i < 5; i++) {
+        ParseAndRewrite(parser);
+        parser.Reset();
+        arena.Reset();
+    }
+
+    std::size_t before = Allocations;
+    std::size_t headers = 0;
+    for (std::size_t i = 0; i < 100; i++) {
+        headers += ParseAndRewrite(parser);
+        parser.Reset();
+        arena.Reset();
+    }
+    std::size_t allocations = Allocations - before;
+
+    CHECK(allocations == 0);
+    CHECK(headers == 100 * 7);
+    CHECK(arena.BlockSize() > 256);
+}
+
+TEST_CASE("A copy of a message outlives the arena it was parsed into") {
+    TArena arena;
+    THttpRequestParser parser(arena.Resource());
+    std::string_view data = Request;
+    REQUIRE(parser.Consume(data) == EParseResult::Parsed);
+    THttpHeaders copy = parser.TakeParsed().Headers();
+    parser.Reset();
+    arena.Reset();
+
+    // Reuses the memory the original was in
+    data = "GET http://other.org/ HTTP/1.1\r\nHost: other.org\r\nCookie: xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\r\n\r\n";
+    REQUIRE(parser.Consume(data) == EParseResult::Parsed);
+    CHECK(parser.TakeParsed().Headers()["Host"] == "other.org");
+
+    CHECK(copy["Host"] == "example.com");
+    CHECK(copy["Cookie"] == "session=7f3c9a1be2d04c5f8a6e; theme=dark");
+}
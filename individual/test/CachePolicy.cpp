@@ -0,0 +1,133 @@
+#include <doctest/doctest.h>
+
+#include <CachePolicy.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace NHttpProxy;
+using namespace std::chrono_literals;
+
+namespace {
+
+THttpHeaders Headers(const std::vector<THttpHeader>& headers) {
+    return THttpHeaders(headers);
+}
+
+const TWallTime Now = ParseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT").value();
+
+THttpRequest Get(std::vector<THttpHeader> headers = {}) {
+    return THttpRequest(THttpRequestLine("GET", "http://a/", "HTTP/1.1"), Headers(headers), "");
+}
+
+TFreshness Freshness(std::vector<THttpHeader> headers, const std::string& status = "200", const THttpRequest& request = Get()) {
+    headers.push_back({"Date", "Sun, 06 Nov 1994 08:49:37 GMT"});
+    THttpResponse response(THttpResponseStatusLine("HTTP/1.1", status, "Whatever"), Headers(headers), "");
+    return ResponseFreshness(request, response, Now);
+}
+
+}
+
+TEST_CASE("HTTP-dates are parsed in all three formats") {
+    auto expected = Now;
+    CHECK(ParseHttpDate("Sunday, 06-Nov-94 08:49:37 GMT") == expected);
+    CHECK(ParseHttpDate("Sun Nov  6 08:49:37 1994") == expected);
+    CHECK(!ParseHttpDate("0").has_value());
+    CHECK(!ParseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT trailing").has_value());
+}
+
+TEST_CASE("The freshness lifetime comes from the most specific source") {
+    SUBCASE("s-maxage wins over max-age and implies revalidation") {
+        auto freshness = Freshness({{"Cache-Control", "max-age=10, s-maxage=20"}});
+        CHECK(freshness.Storable);
+        CHECK(freshness.Lifetime == 20s);
+        CHECK(freshness.MustRevalidate);
+    }
+    SUBCASE("max-age wins over Expires") {
+        auto freshness = Freshness({{"Cache-Control", "max-age=10"}, {"Expires", "Sun, 06 Nov 1994 09:49:37 GMT"}});
+        CHECK(freshness.Lifetime == 10s);
+    }
+    SUBCASE("Expires counts from Date") {
+        auto freshness = Freshness({{"Expires", "Sun, 06 Nov 1994 09:49:37 GMT"}});
+        CHECK(freshness.Storable);
+        CHECK(freshness.Lifetime == 3600s);
+    }
+    SUBCASE("An invalid Expires means expired") {
+        auto freshness = Freshness({{"Expires", "0"}});
+        CHECK(!freshness.Storable);
+    }
+    SUBCASE("Heuristic freshness is a tenth of the time since Last-Modified") {
+        auto freshness = Freshness({{"Last-Modified", "Sun, 06 Nov 1994 07:49:37 GMT"}});
+        CHECK(freshness.Storable);
+        CHECK(freshness.Heuristic);
+        CHECK(freshness.Lifetime == 360s);
+    }
+    SUBCASE("Heuristic freshness is capped") {
+        auto freshness = Freshness({{"Last-Modified", "Sun, 06 Nov 1983 07:49:37 GMT"}});
+        CHECK(freshness.Lifetime == 24h);
+    }
+    SUBCASE("Age is taken off") {
+        auto freshness = Freshness({{"Cache-Control", "max-age=60"}, {"Age", "100"}});
+        CHECK(freshness.Age == 100s);
+        CHECK(!freshness.Storable);
+    }
+}
+
+TEST_CASE("Responses that may not be stored") {
+    CHECK(!Freshness({}).Storable);
+    CHECK(!Freshness({{"Cache-Control", "no-store, max-age=60"}}).Storable);
+    CHECK(!Freshness({{"Cache-Control", "private, max-age=60"}}).Storable);
+    CHECK(!Freshness({{"cache-control", "PRIVATE"}, {"Expires", "Sun, 06 Nov 1994 09:49:37 GMT"}}).Storable);
+    CHECK(!Freshness({{"Cache-Control", "max-age=60"}}, "206").Storable);
+    CHECK(!Freshness({{"Cache-Control", "max-age=60"}}, "500").Storable);
+    // Heuristics apply to some statuses only
+    CHECK(!Freshness({{"Last-Modified", "Sun, 06 Nov 1994 07:49:37 GMT"}}, "302").Storable);
+    CHECK(Freshness({{"Cache-Control", "max-age=60"}}, "302").Storable);
+    CHECK(Freshness({{"Cache-Control", "max-age=60"}}, "404").Storable);
+    CHECK(!Freshness({{"Cache-Control", "max-age=60"}}, "200", Get({{"Cache-Control", "no-store"}})).Storable);
+    CHECK(!Freshness({{"Cache-Control", "max-age=60"}}, "200",
+        THttpRequest(THttpRequestLine("POST", "http://a/", "HTTP/1.1"), THttpHeaders(), "")).Storable);
+}
+
+TEST_CASE("Authorized requests are cached only if the response allows") {
+    auto authorized = Get({{"Authorization", "Basic Zm9vOmJhcg=="}});
+    CHECK(!Freshness({{"Cache-Control", "max-age=60"}}, "200", authorized).Storable);
+    CHECK(Freshness({{"Cache-Control", "public, max-age=60"}}, "200", authorized).Storable);
+    CHECK(Freshness({{"Cache-Control", "s-maxage=60"}}, "200", authorized).Storable);
+}
+
+TEST_CASE("no-cache responses are stored only to be revalidated") {
+    CHECK(!Freshness({{"Cache-Control", "no-cache, max-age=60"}}).Storable);
+    auto freshness = Freshness({{"Cache-Control", "no-cache"}, {"ETag", "\"v1\""}});
+    CHECK(freshness.Storable);
+    CHECK(freshness.Lifetime == 0s);
+    CHECK(freshness.MustRevalidate);
+}
+
+TEST_CASE("Request Cache-Control") {
+    auto control = ParseRequestCacheControl(Headers({{"Cache-Control", "max-age=5, min-fresh=\"10\", max-stale, only-if-cached"}}));
+    CHECK(control.MaxAge == 5s);
+    CHECK(control.MinFresh == 10s);
+    CHECK(control.MaxStale == std::chrono::seconds::max());
+    CHECK(control.OnlyIfCached);
+    CHECK(!control.NoCache);
+
+    CHECK(ParseRequestCacheControl(Headers({{"Pragma", "no-cache"}})).NoCache);
+    CHECK(ParseRequestCacheControl(Headers({{"Cache-Control", "max-stale=30"}})).MaxStale == 30s);
+}
+
+TEST_CASE("Vary makes the request headers part of the key") {
+    auto vary = VaryHeaders(Headers({{"Vary", "Accept-Encoding, User-Agent"}, {"vary", "accept-language"}}));
+    REQUIRE(vary.has_value());
+    CHECK(vary.value() == std::vector<std::string>{"accept-language", "user-agent"});
+    CHECK(!VaryHeaders(Headers({{"Vary", "*"}})).has_value());
+    CHECK(VaryHeaders(THttpHeaders()).value().empty());
+
+    std::vector<std::string> language = {"accept-language"};
+    auto key = CacheKey("http://a/", language, Headers({{"Accept-Language", "en, de"}}));
+    CHECK(key == CacheKey("http://a/", language, Headers({{"accept-language", "en,de"}})));
+    CHECK(key != CacheKey("http://a/", language, Headers({{"Accept-Language", "de"}})));
+    CHECK(key != CacheKey("http://a/", language, THttpHeaders()));
+    CHECK(CacheKey("http://a/", {}, Headers({{"Accept-Language", "de"}})) == "http://a/");
+}
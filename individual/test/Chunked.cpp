@@ -0,0 +1,121 @@
+#include <doctest/doctest.h>
+
+#include <Chunked.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+using namespace NHttpProxy;
+
+namespace {
+
+const std::string Body =
+    "5;name=value\r\n"
+    "hello\r\n"
+    "7 ; quoted=\"a;b\"\r\n"
+    ", world\r\n"
+    "0\r\n"
+    "X-Checksum: abc\r\n"
+    "X-Empty:\r\n"
+    "\r\n";
+
+// Feeds the body in pieces of the given size, returns the last result
+EParseResult FeedBy(TChunkedDecoder& decoder, std::string_view body, std::size_t step, std::string& out) {
+    auto sink = [&out](std::string_view piece) { out += piece; };
+    EParseResult status = EParseResult::Await;
+    while (!body.empty() && status == EParseResult::Await) {
+        std::string_view piece = body.substr(0, step);
+        status = decoder.Consume(piece, sink);
+        body.remove_prefix(std::min(step, body.size()) - piece.size());
+    }
+    return status;
+}
+
+}
+
+TEST_CASE("TChunkedDecoder dechunks a body in pieces of any size") {
+    for (std::size_t step = 1; step <= Body.size(); step++) {
+        TChunkedDecoder decoder;
+        std::string out;
+        REQUIRE(FeedBy(decoder, Body, step, out) == EParseResult::Parsed);
+        CHECK(out == "hello, world");
+        CHECK(decoder.Trailers().Size() == 2);
+        CHECK(decoder.Trailers()["x-checksum"] == "abc");
+        CHECK(decoder.Trailers().Find("X-Empty") != nullptr);
+    }
+}
+
+TEST_CASE("TChunkedDecoder passes the body verbatim and stops at its end") {
+    for (std::size_t step = 1; step <= Body.size(); step++) {
+        TChunkedDecoder decoder(EChunkedMode::Verbatim);
+        std::string out;
+        REQUIRE(FeedBy(decoder, Body, step, out) == EParseResult::Parsed);
+        CHECK(out == Body);
+    }
+
+    TChunkedDecoder decoder(EChunkedMode::Verbatim);
+    std::string out;
+    std::string_view data = "3\r\nabc\r\n0\r\n\r\nHTTP/1.1 200 OK\r\n";
+    REQUIRE(decoder.Consume(data, [&out](std::string_view piece) { out += piece; }) == EParseResult::Parsed);
+    CHECK(out == "3\r\nabc\r\n0\r\n\r\n");
+    CHECK(data == "HTTP/1.1 200 OK\r\n");
+}
+
+TEST_CASE("TChunkedDecoder rejects broken framing") {
+    const std::string broken[] = {
+        "zz\r\nhello\r\n0\r\n\r\n",
+        "\r\n",
+        "5x\r\nhello\r\n0\r\n\r\n",
+        "5\r\nhelloX\r\n0\r\n\r\n",
+        "10000000000000000\r\n",
+        "0\r\nno colon\r\n\r\n",
+        "5;" + std::string(8192, 'x') + "\r\n"
+    };
+    for (const auto& body : broken) {
+        TChunkedDecoder decoder;
+        std::string out;
+        CHECK(FeedBy(decoder, body, body.size(), out) == EParseResult::Error);
+        std::string_view more = "0\r\n\r\n";
+        CHECK(decoder.Consume(more, [](std::string_view) {}) == EParseResult::Error);
+    }
+}
+
+TEST_CASE("TChunkedDecoder limits the trailer section as a whole") {
+    std::string line = "X-Long: " + std::string(8192 - 10, 'x') + "\r\n";
+    std::string within = "0\r\n" + line + "\r\n";
+    std::string filled = "0\r\n" + line;
+    std::string many = "0\r\n";
+    for (std::size_t i = 0; i < 1000; i++) {
+        filled += "X-More: yyyyyyyy\r\n";
+        many += "X-Field-" + std::to_string(i) + ": yyyyyyyy\r\n";
+    }
+    filled += "\r\n";
+    many += "\r\n";
+
+    for (std::size_t step : {std::size_t(1), std::size_t(1000), many.size()}) {
+        TChunkedDecoder decoder;
+        std::string out;
+        CHECK(FeedBy(decoder, within, step, out) == EParseResult::Parsed);
+        CHECK(decoder.Trailers().Size() == 1);
+
+        for (const std::string& body : {filled, many}) {
+            decoder.Reset();
+            CHECK(FeedBy(decoder, body, step, out) == EParseResult::Error);
+            CHECK(decoder.Trailers().Size() < 1000);
+        }
+    }
+}
+
+TEST_CASE("THttpResponseParser fails on a broken chunked body") {
+    std::string_view data =
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "nope\r\n";
+
+    THttpResponseParser parser;
+    REQUIRE(parser.Consume(data) == EParseResult::Head);
+    CHECK(parser.Consume(data) == EParseResult::Error);
+    CHECK(parser.Finish() != EParseResult::Parsed);
+}
@@ -0,0 +1,136 @@
+#include <doctest/doctest.h>
+
+#include <Compress.h>
+#include <CompressionPool.h>
+
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <zlib.h>
+
+using namespace NHttpProxy;
+
+namespace {
+
+std::string Gunzip(const std::string& data) {
+    z_stream stream{};
+    REQUIRE(inflateInit2(&stream, 15 + 16) == Z_OK);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = data.size();
+
+    std::string ret;
+    int status = Z_OK;
+    while (status == Z_OK) {
+        char buffer[4096];
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        status = inflate(&stream, Z_NO_FLUSH);
+        ret.append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    CHECK(status == Z_STREAM_END);
+    return ret;
+}
+
+std::string Body() {
+    std::string body;
+    for (int i = 0; i < 20000; i++) {
+        body += "line " + std::to_string(i * 7919 % 1000) + "\n";
+    }
+    return body;
+}
+
+}
+
+TEST_CASE("gzip stream output written in pieces decompresses to the input") {
+    const std::string body = Body();
+
+    auto stream = TEncoderRegistry::Builtin().Find("gzip")->MakeStream();
+    // The stream is reused for the second body
+    for (int round = 0; round < 2; round++) {
+        std::string out;
+        std::string_view rest = body;
+        while (!rest.empty()) {
+            stream->Write(rest.substr(0, 3000), out);
+            stream->Flush(out);
+            rest.remove_prefix(std::min<std::size_t>(rest.size(), 3000));
+        }
+        stream->Finish(out);
+
+        CHECK(out.size() < body.size() / 2);
+        CHECK(Gunzip(out) == body);
+    }
+}
+
+TEST_CASE("Compress gzips a text response") {
+    THttpHeaders headers(std::vector<THttpHeader>{
+        {"Content-Type", "text/plain"},
+        {"Content-Length", "0"}
+    });
+    THttpResponse response(THttpResponseStatusLine("HTTP/1.1", "200", "OK"), headers, Body());
+    response.UpdateContentLength();
+
+    TCompressionOptions options;
+    REQUIRE(Compressible(response, options));
+    Compress(response, *TEncoderRegistry::Builtin().Find("gzip"));
+
+    CHECK(response.Headers().Find("Content-Encoding")->Value() == "gzip");
+    CHECK(response.Headers().Find("Vary")->Value() == "Accept-Encoding");
+    CHECK(response.Headers().Find("Content-Length")->Value() == std::to_string(response.Data().size()));
+    CHECK(Gunzip(response.Data()) == Body());
+    CHECK_FALSE(Compressible(response, options));
+}
+
+TEST_CASE("ParseAcceptEncoding reads q-values") {
+    auto accepted = ParseAcceptEncoding("GZIP;q=0.5, br ;Q=0.8,identity;q=0, *;q=0.1, deflate");
+    REQUIRE(accepted.size() == 5);
+    CHECK(accepted[0].Name == "gzip");
+    CHECK(AcceptQuality(accepted, "gzip") == doctest::Approx(0.5));
+    CHECK(AcceptQuality(accepted, "br") == doctest::Approx(0.8));
+    CHECK(AcceptQuality(accepted, "deflate") == doctest::Approx(1));
+    CHECK(AcceptQuality(accepted, "zstd") == doctest::Approx(0.1));
+    CHECK(AcceptQuality(accepted, "identity") == 0);
+
+    auto plain = ParseAcceptEncoding("gzip");
+    CHECK(AcceptQuality(plain, "br") == 0);
+    CHECK(AcceptQuality(plain, "identity") == 1);
+}
+
+TEST_CASE("TEncoderRegistry chooses by quality, then by cost") {
+    auto dummy = []() -> std::unique_ptr<TEncoderStream> { return nullptr; };
+    TEncoderRegistry registry;
+    registry.Register({"slow", 2, 0.5, dummy});
+    registry.Register({"fast", 0.5, 1, dummy});
+
+    CHECK(registry.Choose("slow, fast", 1)->Name == "fast");
+    CHECK(registry.Choose("slow, fast", 0)->Name == "slow");
+    CHECK(registry.Choose("slow, fast;q=0.9", 1)->Name == "slow");
+    CHECK(registry.Choose("fast;q=0", 1) == nullptr);
+    CHECK(registry.Choose("fast;q=0.5", 1)->Name == "fast");
+    CHECK(registry.Choose("fast;q=0.5, identity", 1) == nullptr);
+    CHECK(registry.Choose("*", 1)->Name == "fast");
+}
+
+TEST_CASE("TCompressionPool passes nothing to the callback when the encoder fails") {
+    class TFailingStream : public TEncoderStream {
+    public:
+        void Write(std::string_view, std::string&) override {
+            throw std::runtime_error("broken");
+        }
+        void Flush(std::string&) override {}
+        void Finish(std::string&) override {}
+    };
+    TEncoder failing{"gzip", 1, 1, []() -> std::unique_ptr<TEncoderStream> { return std::make_unique<TFailingStream>(); }};
+
+    TCompressionPool pool(TCompressionPoolOptions{});
+    THttpHeaders headers(std::vector<THttpHeader>{{"Content-Type", "text/plain"}});
+    THttpResponse response(THttpResponseStatusLine("HTTP/1.1", "200", "OK"), headers, std::string(4096, 'a'));
+    std::promise<bool> compressed;
+    REQUIRE(pool.Submit(std::move(response), failing, [&compressed](std::optional<THttpResponse> result) {
+        compressed.set_value(result.has_value());
+    }));
+    CHECK_FALSE(compressed.get_future().get());
+    CHECK(pool.Failures() == 1);
+}
@@ -0,0 +1,75 @@
+#include <doctest/doctest.h>
+
+#include <ConnectionPool.h>
+
+#include <chrono>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+using namespace NHttpProxy;
+
+namespace {
+
+using boost::asio::ip::tcp;
+
+// Both ends of a local connection
+struct TConnection {
+    tcp::socket Client;
+    tcp::socket Server;
+};
+
+TConnection Connect(boost::asio::io_context& context, tcp::acceptor& acceptor) {
+    tcp::socket client(context);
+    client.connect(acceptor.local_endpoint());
+    tcp::socket server(context);
+    acceptor.accept(server);
+    return TConnection{std::move(client), std::move(server)};
+}
+
+}
+
+TEST_CASE("The most recent connection to the host is borrowed") {
+    boost::asio::io_context context;
+    tcp::acceptor acceptor(context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+    TConnectionPool pool(TConnectionPoolOptions{});
+
+    auto first = Connect(context, acceptor);
+    auto second = Connect(context, acceptor);
+    auto other = Connect(context, acceptor);
+    auto port = second.Client.local_endpoint().port();
+    pool.Return("a", "80", std::move(first.Client));
+    pool.Return("a", "80", std::move(second.Client));
+    pool.Return("b", "80", std::move(other.Client));
+
+    auto borrowed = pool.Borrow("a", "80");
+    REQUIRE(borrowed.has_value());
+    CHECK(borrowed->local_endpoint().port() == port);
+    CHECK(pool.Borrow("a", "80").has_value());
+    CHECK(!pool.Borrow("a", "80").has_value());
+    CHECK(pool.Borrow("b", "80").has_value());
+}
+
+TEST_CASE("The sweep closes the connections closed by the server or idle for too long") {
+    boost::asio::io_context context;
+    tcp::acceptor acceptor(context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+    TConnectionPoolOptions options;
+    options.IdleTimeout = std::chrono::seconds(0);
+
+    TConnectionPool closing(TConnectionPoolOptions{});
+    auto closed = Connect(context, acceptor);
+    auto open = Connect(context, acceptor);
+    closing.Return("a", "80", std::move(closed.Client));
+    closing.Return("b", "80", std::move(open.Client));
+    closed.Server.close();
+    closing.Sweep();
+    CHECK(!closing.Borrow("a", "80").has_value());
+    CHECK(closing.Borrow("b", "80").has_value());
+
+    TConnectionPool expiring(options);
+    auto idle = Connect(context, acceptor);
+    expiring.Return("a", "80", std::move(idle.Client));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    expiring.Sweep();
+    CHECK(!expiring.Borrow("a", "80").has_value());
+}
@@ -0,0 +1,307 @@
+#include <doctest/doctest.h>
+
+#include <Database.h>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace NHttpProxy;
+
+namespace {
+
+struct TTempDirectory {
+    TTempDirectory()
+        : Path(std::filesystem::temp_directory_path() / ("proxy-database-" + std::to_string(getpid())))
+    {
+        std::filesystem::remove_all(Path);
+    }
+
+    ~TTempDirectory() {
+        std::filesystem::remove_all(Path);
+    }
+
+    std::filesystem::path Path;
+};
+
+THttpHeaders Headers(const std::vector<THttpHeader>& headers) {
+    return THttpHeaders(headers);
+}
+
+THttpRequest Request(const std::string& url) {
+    return THttpRequest(THttpRequestLine("GET", url, "HTTP/1.1"), THttpHeaders(), "");
+}
+
+THttpResponse Response(const std::string& cacheControl, const std::string& body) {
+    THttpHeaders headers(std::vector<THttpHeader>{
+        {"Cache-Control", cacheControl},
+        {"ETag", "\"v1\""}
+    });
+    THttpResponse response(THttpResponseStatusLine("HTTP/1.1", "200", "OK"), headers, body);
+    response.UpdateContentLength();
+    return response;
+}
+
+THttpResponse NotModified(const std::string& etag) {
+    THttpHeaders headers(std::vector<THttpHeader>{
+        {"Cache-Control", "max-age=60"},
+        {"ETag", etag}
+    });
+    return THttpResponse(THttpResponseStatusLine("HTTP/1.1", "304", "Not Modified"), headers, "");
+}
+
+}
+
+TEST_CASE("An expired entry is revalidated and refreshed by a 304") {
+    TDatabase database;
+    database.CacheResponse(Request("http://a/"), Response("max-age=1", "body"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+
+    auto hit = database.ServeCached(Request("http://a/"));
+    REQUIRE(hit.has_value());
+    CHECK(hit.value().Stale);
+    CHECK(hit.value().Response->Body == "body");
+
+    CHECK(database.Refresh(Request("http://a/"), NotModified("\"v2\"")) == nullptr);
+    auto refreshed = database.Refresh(Request("http://a/"), NotModified("\"v1\""));
+    REQUIRE(refreshed != nullptr);
+    CHECK(refreshed->Head.Headers()["Cache-Control"] == "max-age=60");
+    CHECK(refreshed->Body == "body");
+
+    hit = database.ServeCached(Request("http://a/"));
+    REQUIRE(hit.has_value());
+    CHECK(!hit.value().Stale);
+    CHECK(database.Stats().Refreshes == 1);
+}
+
+TEST_CASE("Within stale-while-revalidate one hit revalidates in background") {
+    TDatabase database;
+    database.CacheResponse(Request("http://a/"), Response("max-age=1, stale-while-revalidate=60", "body"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+
+    auto first = database.ServeCached(Request("http://a/"));
+    auto second = database.ServeCached(Request("http://a/"));
+    REQUIRE(first.has_value());
+    REQUIRE(second.has_value());
+    CHECK(!first.value().Stale);
+    CHECK(first.value().Revalidate);
+    CHECK(!second.value().Revalidate);
+
+    database.AbortRevalidation(Request("http://a/"));
+    CHECK(database.ServeCached(Request("http://a/")).value().Revalidate);
+    CHECK(database.Stats().StaleHits == 3);
+}
+
+TEST_CASE("Responses varying on a request header are cached per its value") {
+    TDatabase database;
+    auto request = [](const std::string& language) {
+        return THttpRequest(
+            THttpRequestLine("GET", "http://a/", "HTTP/1.1"),
+            Headers({{"Accept-Language", language}}),
+            ""
+        );
+    };
+    auto response = [](const std::string& body) {
+        auto ret = Response("max-age=60", body);
+        ret.Headers().Append({"Vary", "Accept-Language, Accept-Encoding"});
+        return ret;
+    };
+    database.CacheResponse(request("en"), response("hello"));
+    database.CacheResponse(request("de"), response("hallo"));
+
+    CHECK(database.ServeCached(request("en")).value().Response->Body == "hello");
+    CHECK(database.ServeCached(request("de")).value().Response->Body == "hallo");
+    CHECK(!database.ServeCached(request("fr")).has_value());
+    CHECK(database.Stats().Entries == 2);
+}
+
+TEST_CASE("A refused response leaves the variants cached before it") {
+    TDatabaseOptions options;
+    options.Shards = 1;
+    options.MaxBytes = 1000;
+    TDatabase database(options);
+    auto request = [](const std::string& language) {
+        return THttpRequest(
+            THttpRequestLine("GET", "http://a/", "HTTP/1.1"),
+            Headers({{"Accept-Language", language}, {"User-Agent", "test"}}),
+            ""
+        );
+    };
+    auto response = [](const std::string& vary, const std::string& body) {
+        auto ret = Response("max-age=60", body);
+        ret.Headers().Append({"Vary", vary});
+        return ret;
+    };
+    database.CacheResponse(request("en"), response("Accept-Language", "hello"));
+    database.CacheResponse(request("de"), response("User-Agent", std::string(1000, 'x')));
+
+    CHECK(database.ServeCached(request("en")).value().Response->Body == "hello");
+    CHECK(!database.ServeCached(request("de")).has_value());
+    CHECK(database.Stats().Entries == 1);
+}
+
+TEST_CASE("Responses varying on a request header are found on disk after a restart") {
+    TTempDirectory directory;
+    TDatabaseOptions options;
+    options.Disk.Directory = directory.Path.string();
+    auto request = [](const std::string& language) {
+        return THttpRequest(
+            THttpRequestLine("GET", "http://a/", "HTTP/1.1"),
+            Headers({{"Accept-Language", language}}),
+            ""
+        );
+    };
+    auto response = [](const std::string& body) {
+        auto ret = Response("max-age=60", body);
+        ret.Headers().Append({"Vary", "Accept-Language"});
+        return ret;
+    };
+    {
+        TDatabase database(options);
+        database.CacheResponse(request("en"), response("hello"));
+        database.CacheResponse(request("de"), response("hallo"));
+    }
+
+    TDatabase database(options);
+    CHECK(database.ServeCached(request("de")).value().Response->Body == "hallo");
+    CHECK(database.ServeCached(request("en")).value().Response->Body == "hello");
+    CHECK(!database.ServeCached(request("fr")).has_value());
+    CHECK(database.Stats().DiskHits == 2);
+    CHECK(database.Stats().Entries == 2);
+}
+
+TEST_CASE("Request directives bear on what is served") {
+    TDatabase database;
+    database.CacheResponse(Request("http://a/"), Response("max-age=60", "body"));
+
+    auto withControl = [](const std::string& value) {
+        return THttpRequest(THttpRequestLine("GET", "http://a/", "HTTP/1.1"), Headers({{"Cache-Control", value}}), "");
+    };
+    CHECK(!database.ServeCached(withControl("min-fresh=30")).value().Stale);
+    CHECK(database.ServeCached(withControl("min-fresh=120")).value().Stale);
+    CHECK(database.ServeCached(withControl("no-cache")).value().Stale);
+    CHECK(!database.ServeCached(THttpRequest(THttpRequestLine("POST", "http://a/", "HTTP/1.1"), THttpHeaders(), "")).has_value());
+}
+
+TEST_CASE("Request directives bear on a disk hit too large to be kept in memory") {
+    TTempDirectory directory;
+    TDatabaseOptions options;
+    options.Disk.Directory = directory.Path.string();
+    {
+        TDatabase database(options);
+        database.CacheResponse(Request("http://a/"), Response("max-age=60", std::string(1000, 'x')));
+    }
+
+    options.MaxBytes = 100;
+    options.Shards = 1;
+    TDatabase database(options);
+    auto withControl = [](const std::string& value) {
+        return THttpRequest(THttpRequestLine("GET", "http://a/", "HTTP/1.1"), Headers({{"Cache-Control", value}}), "");
+    };
+    auto hit = database.ServeCached(Request("http://a/"));
+    REQUIRE(hit.has_value());
+    CHECK(!hit.value().Stale);
+    CHECK(hit.value().Response->Body.size() == 1000);
+    CHECK(database.ServeCached(withControl("no-cache")).value().Stale);
+    CHECK(database.ServeCached(withControl("min-fresh=120")).value().Stale);
+    CHECK(!database.ServeCached(withControl("max-age=30")).value().Stale);
+    CHECK(database.Stats().Entries == 0);
+    CHECK(database.Stats().DiskHits == 4);
+}
+
+TEST_CASE("The least recently used entries are evicted to stay within the budget") {
+    std::size_t size = 0;
+    {
+        TDatabase database;
+        database.CacheResponse(Request("http://a/"), Response("max-age=60", "body"));
+        size = database.Stats().Bytes;
+    }
+    TDatabaseOptions options;
+    options.Shards = 1;
+    options.MaxBytes = 3 * size + size / 2;
+    TDatabase database(options);
+    database.CacheResponse(Request("http://a/"), Response("max-age=60", "body"));
+    database.CacheResponse(Request("http://b/"), Response("max-age=60", "body"));
+    database.CacheResponse(Request("http://c/"), Response("max-age=60", "body"));
+    CHECK(database.ServeCached(Request("http://a/")).has_value());
+
+    database.CacheResponse(Request("http://d/"), Response("max-age=60", "body"));
+    CHECK(!database.ServeCached(Request("http://b/")).has_value());
+    CHECK(database.ServeCached(Request("http://a/")).has_value());
+    CHECK(database.ServeCached(Request("http://c/")).has_value());
+    CHECK(database.ServeCached(Request("http://d/")).has_value());
+    CHECK(database.Stats().Evictions == 1);
+    CHECK(database.Stats().Entries == 3);
+    CHECK(database.Stats().Bytes == 3 * size);
+}
+
+TEST_CASE("A response larger than a shard is not cached and evicts nothing") {
+    TDatabaseOptions options;
+    options.Shards = 1;
+    options.MaxBytes = 1000;
+    TDatabase database(options);
+    database.CacheResponse(Request("http://a/"), Response("max-age=60", "body"));
+    auto bytes = database.Stats().Bytes;
+
+    database.CacheResponse(Request("http://b/"), Response("max-age=60", std::string(1000, 'x')));
+    CHECK(!database.ServeCached(Request("http://b/")).has_value());
+    CHECK(database.ServeCached(Request("http://a/")).has_value());
+    CHECK(database.Stats().Evictions == 0);
+    CHECK(database.Stats().Entries == 1);
+    CHECK(database.Stats().Bytes == bytes);
+}
+
+TEST_CASE("A sweep drops the entries that are not to be revalidated anymore") {
+    TDatabaseOptions options;
+    options.MaxStale = std::chrono::seconds(0);
+    TDatabase database(options);
+    database.CacheResponse(Request("http://a/"), Response("max-age=1", "body"));
+    database.CacheResponse(Request("http://b/"), Response("max-age=60", "body"));
+    database.Sweep();
+    CHECK(database.Stats().Entries == 2);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    database.Sweep();
+    CHECK(database.Stats().Entries == 1);
+    CHECK(database.Stats().Expirations == 1);
+    CHECK(!database.ServeCached(Request("http://a/")).has_value());
+    CHECK(database.ServeCached(Request("http://b/")).has_value());
+}
+
+TEST_CASE("Variants are counted in the size of their entry") {
+    TDatabaseOptions options;
+    options.Shards = 1;
+    options.MaxBytes = 1000;
+    TDatabase database(options);
+    database.CacheResponse(Request("http://a/"), Response("max-age=60", "body"));
+    database.CacheResponse(Request("http://b/"), Response("max-age=60", "body"));
+    auto bytes = database.Stats().Bytes;
+
+    // The identity response served as is takes no more room
+    auto hit = database.ServeCached(Request("http://b/"), "br");
+    REQUIRE(hit.value().BuildVariant);
+    database.AddVariant(hit.value().Key, hit.value().Response, "br", hit.value().Response);
+    CHECK(database.Stats().Bytes == bytes);
+
+    hit = database.ServeCached(Request("http://b/"), "gzip");
+    REQUIRE(hit.value().BuildVariant);
+    auto gzip = Response("max-age=60", "compressed");
+    gzip.Headers().Append({"Content-Encoding", "gzip"});
+    auto variant = MakeCachedResponse(std::move(gzip));
+    database.AddVariant(hit.value().Key, hit.value().Response, "gzip", variant);
+    auto variantSize = hit.value().Key.size() + 2 * variant->SerializedHead.size() + variant->Body.size();
+    CHECK(database.Stats().Bytes == bytes + variantSize);
+    CHECK(database.ServeCached(Request("http://b/"), "gzip").value().Response == variant);
+
+    // A variant too large for the budget evicts the other entries first
+    hit = database.ServeCached(Request("http://b/"), "deflate");
+    REQUIRE(hit.value().BuildVariant);
+    auto deflate = Response("max-age=60", std::string(1000 - database.Stats().Bytes, 'x'));
+    database.AddVariant(hit.value().Key, hit.value().Response, "deflate", MakeCachedResponse(std::move(deflate)));
+    CHECK(!database.ServeCached(Request("http://a/")).has_value());
+    CHECK(database.Stats().Evictions >= 1);
+    CHECK(database.Stats().Bytes <= 1000);
+}
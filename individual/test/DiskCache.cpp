@@ -0,0 +1,109 @@
+#include <doctest/doctest.h>
+
+#include <DiskCache.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <unistd.h>
+
+using namespace NHttpProxy;
+
+namespace {
+
+struct TTempDirectory {
+    TTempDirectory()
+        : Path(std::filesystem::temp_directory_path() / ("proxy-disk-cache-" + std::to_string(getpid())))
+    {
+        std::filesystem::remove_all(Path);
+    }
+
+    ~TTempDirectory() {
+        std::filesystem::remove_all(Path);
+    }
+
+    std::filesystem::path Path;
+};
+
+std::shared_ptr<const TCachedResponse> Response(const std::string& body) {
+    THttpHeaders headers(std::vector<THttpHeader>{
+        {"Content-Type", "text/plain"},
+        {"Cache-Control", "max-age=60"}
+    });
+    THttpResponse response(THttpResponseStatusLine("HTTP/1.1", "200", "OK"), headers, body);
+    response.UpdateContentLength();
+    return MakeCachedResponse(std::move(response));
+}
+
+}
+
+TEST_CASE("TDiskCache serves the responses stored before a restart") {
+    TTempDirectory directory;
+    TDiskCacheOptions options;
+    options.Directory = directory.Path.string();
+    auto now = std::chrono::system_clock::now();
+
+    {
+        TDiskCache cache(options);
+        cache.Store("http://a/", Response("first"), now + std::chrono::hours(1));
+        cache.Store("http://b/", Response("expired"), now - std::chrono::seconds(1));
+        cache.Store("http://a/", Response("second"), now + std::chrono::hours(1));
+        cache.Flush();
+
+        TDiskCache::TWallTime expire;
+        auto loaded = cache.Load("http://a/", expire);
+        REQUIRE(loaded);
+        CHECK(loaded->Body == "second");
+    }
+
+    // A torn record at the end is dropped
+    for (const auto& file : std::filesystem::directory_iterator(directory.Path)) {
+        std::ofstream(file.path(), std::ios::app) << "garbage";
+    }
+
+    TDiskCache cache(options);
+    CHECK(cache.Entries() == 1);
+
+    TDiskCache::TWallTime expire;
+    auto loaded = cache.Load("http://a/", expire);
+    REQUIRE(loaded);
+    CHECK(loaded->Body == "second");
+    CHECK(loaded->Head.ResponseStatusLine().StatusCode() == "200");
+    CHECK(loaded->Head.Headers().Find("Content-Length")->Value() == "6");
+    CHECK(std::chrono::abs(expire - (now + std::chrono::hours(1))) < std::chrono::seconds(2));
+    CHECK_FALSE(cache.Load("http://b/", expire));
+    CHECK_FALSE(cache.Load("http://c/", expire));
+
+    // Appends go after the last whole record
+    cache.Store("http://c/", Response("third"), now + std::chrono::hours(1));
+    cache.Flush();
+    auto third = cache.Load("http://c/", expire);
+    REQUIRE(third);
+    CHECK(third->Body == "third");
+}
+
+TEST_CASE("TDiskCache stops writing once a segment can't be opened") {
+    TTempDirectory directory;
+    TDiskCacheOptions options;
+    options.Directory = directory.Path.string();
+    options.SegmentSize = 1;
+    auto now = std::chrono::system_clock::now();
+
+    TDiskCache cache(options);
+    cache.Store("http://a/", Response("first"), now + std::chrono::hours(1));
+    cache.Flush();
+    // The next record needs a new segment
+    std::filesystem::remove_all(directory.Path);
+    cache.Store("http://b/", Response("second"), now + std::chrono::hours(1));
+    cache.Flush();
+    CHECK(cache.Failures() == 1);
+
+    cache.Store("http://c/", Response("third"), now + std::chrono::hours(1));
+    cache.Flush();
+    CHECK(cache.Failures() == 1);
+    TDiskCache::TWallTime expire;
+    CHECK_FALSE(cache.Load("http://c/", expire));
+    CHECK(cache.Entries() == 1);
+}
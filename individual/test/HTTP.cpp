@@ -0,0 +1,270 @@
+#include <doctest/doctest.h>
+
+#include <HTTP.h>
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+using namespace NHttpProxy;
+
+namespace {
+
+// Feeds the message in pieces of the given size
+template<typename TParser>
+EParseResult FeedBy(TParser& parser, std::string_view message, std::size_t step) {
+    EParseResult status = EParseResult::Await;
+    while (!message.empty() && status != EParseResult::Parsed && status != EParseResult::Error) {
+        std::string_view piece = message.substr(0, step);
+        status = parser.Consume(piece);
+        message.remove_prefix(std::min(step, message.size()) - piece.size());
+    }
+    return status;
+}
+
+}
+
+TEST_CASE("THttpRequestParser parses a request in pieces of any size") {
+    const std::string message =
+        "POST http://example.com/form HTTP/1.1\r\n"
+        "Host: example.com\r\n"
+        "Content-Length:  5 \r\n"
+        "\r\n"
+        "hello";
+
+    for (std::size_t step = 1; step <= message.size(); step++) {
+        THttpRequestParser parser;
+        REQUIRE(FeedBy(parser, message, step) == EParseResult::Parsed);
+
+        auto request = parser.TakeParsed();
+        CHECK(request.RequestLine().Method() == "POST");
+        CHECK(request.RequestLine().URL() == "http://example.com/form");
+        CHECK(request.RequestLine().HttpVersion() == "HTTP/1.1");
+        CHECK(request.Headers().Size() == 2);
+        CHECK(request.Headers()["Host"] == "example.com");
+        CHECK(request.Headers()["Content-Length"] == "5");
+        CHECK(request.Data() == "hello");
+    }
+}
+
+TEST_CASE("THttpRequestParser leaves the next pipelined request untouched") {
+    std::string_view data =
+        "GET http://example.com/a HTTP/1.1\r\n"
+        "\r\n"
+        "GET http://example.com/b HTTP/1.1\r\n"
+        "\r\n";
+
+    THttpRequestParser parser;
+    REQUIRE(parser.Consume(data) == EParseResult::Parsed);
+    CHECK(parser.TakeParsed().RequestLine().URL() == "http://example.com/a");
+    CHECK(data.substr(0, 5) == "GET h");
+
+    parser.Reset();
+    REQUIRE(parser.Consume(data) == EParseResult::Parsed);
+    CHECK(parser.TakeParsed().RequestLine().URL() == "http://example.com/b");
+    CHECK(data.empty());
+}
+
+TEST_CASE("THttpRequestParser streams a chunked body as it is") {
+    const std::string body =
+        "5;ext=1\r\n"
+        "hello\r\n"
+        "0\r\n"
+        "\r\n";
+    const std::string message =
+        "POST http://example.com/upload HTTP/1.1\r\n"
+        "transfer-encoding: chunked\r\n"
+        "\r\n" + body +
+        "GET http://example.com/next HTTP/1.1\r\n"
+        "\r\n";
+    std::string_view data = message;
+
+    THttpRequestParser parser;
+    REQUIRE(parser.Consume(data) == EParseResult::Head);
+    CHECK(parser.TakeParsed().Headers()["Transfer-Encoding"] == "chunked");
+
+    std::string streamed;
+    parser.StreamBody([&streamed](std::string_view piece) { streamed += piece; });
+    REQUIRE(parser.Consume(data) == EParseResult::Parsed);
+    CHECK(streamed == body);
+    CHECK(data.substr(0, 5) == "GET h");
+}
+
+TEST_CASE("THttpRequestParser keeps a chunked body it doesn't stream decoded") {
+    const std::string message =
+        "PUT http://example.com/a HTTP/1.1\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n";
+
+    for (std::size_t step = 1; step <= message.size(); step++) {
+        THttpRequestParser parser;
+        REQUIRE(FeedBy(parser, message, step) == EParseResult::Parsed);
+        auto request = parser.TakeParsed();
+        CHECK(request.Data() == "abcde");
+        CHECK(request.Headers()["Content-Length"] == "5");
+        CHECK(request.Headers().Find(EHeader::TransferEncoding) == nullptr);
+    }
+}
+
+TEST_CASE("THttpRequestParser rejects an endless head and a malformed request line") {
+    std::string endless = "GET http://example.com/ HTTP/1.1\r\n";
+    while (endless.size() <= (64 << 10)) {
+        endless += "X-Filler: 0123456789012345678901234567890123456789\r\n";
+    }
+    for (std::size_t step : {std::size_t(1), std::size_t(1000), endless.size()}) {
+        THttpRequestParser parser;
+        CHECK(FeedBy(parser, endless, step) == EParseResult::Error);
+    }
+    THttpRequestParser noLineBreak;
+    CHECK(FeedBy(noLineBreak, std::string(100 << 10, 'G'), 4096) == EParseResult::Error);
+
+    for (std::string line : {"GARBAGE", "GET /", "GET / HTTP/1.1 extra", "GET  HTTP/1.1"}) {
+        THttpRequestParser parser;
+        std::string message = line + "\r\nHost: a\r\n\r\n";
+        CHECK(FeedBy(parser, message, message.size()) == EParseResult::Error);
+    }
+}
+
+TEST_CASE("THttpResponseParser rejects a malformed status line") {
+    for (std::string line : {"HTTP/1.1 OK", "HTTP/1.1 2000 OK", "SIP/2.0 200 OK"}) {
+        THttpResponseParser parser;
+        std::string message = line + "\r\nContent-Length: 0\r\n\r\n";
+        CHECK(FeedBy(parser, message, message.size()) == EParseResult::Error);
+    }
+    THttpResponseParser parser;
+    std::string message = "HTTP/1.1 204\r\n\r\n";
+    CHECK(FeedBy(parser, message, message.size()) == EParseResult::Parsed);
+}
+
+TEST_CASE("A request copied onto a resource lives there") {
+    std::string_view data =
+        "GET http://example.com/a HTTP/1.1\r\n"
+        "Host: example.com\r\n"
+        "Accept: text/html, application/xhtml+xml\r\n"
+        "\r\n";
+    THttpRequestParser parser;
+    REQUIRE(parser.Consume(data) == EParseResult::Parsed);
+    const THttpRequest request = parser.TakeParsed();
+
+    // Nothing but the buffer to allocate from
+    std::array<std::byte, 1024> buffer;
+    std::pmr::monotonic_buffer_resource resource(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+    THttpRequest copy(request, &resource);
+
+    auto inBuffer = [&buffer](std::string_view s) {
+        return reinterpret_cast<const std::byte*>(s.data()) >= buffer.data()
+            && reinterpret_cast<const std::byte*>(s.data()) < buffer.data() + buffer.size();
+    };
+    CHECK(inBuffer(copy.RequestLine().URL()));
+    CHECK(inBuffer(copy.Headers()["Accept"]));
+    CHECK(copy.Serialize() == request.Serialize());
+}
+
+TEST_CASE("THttpResponseParser decodes a chunked body") {
+    const std::string message =
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "5;name=value\r\n"
+        "hello\r\n"
+        "7\r\n"
+        ", world\r\n"
+        "0\r\n"
+        "X-Trailer: yes\r\n"
+        "\r\n";
+
+    for (std::size_t step = 1; step <= message.size(); step++) {
+        THttpResponseParser parser;
+        REQUIRE(FeedBy(parser, message, step) == EParseResult::Parsed);
+
+        auto response = parser.TakeParsed();
+        CHECK(response.ResponseStatusLine().StatusCode() == "200");
+        CHECK(response.ResponseStatusLine().Reason() == "OK");
+        CHECK(response.Data() == "hello, world");
+        CHECK(response.Headers()["Content-Length"] == "12");
+        CHECK(response.Headers().Find("Transfer-Encoding") == nullptr);
+    }
+}
+
+TEST_CASE("THttpResponseParser keeps spaces in the reason phrase") {
+    std::string_view data =
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n";
+
+    THttpResponseParser parser;
+    REQUIRE(parser.Consume(data) == EParseResult::Parsed);
+    CHECK(parser.TakeParsed().ResponseStatusLine().Reason() == "Not Found");
+}
+
+TEST_CASE("THttpResponseParser streams the body after the head") {
+    std::string_view data =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length: 5\r\n"
+        "\r\n"
+        "hello";
+
+    THttpResponseParser parser;
+    REQUIRE(parser.Consume(data) == EParseResult::Head);
+    CHECK(parser.Head().Headers()["Content-Length"] == "5");
+    CHECK(data == "hello");
+
+    std::string body;
+    parser.StreamBody([&body](std::string_view piece) { body += piece; });
+    REQUIRE(parser.Consume(data) == EParseResult::Parsed);
+    CHECK(body == "hello");
+    CHECK(parser.TakeParsed().Data().empty());
+}
+
+TEST_CASE("THttpHeaders looks names up whatever their case") {
+    THttpHeaders headers;
+    headers.Append({"content-type", "text/plain"});
+    headers.Append({"X-Custom", "a"});
+    headers.Append({"x-custom", "b"});
+
+    CHECK(HeaderId("CONTENT-TYPE") == EHeader::ContentType);
+    CHECK(HeaderId("X-Custom") == EHeader::Unknown);
+    CHECK(headers.Find(EHeader::ContentType)->Key() == "content-type");
+    CHECK(headers["Content-Type"] == "text/plain");
+    CHECK(headers["X-CUSTOM"] == "a");
+    CHECK(headers["Missing"].empty());
+
+    headers.Update({"X-Custom", "c"});
+    CHECK(headers.Size() == 3);
+    CHECK(headers[2].Value() == "c");
+
+    headers.Remove("X-CUSTOM");
+    headers.Update({EHeader::ContentLength, "5"});
+    CHECK(headers.Serialize() == "content-type: text/plain\r\nContent-Length: 5\r\n");
+}
+
+TEST_CASE("THttpResponse serializes into buffers over its own storage") {
+    THttpHeaders headers;
+    headers.Append({"Content-Type", "text/plain"});
+    headers.Append({"Content-Length", "5"});
+    THttpResponse response(THttpResponseStatusLine("HTTP/1.1", "200", "OK"), headers, "hello");
+
+    TBuffers buffers;
+    response.Serialize(buffers);
+    std::string joined;
+    for (const auto& buffer : buffers) {
+        joined.append(static_cast<const char*>(buffer.data()), buffer.size());
+    }
+    CHECK(joined == "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 5\r\n\r\nhello");
+    CHECK(joined == response.Serialize());
+    CHECK(buffers.back().data() == response.Data().data());
+}
+
+TEST_CASE("IsInterim takes 1xx but 101 as interim") {
+    auto head = [](const std::string& code) {
+        return THttpResponse(THttpResponseStatusLine("HTTP/1.1", code, "Reason"), THttpHeaders(), "");
+    };
+    CHECK(IsInterim(head("100")));
+    CHECK(IsInterim(head("103")));
+    CHECK_FALSE(IsInterim(head("101")));
+    CHECK_FALSE(IsInterim(head("200")));
+    CHECK_FALSE(IsInterim(head("1")));
+}
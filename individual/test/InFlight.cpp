@@ -0,0 +1,88 @@
+#include <doctest/doctest.h>
+
+#include <InFlight.h>
+
+#include <string>
+
+using namespace NHttpProxy;
+
+namespace {
+
+THttpResponse Head() {
+    THttpHeaders headers(std::vector<THttpHeader>{{"Content-Length", "6"}});
+    return THttpResponse(THttpResponseStatusLine("HTTP/1.1", "200", "OK"), headers, "");
+}
+
+std::string Join(const TInFlight::TUpdate& update) {
+    std::string body;
+    for (const auto& piece : update.Pieces) {
+        body += *piece;
+    }
+    return body;
+}
+
+}
+
+TEST_CASE("A fetch is led by the first session asking for the URL") {
+    TInFlightTable table;
+    auto [first, leader] = table.Join("http://a/");
+    CHECK(leader);
+    auto [second, waiter] = table.Join("http://a/");
+    CHECK(!waiter);
+    CHECK(first == second);
+    CHECK(table.Coalesced() == 1);
+
+    table.Remove("http://a/", first);
+    CHECK(table.Join("http://a/").second);
+}
+
+TEST_CASE("A waiter gets the body from the start and is woken on news") {
+    TInFlight flight;
+    TInFlight::TCursor cursor;
+    int wakes = 0;
+    CHECK(!flight.Poll(cursor, [&]() { wakes++; }).has_value());
+
+    flight.SetHead(THttpHeaders(), Head());
+    flight.Append("abc");
+    CHECK(wakes == 1);
+
+    auto update = flight.Poll(cursor, [&]() { wakes++; });
+    REQUIRE(update.has_value());
+    CHECK(update.value().Head.has_value());
+    CHECK(Join(update.value()) == "abc");
+    CHECK(!update.value().Finished);
+
+    CHECK(!flight.Poll(cursor, [&]() { wakes++; }).has_value());
+    flight.Append("def");
+    flight.Finish();
+    CHECK(wakes == 2);
+
+    update = flight.Poll(cursor, [&]() { wakes++; });
+    REQUIRE(update.has_value());
+    CHECK(!update.value().Head.has_value());
+    CHECK(Join(update.value()) == "def");
+    CHECK(update.value().Finished);
+
+    // A late waiter still sees it all
+    TInFlight::TCursor late;
+    update = flight.Poll(late, [&]() { wakes++; });
+    REQUIRE(update.has_value());
+    CHECK(Join(update.value()) == "abcdef");
+    CHECK(update.value().Finished);
+}
+
+TEST_CASE("An abandoned fetch tells the waiters to go on their own") {
+    TInFlight flight;
+    TInFlight::TCursor cursor;
+    bool woken = false;
+    CHECK(!flight.Poll(cursor, [&]() { woken = true; }).has_value());
+    flight.Abandon();
+    CHECK(woken);
+    auto update = flight.Poll(cursor, [&]() {});
+    REQUIRE(update.has_value());
+    CHECK(update.value().Abandoned);
+
+    // Nothing is published after that
+    flight.SetHead(THttpHeaders(), Head());
+    CHECK(flight.Poll(cursor, [&]() {}).value().Abandoned);
+}
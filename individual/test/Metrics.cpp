@@ -0,0 +1,59 @@
+#include <doctest/doctest.h>
+
+#include <Metrics.h>
+
+#include <string>
+
+using namespace NHttpProxy;
+
+namespace {
+
+bool Contains(const std::string& text, const std::string& line) {
+    return text.find(line + "\n") != std::string::npos;
+}
+
+}
+
+TEST_CASE("Counters and gauges are rendered with their help and type") {
+    TMetricsRegistry registry;
+    registry.AddCounter("requests_total", "Requests").Add(3);
+    registry.AddGauge("sessions", "Sessions").Add(-2);
+
+    std::string text = registry.Render();
+    CHECK(Contains(text, "# HELP requests_total Requests"));
+    CHECK(Contains(text, "# TYPE requests_total counter"));
+    CHECK(Contains(text, "requests_total 3"));
+    CHECK(Contains(text, "# TYPE sessions gauge"));
+    CHECK(Contains(text, "sessions -2"));
+}
+
+TEST_CASE("Histogram buckets are cumulative and in seconds") {
+    TMetricsRegistry registry;
+    THistogram& histogram = registry.AddHistogram("latency_seconds", "Latency");
+    histogram.Record(std::chrono::milliseconds(3));
+    histogram.Record(std::chrono::milliseconds(3));
+    histogram.Record(std::chrono::seconds(1000));
+
+    std::string text = registry.Render();
+    CHECK(Contains(text, "# TYPE latency_seconds histogram"));
+    CHECK(Contains(text, "latency_seconds_bucket{le=\"0.002047\"} 0"));
+    CHECK(Contains(text, "latency_seconds_bucket{le=\"0.004095\"} 2"));
+    CHECK(Contains(text, "latency_seconds_bucket{le=\"134.217727\"} 2"));
+    CHECK(Contains(text, "latency_seconds_bucket{le=\"+Inf\"} 3"));
+    CHECK(Contains(text, "latency_seconds_sum 1000.006"));
+    CHECK(Contains(text, "latency_seconds_count 3"));
+}
+
+TEST_CASE("Function metrics are read when rendered") {
+    TMetricsRegistry registry;
+    double ratio = 0.5;
+    registry.AddGaugeFunction("ratio", "Ratio", [&ratio] { return ratio; });
+    registry.AddCounterFunction("hits_total", "Hits", [] { return 123456789012.0; });
+
+    CHECK(Contains(registry.Render(), "ratio 0.5"));
+    ratio = 0.25;
+    std::string text = registry.Render();
+    CHECK(Contains(text, "ratio 0.25"));
+    CHECK(Contains(text, "# TYPE hits_total counter"));
+    CHECK(Contains(text, "hits_total 123456789012"));
+}
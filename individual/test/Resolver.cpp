@@ -0,0 +1,87 @@
+#include <doctest/doctest.h>
+
+#include <Resolver.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+using namespace NHttpProxy;
+
+namespace {
+
+struct TLookups {
+    int Succeeded = 0;
+    int Failed = 0;
+
+    TResolveCallback Callback() {
+        return [this](boost::system::error_code ec, boost::asio::ip::tcp::resolver::results_type results) {
+            if (ec) {
+                Failed++;
+            } else if (!results.empty()) {
+                Succeeded++;
+            }
+        };
+    }
+};
+
+TResolverOptions ShortTtls() {
+    TResolverOptions options;
+    options.Ttl = std::chrono::seconds(1);
+    options.NegativeTtl = std::chrono::seconds(1);
+    return options;
+}
+
+}
+
+TEST_CASE("Concurrent lookups of a name are merged and cached for the TTL") {
+    boost::asio::io_context context;
+    TResolver resolver(context, ShortTtls());
+    TLookups lookups;
+
+    for (int i = 0; i < 3; i++) {
+        resolver.AsyncResolve("localhost", "80", lookups.Callback());
+    }
+    context.run();
+    CHECK(lookups.Succeeded == 3);
+    CHECK(resolver.Lookups() == 1);
+
+    // A cache hit completes inline
+    resolver.AsyncResolve("localhost", "80", lookups.Callback());
+    CHECK(lookups.Succeeded == 4);
+    CHECK(resolver.Lookups() == 1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    resolver.AsyncResolve("localhost", "80", lookups.Callback());
+    CHECK(lookups.Succeeded == 4);
+    context.restart();
+    context.run();
+    CHECK(lookups.Succeeded == 5);
+    CHECK(resolver.Lookups() == 2);
+}
+
+TEST_CASE("A failed lookup is cached for the negative TTL") {
+    boost::asio::io_context context;
+    TResolver resolver(context, ShortTtls());
+    TLookups lookups;
+
+    resolver.AsyncResolve("unresolvable.invalid", "80", lookups.Callback());
+    resolver.AsyncResolve("unresolvable.invalid", "80", lookups.Callback());
+    context.run();
+    CHECK(lookups.Failed == 2);
+    CHECK(resolver.Lookups() == 1);
+
+    resolver.AsyncResolve("unresolvable.invalid", "80", lookups.Callback());
+    CHECK(lookups.Failed == 3);
+    CHECK(resolver.Lookups() == 1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    resolver.AsyncResolve("unresolvable.invalid", "80", lookups.Callback());
+    context.restart();
+    context.run();
+    CHECK(lookups.Failed == 4);
+    CHECK(resolver.Lookups() == 2);
+    CHECK(lookups.Succeeded == 0);
+}
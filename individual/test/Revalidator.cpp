@@ -0,0 +1,113 @@
+#include <doctest/doctest.h>
+
+#include <Revalidator.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+using namespace NHttpProxy;
+
+namespace {
+
+using boost::asio::ip::tcp;
+
+// Answers one request with the given response, or holds the connection
+// open without answering if it is empty
+class TOrigin {
+public:
+    explicit TOrigin(std::string response)
+        : Acceptor_(Context_, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0))
+        , Socket_(Context_)
+        , Thread_([this, response]() {
+            Acceptor_.accept(Socket_);
+            std::string request;
+            boost::system::error_code ec;
+            boost::asio::read_until(Socket_, boost::asio::dynamic_buffer(request), "\r\n\r\n", ec);
+            if (!response.empty()) {
+                boost::asio::write(Socket_, boost::asio::buffer(response), ec);
+            }
+        })
+    {}
+
+    ~TOrigin() {
+        Thread_.join();
+    }
+
+    std::string URL() const {
+        return "http://127.0.0.1:" + std::to_string(Acceptor_.local_endpoint().port()) + "/";
+    }
+
+private:
+    boost::asio::io_context Context_;
+    tcp::acceptor Acceptor_;
+    tcp::socket Socket_;
+    std::thread Thread_;
+};
+
+THttpRequest Request(const std::string& url) {
+    return THttpRequest(
+        THttpRequestLine("GET", url, "HTTP/1.1"),
+        THttpHeaders(std::vector<THttpHeader>{{"If-None-Match", "\"v1\""}}),
+        ""
+    );
+}
+
+// Cached and expired, within stale-while-revalidate
+void CacheStale(TDatabase& database, const std::string& url) {
+    THttpHeaders headers(std::vector<THttpHeader>{
+        {"Cache-Control", "max-age=1, stale-while-revalidate=60"},
+        {"ETag", "\"v1\""}
+    });
+    THttpResponse response(THttpResponseStatusLine("HTTP/1.1", "200", "OK"), headers, "body");
+    response.UpdateContentLength();
+    database.CacheResponse(Request(url), std::move(response));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    REQUIRE(database.ServeCached(Request(url)).value().Revalidate);
+}
+
+}
+
+TEST_CASE("A revalidation skips interim responses") {
+    TOrigin origin(
+        "HTTP/1.1 103 Early Hints\r\nLink: </a.css>\r\n\r\n"
+        "HTTP/1.1 304 Not Modified\r\nETag: \"v1\"\r\nCache-Control: max-age=60\r\n\r\n"
+    );
+    boost::asio::io_context context;
+    TDatabase database;
+    TResolver resolver(context, TResolverOptions{});
+    TConnectionPool pool(TConnectionPoolOptions{});
+    TRevalidator revalidator(TRevalidatorOptions{}, context, resolver, pool, database);
+    CacheStale(database, origin.URL());
+
+    revalidator.Revalidate(Request(origin.URL()));
+    context.run();
+
+    auto hit = database.ServeCached(Request(origin.URL()));
+    CHECK(!hit.value().Stale);
+    CHECK(!hit.value().Revalidate);
+    CHECK(database.Stats().Refreshes == 1);
+}
+
+TEST_CASE("A revalidation is given up after the timeout") {
+    TOrigin origin("");
+    boost::asio::io_context context;
+    TDatabase database;
+    TResolver resolver(context, TResolverOptions{});
+    TConnectionPool pool(TConnectionPoolOptions{});
+    TRevalidatorOptions options;
+    options.Timeout = std::chrono::seconds(1);
+    TRevalidator revalidator(options, context, resolver, pool, database);
+    CacheStale(database, origin.URL());
+
+    auto start = std::chrono::steady_clock::now();
+    revalidator.Revalidate(Request(origin.URL()));
+    context.run();
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+    // The next hit gets to try again
+    CHECK(database.ServeCached(Request(origin.URL())).value().Revalidate);
+    CHECK(database.Stats().Refreshes == 0);
+}
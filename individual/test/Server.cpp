@@ -0,0 +1,217 @@
+#include <doctest/doctest.h>
+
+#include <Server.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+using namespace NHttpProxy;
+
+namespace {
+
+using boost::asio::ip::tcp;
+
+const std::string ChunkedResponse =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Cache-Control: no-store\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n";
+
+// Answers the given number of requests with the chunked response, one per
+// connection. The response tells the requested URL in X-URL.
+class TOrigin {
+public:
+    explicit TOrigin(std::size_t requests)
+        : Acceptor_(Context_, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0))
+        , Thread_([this, requests]() { Serve(requests); })
+    {}
+
+    ~TOrigin() {
+        Thread_.join();
+    }
+
+    unsigned short Port() const {
+        return Acceptor_.local_endpoint().port();
+    }
+
+private:
+    void Serve(std::size_t requests) {
+        for (std::size_t i = 0; i < requests; i++) {
+            tcp::socket socket(Context_);
+            Acceptor_.accept(socket);
+            std::string request;
+            boost::system::error_code ec;
+            boost::asio::read_until(socket, boost::asio::dynamic_buffer(request), "\r\n\r\n", ec);
+            auto start = request.find(' ') + 1;
+            std::string target = request.substr(start, request.find(' ', start) - start);
+            std::string response = ChunkedResponse;
+            response.insert(response.find("\r\n") + 2, "X-URL: " + target + "\r\n");
+            boost::asio::write(socket, boost::asio::buffer(response), ec);
+        }
+    }
+
+    boost::asio::io_context Context_;
+    tcp::acceptor Acceptor_;
+    std::thread Thread_;
+};
+
+unsigned short FreePort() {
+    boost::asio::io_context context;
+    tcp::acceptor acceptor(context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+    return acceptor.local_endpoint().port();
+}
+
+// Sends the request over a new connection and reads until it is closed
+std::string Exchange(unsigned short port, const std::string& request) {
+    boost::asio::io_context context;
+    tcp::socket socket(context);
+    // The server starts listening once it runs
+    boost::system::error_code ec;
+    for (int attempt = 0; attempt < 100; attempt++) {
+        socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port), ec);
+        if (!ec) {
+            break;
+        }
+        socket.close();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    REQUIRE(!ec);
+    boost::asio::write(socket, boost::asio::buffer(request));
+    std::string response;
+    boost::asio::read(socket, boost::asio::dynamic_buffer(response), ec);
+    return response;
+}
+
+std::string Body(const std::string& response) {
+    auto end = response.find("\r\n\r\n");
+    return end == std::string::npos ? "" : response.substr(end + 4);
+}
+
+// The X-URL values of the responses, in the order they came
+std::vector<std::string> URLs(const std::string& responses) {
+    std::vector<std::string> ret;
+    const std::string name = "X-URL: ";
+    for (auto start = responses.find(name); start != std::string::npos; start = responses.find(name, start)) {
+        start += name.size();
+        ret.push_back(responses.substr(start, responses.find("\r\n", start) - start));
+    }
+    return ret;
+}
+
+std::string Get(const std::string& url) {
+    return "GET " + url + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+}
+
+}
+
+TEST_CASE("A chunked response reaches an HTTP/1.0 client decoded and delimited by the close") {
+    TOrigin origin(2);
+    std::string url = "http://127.0.0.1:" + std::to_string(origin.Port()) + "/";
+
+    TServerOptions options;
+    options.AccessLog.clear();
+    TServer server(options);
+    unsigned short port = FreePort();
+    server.Bind("127.0.0.1", std::to_string(port));
+    std::thread runner([&server]() { server.Run(); });
+
+    std::string old = Exchange(port, "GET " + url + " HTTP/1.0\r\n\r\n");
+    CHECK(old.rfind("HTTP/1.1 200", 0) == 0);
+    CHECK(old.find("chunked") == std::string::npos);
+    CHECK(Body(old) == "hello world");
+
+    std::string current = Exchange(port, "GET " + url + " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n");
+    CHECK(current.find("Transfer-Encoding: chunked") != std::string::npos);
+    CHECK(Body(current) == "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n");
+
+    server.Stop();
+    runner.join();
+}
+
+TEST_CASE("A malformed request is answered with 400 and the connection is closed") {
+    TServerOptions options;
+    options.AccessLog.clear();
+    TServer server(options);
+    unsigned short port = FreePort();
+    server.Bind("127.0.0.1", std::to_string(port));
+    std::thread runner([&server]() { server.Run(); });
+
+    std::string response = Exchange(port, "GARBAGE\r\n\r\nGET http://127.0.0.1:1/ HTTP/1.1\r\n\r\n");
+    CHECK(response.rfind("HTTP/1.1 400 Bad Request\r\n", 0) == 0);
+    CHECK(response.find("HTTP/1.1", 1) == std::string::npos);
+
+    server.Stop();
+    runner.join();
+}
+
+TEST_CASE("Pipelined requests are answered in order on the same connection") {
+    TOrigin origin(2);
+    std::string url = "http://127.0.0.1:" + std::to_string(origin.Port());
+
+    TServerOptions options;
+    options.AccessLog.clear();
+    TServer server(options);
+    unsigned short port = FreePort();
+    server.Bind("127.0.0.1", std::to_string(port));
+    std::thread runner([&server]() { server.Run(); });
+
+    // Both requests go in one write
+    std::string responses = Exchange(port,
+        Get(url + "/first") +
+        "GET " + url + "/second HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n");
+    CHECK(URLs(responses) == std::vector<std::string>{url + "/first", url + "/second"});
+
+    server.Stop();
+    runner.join();
+}
+
+TEST_CASE("The connection is closed after MaxRequests requests") {
+    TOrigin origin(2);
+    std::string url = "http://127.0.0.1:" + std::to_string(origin.Port());
+
+    TServerOptions options;
+    options.AccessLog.clear();
+    options.Session.MaxRequests = 2;
+    TServer server(options);
+    unsigned short port = FreePort();
+    server.Bind("127.0.0.1", std::to_string(port));
+    std::thread runner([&server]() { server.Run(); });
+
+    std::string responses = Exchange(port, Get(url + "/1") + Get(url + "/2") + Get(url + "/3"));
+    CHECK(URLs(responses) == std::vector<std::string>{url + "/1", url + "/2"});
+    CHECK(responses.find("Connection: keep-alive") < responses.find("Connection: close"));
+
+    server.Stop();
+    runner.join();
+}
+
+TEST_CASE("An idle connection is closed after IdleTimeout") {
+    TOrigin origin(1);
+    std::string url = "http://127.0.0.1:" + std::to_string(origin.Port());
+
+    TServerOptions options;
+    options.AccessLog.clear();
+    options.Session.IdleTimeout = std::chrono::seconds(1);
+    TServer server(options);
+    unsigned short port = FreePort();
+    server.Bind("127.0.0.1", std::to_string(port));
+    std::thread runner([&server]() { server.Run(); });
+
+    // The connection is kept alive after the response, until the timeout
+    auto start = std::chrono::steady_clock::now();
+    std::string response = Exchange(port, Get(url + "/"));
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    CHECK(URLs(response) == std::vector<std::string>{url + "/"});
+    CHECK(response.find("Connection: keep-alive") != std::string::npos);
+    CHECK(elapsed >= std::chrono::milliseconds(900));
+    CHECK(elapsed < std::chrono::seconds(5));
+
+    server.Stop();
+    runner.join();
+}